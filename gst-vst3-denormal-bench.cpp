@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+// Measures how long a chain of VST elements takes to process the decaying
+// tail after a short burst of audio, once with flush-denormals disabled and
+// once with it enabled. Filters and reverbs that decay exponentially end up
+// processing denormal numbers for most of the tail, which is many times
+// slower on most CPUs unless they are flushed to zero:
+//
+//   gst-vst3-denormal-bench "vstaudioprocessor-reverb size=0.9"
+//
+// The input is a sine burst followed by digital silence, processed as fast as
+// possible in offline mode. The best of all runs is reported for each setting.
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+#define DEFAULT_DURATION (60)
+#define DEFAULT_RUNS (3)
+#define BURST_DURATION (100 * GST_MSECOND)
+#define RATE (48000)
+#define SAMPLES_PER_BUFFER (1024)
+
+static gboolean
+is_vst_element(GstElement * element)
+{
+  return g_object_class_find_property(G_OBJECT_GET_CLASS(element), "process-mode") != nullptr
+      && g_object_class_find_property(G_OBJECT_GET_CLASS(element), "flush-denormals") != nullptr;
+}
+
+// Configures all VST elements of the chain and returns how many there are
+static guint
+configure_chain(GstElement * chain, gboolean flush_denormals)
+{
+  guint n_elements = 0;
+  GValue item = G_VALUE_INIT;
+
+  auto it = gst_bin_iterate_recurse(GST_BIN(chain));
+  while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+    auto element = GST_ELEMENT(g_value_get_object(&item));
+
+    if (is_vst_element(element)) {
+      gst_util_set_object_arg(G_OBJECT(element), "process-mode", "offline");
+      g_object_set(element, "flush-denormals", flush_denormals, nullptr);
+      n_elements++;
+    }
+    g_value_reset(&item);
+  }
+  g_value_unset(&item);
+  gst_iterator_free(it);
+
+  return n_elements;
+}
+
+// Silences everything after the burst so that only the tail of the chain is
+// left to process
+static GstPadProbeReturn
+on_source_output(GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+  if (!GST_BUFFER_PTS_IS_VALID(buffer) || GST_BUFFER_PTS(buffer) < BURST_DURATION)
+    return GST_PAD_PROBE_OK;
+
+  buffer = gst_buffer_make_writable(buffer);
+  gst_buffer_memset(buffer, 0, 0, gst_buffer_get_size(buffer));
+  GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+  return GST_PAD_PROBE_OK;
+}
+
+// Processes duration of audio through a new instance of the chain and
+// returns the elapsed wall-clock time, or GST_CLOCK_TIME_NONE on errors
+static GstClockTime
+run_chain(const gchar * description, gboolean flush_denormals, GstClockTime duration)
+{
+  GError *err = nullptr;
+
+  auto pipeline = gst_pipeline_new(nullptr);
+  auto src = gst_element_factory_make("audiotestsrc", nullptr);
+  auto sink = gst_element_factory_make("fakesink", nullptr);
+
+  if (!src || !sink) {
+    g_printerr("Missing core or base elements\n");
+    if (src)
+      gst_object_unref(src);
+    if (sink)
+      gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  auto chain = gst_parse_bin_from_description(description, TRUE, &err);
+  if (err) {
+    g_printerr("Invalid chain: %s\n", err->message);
+    g_error_free(err);
+    if (chain)
+      gst_object_unref(chain);
+    gst_object_unref(src);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  gst_bin_add_many(GST_BIN(pipeline), src, chain, sink, nullptr);
+
+  if (configure_chain(chain, flush_denormals) == 0) {
+    g_printerr("No VST element in the chain\n");
+    gst_object_unref(pipeline);
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  auto n_buffers = gst_util_uint64_scale(duration, RATE, GST_SECOND * SAMPLES_PER_BUFFER);
+  g_object_set(src, "num-buffers", (gint) MAX(n_buffers, 1), "samplesperbuffer", SAMPLES_PER_BUFFER,
+      "volume", 0.5, nullptr);
+  g_object_set(sink, "sync", FALSE, nullptr);
+
+  auto caps = gst_caps_new_simple("audio/x-raw",
+      "format", G_TYPE_STRING, GST_AUDIO_NE(F32),
+      "rate", G_TYPE_INT, RATE,
+      "channels", G_TYPE_INT, 2,
+      "layout", G_TYPE_STRING, "interleaved", nullptr);
+  auto linked = gst_element_link_filtered(src, chain, caps) && gst_element_link(chain, sink);
+  gst_caps_unref(caps);
+
+  if (!linked) {
+    g_printerr("Failed to link pipeline\n");
+    gst_object_unref(pipeline);
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  auto src_pad = gst_element_get_static_pad(src, "src");
+  gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, on_source_output, nullptr, nullptr);
+  gst_object_unref(src_pad);
+
+  auto bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = nullptr;
+  auto elapsed = GST_CLOCK_TIME_NONE;
+
+  // Opening the plugin is not measured
+  gst_element_set_state(pipeline, GST_STATE_READY);
+  auto start = g_get_monotonic_time();
+
+  if (gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE)
+    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        (GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  else
+    msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+
+  if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+    elapsed = (g_get_monotonic_time() - start) * GST_USECOND;
+  } else if (msg) {
+    gchar *debug;
+
+    gst_message_parse_error(msg, &err, &debug);
+    g_printerr("%s: %s\n", GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)), err->message);
+    g_error_free(err);
+    g_free(debug);
+  } else {
+    g_printerr("Failed to start pipeline\n");
+  }
+
+  if (msg)
+    gst_message_unref(msg);
+  gst_object_unref(bus);
+
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+
+  return elapsed;
+}
+
+// Returns the fastest of n_runs runs, or GST_CLOCK_TIME_NONE on errors
+static GstClockTime
+measure(const gchar * description, gboolean flush_denormals, GstClockTime duration,
+    gint n_runs)
+{
+  auto best = GST_CLOCK_TIME_NONE;
+
+  for (auto i = 0; i < n_runs; i++) {
+    auto elapsed = run_chain(description, flush_denormals, duration);
+
+    if (!GST_CLOCK_TIME_IS_VALID(elapsed))
+      return GST_CLOCK_TIME_NONE;
+    best = GST_CLOCK_TIME_IS_VALID(best) ? MIN(best, elapsed) : elapsed;
+  }
+
+  g_print("flush-denormals=%s: %" GST_TIME_FORMAT " of audio in %" GST_TIME_FORMAT
+      " (%.1fx real-time)\n", flush_denormals ? "true" : "false",
+      GST_TIME_ARGS(duration), GST_TIME_ARGS(best),
+      best > 0 ? (gdouble) duration / best : 0.0);
+
+  return best;
+}
+
+int
+main(int argc, char ** argv)
+{
+  gint duration = DEFAULT_DURATION;
+  gint n_runs = DEFAULT_RUNS;
+  GError *err = nullptr;
+  GOptionEntry entries[] = {
+    {"duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+        "Seconds of audio to process per run (default: 60)", "SECONDS"},
+    {"runs", 'r', 0, G_OPTION_ARG_INT, &n_runs,
+        "Number of runs per setting, the fastest is reported (default: 3)", "N"},
+    {nullptr}
+  };
+
+  auto context = g_option_context_new("CHAIN - time the decaying tail of VST elements "
+      "with and without flush-denormals");
+  g_option_context_add_main_entries(context, entries, nullptr);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &err)) {
+    g_printerr("%s\n", err->message);
+    g_error_free(err);
+    g_option_context_free(context);
+    return 1;
+  }
+  g_option_context_free(context);
+
+  if (argc != 2 || duration <= 0 || n_runs <= 0) {
+    g_printerr("Usage: %s [-d SECONDS] [-r N] CHAIN\n", argv[0]);
+    return 1;
+  }
+
+  auto duration_time = duration * GST_SECOND;
+  auto without = measure(argv[1], FALSE, duration_time, n_runs);
+  auto with = GST_CLOCK_TIME_IS_VALID(without) ?
+      measure(argv[1], TRUE, duration_time, n_runs) : GST_CLOCK_TIME_NONE;
+
+  if (!GST_CLOCK_TIME_IS_VALID(with))
+    return 1;
+
+  g_print("Flushing denormals is %.2fx as fast\n", with > 0 ? (gdouble) without / with : 0.0);
+
+  return 0;
+}
@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+// Renders many files through chains of VST elements. Every job of the job
+// file runs in a pipeline of its own, and a number of them run concurrently
+// on worker threads of this process. All pipelines use the elements of the
+// plugin, so plugin modules are loaded once and shared by all jobs.
+//
+// The job file is a key file with one group per job:
+//
+//   [hall-take1]
+//   input=take1.wav
+//   output=take1-hall.flac
+//   chain=vstaudioprocessor-reverb name=reverb size=0.8 ! vstaudioprocessor-limiter
+//   encoder=flacenc
+//   preset.reverb=hall.vstpreset
+//
+// chain is a gst-launch description of the elements between decoder and
+// encoder. encoder is a gst-launch description too and defaults to wavenc.
+// preset is loaded into the only VST element of the chain, and preset.NAME
+// into the element with that name.
+
+#include <gst/gst.h>
+
+#include <string.h>
+
+#include <initializer_list>
+
+#define DEFAULT_ENCODER "wavenc"
+
+typedef struct {
+  gchar *name;
+  gchar *input;
+  gchar *output;
+  gchar *chain;
+  gchar *encoder;
+  // Element name, or "" for the only VST element, to preset file
+  GHashTable *presets;
+
+  // Result
+  gboolean ok;
+  gchar *error;
+  GstClockTime audio_duration;
+  GstClockTime elapsed;
+} Job;
+
+typedef struct {
+  Job *jobs;
+  guint n_jobs;
+
+  GMutex lock;
+  guint next_job;
+  guint n_failed;
+} Render;
+
+static void
+job_clear(Job * job)
+{
+  g_free(job->name);
+  g_free(job->input);
+  g_free(job->output);
+  g_free(job->chain);
+  g_free(job->encoder);
+  if (job->presets)
+    g_hash_table_unref(job->presets);
+  g_free(job->error);
+}
+
+static gboolean
+load_jobs(Render * render, const gchar * path, GError ** error)
+{
+  auto key_file = g_key_file_new();
+  gsize n_groups;
+
+  if (!g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, error)) {
+    g_key_file_free(key_file);
+    return FALSE;
+  }
+
+  auto groups = g_key_file_get_groups(key_file, &n_groups);
+  render->jobs = g_new0(Job, n_groups);
+  render->n_jobs = 0;
+
+  for (auto i = 0U; i < n_groups; i++) {
+    auto job = &render->jobs[render->n_jobs++];
+    gsize n_keys;
+
+    job->name = g_strdup(groups[i]);
+    job->input = g_key_file_get_string(key_file, groups[i], "input", error);
+    job->output = job->input ? g_key_file_get_string(key_file, groups[i], "output", error) : nullptr;
+    job->chain = job->output ? g_key_file_get_string(key_file, groups[i], "chain", error) : nullptr;
+    if (!job->chain)
+      break;
+
+    job->encoder = g_key_file_get_string(key_file, groups[i], "encoder", nullptr);
+    if (!job->encoder)
+      job->encoder = g_strdup(DEFAULT_ENCODER);
+
+    job->presets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    auto keys = g_key_file_get_keys(key_file, groups[i], &n_keys, nullptr);
+    for (auto k = 0U; k < n_keys; k++) {
+      if (strcmp(keys[k], "preset") == 0)
+        g_hash_table_insert(job->presets, g_strdup(""),
+            g_key_file_get_string(key_file, groups[i], keys[k], nullptr));
+      else if (g_str_has_prefix(keys[k], "preset."))
+        g_hash_table_insert(job->presets, g_strdup(keys[k] + strlen("preset.")),
+            g_key_file_get_string(key_file, groups[i], keys[k], nullptr));
+    }
+    g_strfreev(keys);
+  }
+
+  g_strfreev(groups);
+  g_key_file_free(key_file);
+
+  return error == nullptr || *error == nullptr;
+}
+
+static void
+on_pad_added(GstElement * decodebin, GstPad * pad, gpointer user_data)
+{
+  auto convert = GST_ELEMENT(user_data);
+  auto sinkpad = gst_element_get_static_pad(convert, "sink");
+
+  // Only the first audio stream is rendered
+  if (!gst_pad_is_linked(sinkpad)) {
+    auto caps = gst_pad_get_current_caps(pad);
+    if (!caps)
+      caps = gst_pad_query_caps(pad, nullptr);
+
+    auto structure = gst_caps_get_structure(caps, 0);
+    if (g_str_has_prefix(gst_structure_get_name(structure), "audio/"))
+      gst_pad_link(pad, sinkpad);
+    gst_caps_unref(caps);
+  }
+
+  gst_object_unref(sinkpad);
+}
+
+static GstPadProbeReturn
+on_chain_output(GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  auto end = (GstClockTime *) user_data;
+  auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+  if (GST_BUFFER_PTS_IS_VALID(buffer) && GST_BUFFER_DURATION_IS_VALID(buffer))
+    *end = MAX(*end, GST_BUFFER_PTS(buffer) + GST_BUFFER_DURATION(buffer));
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+is_vst_element(GstElement * element)
+{
+  return g_object_class_find_property(G_OBJECT_GET_CLASS(element), "process-mode") != nullptr
+      && g_object_class_find_property(G_OBJECT_GET_CLASS(element), "state") != nullptr;
+}
+
+static gboolean
+load_preset(GstElement * element, const gchar * location, gchar ** error)
+{
+  gchar *contents;
+  gsize size;
+  GError *err = nullptr;
+
+  if (!g_file_get_contents(location, &contents, &size, &err)) {
+    *error = g_strdup(err->message);
+    g_error_free(err);
+    return FALSE;
+  }
+
+  // Restored when the element opens the plugin
+  auto state = g_bytes_new_take(contents, size);
+  g_object_set(element, "state", state, nullptr);
+  g_bytes_unref(state);
+
+  return TRUE;
+}
+
+// Switches all VST elements of the chain to offline processing and sets up
+// their presets
+static gboolean
+configure_chain(Job * job, GstElement * chain, gchar ** error)
+{
+  GstElement *only_element = nullptr;
+  guint n_elements = 0;
+  GValue item = G_VALUE_INIT;
+  auto ret = TRUE;
+
+  auto it = gst_bin_iterate_recurse(GST_BIN(chain));
+  while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+    auto element = GST_ELEMENT(g_value_get_object(&item));
+
+    if (is_vst_element(element)) {
+      gst_util_set_object_arg(G_OBJECT(element), "process-mode", "offline");
+      only_element = element;
+      n_elements++;
+    }
+    g_value_reset(&item);
+  }
+  g_value_unset(&item);
+  gst_iterator_free(it);
+
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init(&iter, job->presets);
+  while (ret && g_hash_table_iter_next(&iter, &key, &value)) {
+    auto name = (const gchar *) key;
+    GstElement *element;
+
+    if (name[0] == '\0') {
+      if (n_elements != 1) {
+        *error = g_strdup_printf("preset needs exactly one VST element in the chain, "
+            "use preset.NAME instead");
+        return FALSE;
+      }
+      element = GST_ELEMENT(gst_object_ref(only_element));
+    } else {
+      element = gst_bin_get_by_name(GST_BIN(chain), name);
+      if (!element || !is_vst_element(element)) {
+        *error = g_strdup_printf("No VST element '%s' in the chain", name);
+        if (element)
+          gst_object_unref(element);
+        return FALSE;
+      }
+    }
+
+    ret = load_preset(element, (const gchar *) value, error);
+    gst_object_unref(element);
+  }
+
+  return ret;
+}
+
+// Decodes the input, runs it through the chain and encodes the output. The
+// duration of the rendered audio is measured at the output of the chain
+static gboolean
+run_job(Job * job)
+{
+  GError *err = nullptr;
+  GstClockTime end = 0;
+
+  auto pipeline = gst_pipeline_new(job->name);
+  auto src = gst_element_factory_make("filesrc", nullptr);
+  auto decodebin = gst_element_factory_make("decodebin", nullptr);
+  auto convert_in = gst_element_factory_make("audioconvert", nullptr);
+  auto resample = gst_element_factory_make("audioresample", nullptr);
+  auto convert_out = gst_element_factory_make("audioconvert", nullptr);
+  auto sink = gst_element_factory_make("filesink", nullptr);
+
+  if (!src || !decodebin || !convert_in || !resample || !convert_out || !sink) {
+    job->error = g_strdup("Missing core or base elements");
+    for (auto element : { src, decodebin, convert_in, resample, convert_out, sink }) {
+      if (element)
+        gst_object_unref(element);
+    }
+    gst_object_unref(pipeline);
+    return FALSE;
+  }
+
+  gst_bin_add_many(GST_BIN(pipeline), src, decodebin, convert_in, resample,
+      convert_out, sink, nullptr);
+
+  auto chain = gst_parse_bin_from_description(job->chain, TRUE, &err);
+  if (err) {
+    job->error = g_strdup_printf("Invalid chain: %s", err->message);
+    g_error_free(err);
+    if (chain)
+      gst_object_unref(chain);
+    gst_object_unref(pipeline);
+    return FALSE;
+  }
+  gst_bin_add(GST_BIN(pipeline), chain);
+
+  auto encoder = gst_parse_bin_from_description(job->encoder, TRUE, &err);
+  if (err) {
+    job->error = g_strdup_printf("Invalid encoder: %s", err->message);
+    g_error_free(err);
+    if (encoder)
+      gst_object_unref(encoder);
+    gst_object_unref(pipeline);
+    return FALSE;
+  }
+  gst_bin_add(GST_BIN(pipeline), encoder);
+
+  if (!configure_chain(job, chain, &job->error)) {
+    gst_object_unref(pipeline);
+    return FALSE;
+  }
+
+  g_object_set(src, "location", job->input, nullptr);
+  g_object_set(sink, "location", job->output, nullptr);
+  g_signal_connect(decodebin, "pad-added", G_CALLBACK(on_pad_added), convert_in);
+
+  if (!gst_element_link(src, decodebin)
+      || !gst_element_link_many(convert_in, resample, chain, convert_out, encoder, sink, nullptr)) {
+    job->error = g_strdup("Failed to link pipeline");
+    gst_object_unref(pipeline);
+    return FALSE;
+  }
+
+  auto chain_src = gst_element_get_static_pad(chain, "src");
+  gst_pad_add_probe(chain_src, GST_PAD_PROBE_TYPE_BUFFER, on_chain_output, &end, nullptr);
+  gst_object_unref(chain_src);
+
+  auto start = g_get_monotonic_time();
+  auto bus = gst_element_get_bus(pipeline);
+  GstMessage *msg = nullptr;
+
+  if (gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE)
+    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        (GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  else
+    msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+
+  if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+    job->ok = TRUE;
+  } else if (msg) {
+    gchar *debug;
+
+    gst_message_parse_error(msg, &err, &debug);
+    job->error = g_strdup_printf("%s: %s", GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)), err->message);
+    g_error_free(err);
+    g_free(debug);
+  } else {
+    job->error = g_strdup("Failed to start pipeline");
+  }
+
+  if (msg)
+    gst_message_unref(msg);
+  gst_object_unref(bus);
+
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+
+  job->elapsed = (g_get_monotonic_time() - start) * GST_USECOND;
+  job->audio_duration = end;
+
+  return job->ok;
+}
+
+static void
+report_job(const Job * job)
+{
+  if (!job->ok) {
+    g_printerr("%s: FAILED: %s\n", job->name, job->error);
+    return;
+  }
+
+  auto realtime_factor = job->elapsed > 0 ? (gdouble) job->audio_duration / job->elapsed : 0.0;
+  g_print("%s: %" GST_TIME_FORMAT " of audio in %" GST_TIME_FORMAT " (%.1fx real-time)\n",
+      job->name, GST_TIME_ARGS(job->audio_duration), GST_TIME_ARGS(job->elapsed),
+      realtime_factor);
+}
+
+static gpointer
+worker_thread(gpointer data)
+{
+  auto render = (Render *) data;
+
+  g_mutex_lock(&render->lock);
+  while (render->next_job < render->n_jobs) {
+    auto job = &render->jobs[render->next_job++];
+    g_mutex_unlock(&render->lock);
+
+    auto ok = run_job(job);
+
+    g_mutex_lock(&render->lock);
+    if (!ok)
+      render->n_failed++;
+    report_job(job);
+  }
+  g_mutex_unlock(&render->lock);
+
+  return nullptr;
+}
+
+int
+main(int argc, char ** argv)
+{
+  gint n_workers = 0;
+  GError *err = nullptr;
+  Render render = { };
+  GOptionEntry entries[] = {
+    {"jobs", 'j', 0, G_OPTION_ARG_INT, &n_workers,
+        "Number of jobs to run concurrently (default: number of processors)", "N"},
+    {nullptr}
+  };
+
+  auto context = g_option_context_new("JOB-FILE - render files through VST elements");
+  g_option_context_add_main_entries(context, entries, nullptr);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &err)) {
+    g_printerr("%s\n", err->message);
+    g_error_free(err);
+    g_option_context_free(context);
+    return 1;
+  }
+  g_option_context_free(context);
+
+  if (argc != 2) {
+    g_printerr("Usage: %s [-j N] JOB-FILE\n", argv[0]);
+    return 1;
+  }
+
+  if (!load_jobs(&render, argv[1], &err)) {
+    g_printerr("Failed to load jobs from '%s': %s\n", argv[1], err->message);
+    g_error_free(err);
+    for (auto i = 0U; i < render.n_jobs; i++)
+      job_clear(&render.jobs[i]);
+    g_free(render.jobs);
+    return 1;
+  }
+
+  if (n_workers <= 0)
+    n_workers = g_get_num_processors();
+  n_workers = MIN((guint) n_workers, MAX(render.n_jobs, 1));
+
+  g_mutex_init(&render.lock);
+
+  auto workers = g_new0(GThread *, n_workers);
+  for (auto i = 0; i < n_workers; i++) {
+    auto name = g_strdup_printf("render-%d", i);
+    workers[i] = g_thread_new(name, worker_thread, &render);
+    g_free(name);
+  }
+  for (auto i = 0; i < n_workers; i++)
+    g_thread_join(workers[i]);
+  g_free(workers);
+
+  g_print("%u of %u jobs failed\n", render.n_failed, render.n_jobs);
+
+  auto ret = render.n_failed > 0 ? 1 : 0;
+
+  for (auto i = 0U; i < render.n_jobs; i++)
+    job_clear(&render.jobs[i]);
+  g_free(render.jobs);
+  g_mutex_clear(&render.lock);
+
+  return ret;
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+// Helper process of the sandbox, see gstvstsandbox.h. Started by the element
+// with the shared memory and eventfd file descriptors on the command line,
+// and runs one plugin instance until it is told to close or the element
+// goes away
+
+#include "plugin.h"
+#include "gstvstinstance.h"
+#include "gstvstsandbox.h"
+
+#include <vst/hosting/hostclasses.h>
+#include <base/source/fstring.h>
+#include <common/memorystream.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+GST_DEBUG_CATEGORY(gst_vst_audio_processor_debug);
+#define GST_CAT_DEFAULT gst_vst_audio_processor_debug
+
+using namespace Steinberg;
+
+namespace Steinberg {
+  FUnknown* gStandardPluginContext = nullptr;
+};
+
+class GStreamerSandboxHostApplication: public Vst::HostApplication {
+public:
+  GStreamerSandboxHostApplication() { }
+
+  tresult PLUGIN_API getName(Vst::String128 name) override
+  {
+    String str ("GStreamer VST Plugin");
+    str.copyTo16 (name, 0, 127);
+    return kResultTrue;
+  }
+};
+
+typedef struct {
+  int shm_fd;
+  GstVstSandboxHeader *header;
+  gsize size;
+
+  GstVstAudioProcessorInfo processor_info;
+  GstVstInstance instance;
+} Sandbox;
+
+static gboolean
+sandbox_map(Sandbox * sandbox, gsize size)
+{
+  if (sandbox->header)
+    munmap(sandbox->header, sandbox->size);
+
+  auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, sandbox->shm_fd, 0);
+  if (p == MAP_FAILED) {
+    sandbox->header = nullptr;
+    return FALSE;
+  }
+
+  sandbox->header = (GstVstSandboxHeader *) p;
+  sandbox->size = size;
+
+  return TRUE;
+}
+
+static tresult
+sandbox_get_state(Sandbox * sandbox)
+{
+  auto header = sandbox->header;
+  MemoryStream stream;
+
+  auto res = sandbox->instance.component->getState(&stream);
+  if (res != kResultOk)
+    return res;
+
+  auto size = (gsize) stream.getSize();
+  if (size > sandbox->size - gst_vst_sandbox_data_offset()) {
+    GST_WARNING("Component state of %" G_GSIZE_FORMAT " bytes too big", size);
+    return kOutOfMemory;
+  }
+
+  memcpy((guint8 *) header + gst_vst_sandbox_data_offset(), stream.getData(), size);
+  header->state_size = size;
+
+  return kResultOk;
+}
+
+static tresult
+sandbox_set_state(Sandbox * sandbox)
+{
+  auto header = sandbox->header;
+
+  if (header->state_size > sandbox->size - gst_vst_sandbox_data_offset())
+    return kInvalidArgument;
+
+  MemoryStream stream((guint8 *) header + gst_vst_sandbox_data_offset(), header->state_size);
+
+  return sandbox->instance.component->setState(&stream);
+}
+
+static tresult
+sandbox_setup(Sandbox * sandbox)
+{
+  auto header = sandbox->header;
+  GstAudioInfo info;
+
+  gst_audio_info_set_format(&info, (GstAudioFormat) header->format, header->rate,
+      header->channels, nullptr);
+
+  if (header->max_samples <= 0 || sandbox->size < gst_vst_sandbox_data_offset()
+      + 2 * gst_vst_sandbox_audio_size(info.bpf, header->max_samples))
+    return kInvalidArgument;
+
+  if (!gst_vst_instance_setup(&sandbox->instance, &info,
+      (Vst::ProcessModes) header->process_mode, header->max_samples))
+    return kResultFalse;
+
+  return kResultOk;
+}
+
+static tresult
+sandbox_process(Sandbox * sandbox)
+{
+  auto header = sandbox->header;
+  auto instance = &sandbox->instance;
+  auto data = (guint8 *) header + gst_vst_sandbox_data_offset();
+  Vst::ParameterChanges in_parameter_changes;
+  guint n_out_samples = 0;
+
+  if (instance->state < GST_VST_INSTANCE_STATE_PROCESSING || header->n_samples > instance->data_len)
+    return kInvalidArgument;
+
+  gst_vst_sandbox_read_parameter_changes(header->in_points,
+      MIN(header->n_in_points, GST_VST_SANDBOX_MAX_PARAMETER_POINTS), &in_parameter_changes);
+  auto out_parameter_changes = gst_vst_instance_get_out_parameter_changes(instance);
+
+  gst_vst_instance_set_flush_denormals(instance, header->flush_denormals);
+  auto res = gst_vst_instance_process(instance, data,
+      data + gst_vst_sandbox_audio_size(instance->info.bpf, instance->data_len),
+      header->n_samples, header->sample_position, header->input_silent,
+      header->n_in_points > 0 ? &in_parameter_changes : nullptr,
+      out_parameter_changes, &n_out_samples);
+
+  header->n_out_samples = n_out_samples;
+  header->n_out_points = gst_vst_sandbox_write_parameter_changes(header->out_points,
+      out_parameter_changes);
+
+  return res;
+}
+
+static void
+sandbox_run(Sandbox * sandbox, int request_fd, int response_fd, int alive_fd)
+{
+  auto instance = &sandbox->instance;
+  auto running = TRUE;
+
+  while (running) {
+    guint64 value;
+
+    // Wait for the next command or for the element to go away. Our end of
+    // the alive pipe reports an error once the element closed the other end,
+    // e.g. because its process exited or crashed
+    struct pollfd fds[2] = { { request_fd, POLLIN, 0 }, { alive_fd, 0, 0 } };
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents & (POLLERR | POLLHUP))
+      break;
+    if (!(fds[0].revents & POLLIN))
+      continue;
+
+    if (read(request_fd, &value, sizeof(value)) != sizeof(value))
+      break;
+
+    // The element grew the shared memory, e.g. for a new configuration
+    if (sandbox->header->size != sandbox->size && !sandbox_map(sandbox, sandbox->header->size))
+      break;
+
+    auto header = sandbox->header;
+    tresult res = kResultFalse;
+
+    switch (header->command) {
+      case GST_VST_SANDBOX_COMMAND_OPEN:
+        if (gst_vst_instance_open(instance, nullptr, &sandbox->processor_info))
+          res = instance->component->getControllerClassId(header->controller_class_id);
+        break;
+      case GST_VST_SANDBOX_COMMAND_GET_STATE:
+        if (instance->state >= GST_VST_INSTANCE_STATE_INITIALIZED)
+          res = sandbox_get_state(sandbox);
+        break;
+      case GST_VST_SANDBOX_COMMAND_SET_STATE:
+        if (instance->state >= GST_VST_INSTANCE_STATE_INITIALIZED)
+          res = sandbox_set_state(sandbox);
+        break;
+      case GST_VST_SANDBOX_COMMAND_SETUP:
+        if (instance->state >= GST_VST_INSTANCE_STATE_INITIALIZED)
+          res = sandbox_setup(sandbox);
+        break;
+      case GST_VST_SANDBOX_COMMAND_ACTIVATE:
+        res = gst_vst_instance_activate(instance) ? kResultOk : kResultFalse;
+        break;
+      case GST_VST_SANDBOX_COMMAND_DEACTIVATE:
+        gst_vst_instance_deactivate(instance);
+        res = kResultOk;
+        break;
+      case GST_VST_SANDBOX_COMMAND_PROCESS:
+        res = sandbox_process(sandbox);
+        break;
+      case GST_VST_SANDBOX_COMMAND_CLOSE:
+        gst_vst_instance_close(instance);
+        res = kResultOk;
+        running = FALSE;
+        break;
+      default:
+        GST_WARNING("Unknown command %u", header->command);
+        break;
+    }
+
+    if (instance->state >= GST_VST_INSTANCE_STATE_SETUP) {
+      header->latency_samples = instance->audio_processor->getLatencySamples();
+      header->tail_samples = gst_vst_instance_get_tail_samples(instance);
+    }
+    header->result = res;
+
+    value = 1;
+    if (write(response_fd, &value, sizeof(value)) != sizeof(value))
+      break;
+  }
+}
+
+int
+main(int argc, char ** argv)
+{
+  Sandbox sandbox = { };
+
+  if (argc != 9) {
+    g_printerr("Usage: %s SHM-FD REQUEST-FD RESPONSE-FD ALIVE-FD MEMORY-LIMIT "
+        "PATH CLASS-ID NAME\n\nOnly meant to be started by the vst3 GStreamer plugin\n",
+        argv[0]);
+    return 1;
+  }
+
+  sandbox.shm_fd = atoi(argv[1]);
+  auto request_fd = atoi(argv[2]);
+  auto response_fd = atoi(argv[3]);
+  // The element notices when we exit and we notice when it exits
+  auto alive_fd = atoi(argv[4]);
+  auto memory_limit = g_ascii_strtoull(argv[5], nullptr, 10);
+
+  // Applies to everything the plugin allocates from here on
+  if (memory_limit > 0) {
+    struct rlimit limit;
+
+    limit.rlim_cur = limit.rlim_max = memory_limit;
+    if (setrlimit(RLIMIT_AS, &limit) != 0)
+      g_printerr("Failed to set memory limit of %" G_GUINT64_FORMAT " bytes\n", memory_limit);
+  }
+
+  gst_init(nullptr, nullptr);
+  GST_DEBUG_CATEGORY_INIT(gst_vst_audio_processor_debug, "vst-audio-processor", 0,
+      "VST Audio Processor sandbox");
+
+  auto class_id = VST3::UID::fromString(argv[7]);
+  if (!class_id) {
+    GST_ERROR("Invalid class ID '%s'", argv[7]);
+    return 1;
+  }
+
+  struct stat st;
+  if (fstat(sandbox.shm_fd, &st) != 0 || (gsize) st.st_size < gst_vst_sandbox_data_offset()
+      || !sandbox_map(&sandbox, st.st_size)) {
+    GST_ERROR("Failed to map shared memory");
+    return 1;
+  }
+
+  gStandardPluginContext = new GStreamerSandboxHostApplication();
+
+  // Busses besides the main ones are not supported in the sandbox
+  sandbox.processor_info.name = argv[8];
+  sandbox.processor_info.path = argv[6];
+  sandbox.processor_info.class_id = *class_id;
+
+  GST_DEBUG("Running '%s' from %s", argv[8], argv[6]);
+
+  sandbox_run(&sandbox, request_fd, response_fd, alive_fd);
+
+  close(alive_fd);
+
+  return 0;
+}
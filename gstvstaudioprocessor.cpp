@@ -24,6 +24,10 @@
 
 #include "plugin.h"
 #include "gstvstaudioprocessor.h"
+#include "gstvstinstance.h"
+#include "gstvstmultiaudioprocessor.h"
+#include "gstvstscheduler.h"
+#include "gstvstsegmentrenderer.h"
 
 #include <gst/audio/audio.h>
 #include <gst/base/base.h>
@@ -31,19 +35,24 @@
 #include <common/memorystream.h>
 #include <vst/hosting/module.h>
 #include <vst/vstcomponent.h>
+#include <vst/vstpresetfile.h>
 #include <vst/vsteditcontroller.h>
 #include <vst/hosting/stringconvert.h>
 #include <vst/hosting/parameterchanges.h>
-#include <pluginterfaces/vst/ivstprocesscontext.h>
 #include <pluginterfaces/vst/ivstaudioprocessor.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
 #if defined(G_OS_WIN32)
 #include <windows.h>
 #include <shlobj.h>
 #pragma comment(lib, "Shell32")
 #endif
 
-GST_DEBUG_CATEGORY_STATIC(gst_vst_audio_processor_debug);
+GST_DEBUG_CATEGORY(gst_vst_audio_processor_debug);
 #define GST_CAT_DEFAULT gst_vst_audio_processor_debug
 
 using namespace Steinberg;
@@ -61,8 +70,26 @@ static gboolean gst_vst_audio_processor_sink_event(GstPad * pad,
     GstObject * parent, GstEvent * event);
 static gboolean gst_vst_audio_processor_src_query(GstPad * pad,
     GstObject * parent, GstQuery * query);
+static gboolean gst_vst_audio_processor_src_event(GstPad * pad,
+    GstObject * parent, GstEvent * event);
+static GstFlowReturn gst_vst_audio_processor_chain_blocks(GstVstAudioProcessor *self,
+    GstBuffer * in_buffer);
+static GstFlowReturn gst_vst_audio_processor_drain_blocks(GstVstAudioProcessor *self);
+static GstBuffer *gst_vst_audio_processor_take_block(GstVstAudioProcessor *self,
+    gsize size);
+static GstFlowReturn gst_vst_audio_processor_chain_buffer(GstVstAudioProcessor *self,
+    GstBuffer * in_buffer);
+static GstIterator *gst_vst_audio_processor_sink_iterate_internal_links(GstPad * pad,
+    GstObject * parent);
 
 static void gst_vst_audio_processor_finalize(GObject * object);
+static gboolean gst_vst_audio_processor_load_state(GstVstAudioProcessor * self,
+    GBytes * state);
+static gboolean gst_vst_audio_processor_load_preset(GstVstAudioProcessor * self,
+    const gchar * location);
+static GBytes *gst_vst_audio_processor_get_state(GstVstAudioProcessor * self);
+static void gst_vst_audio_processor_set_state(GstVstAudioProcessor * self,
+    GBytes * state);
 static void gst_vst_audio_processor_get_property(GObject * object,
     guint property_id, GValue * value, GParamSpec * pspec);
 static void gst_vst_audio_processor_set_property(GObject * object,
@@ -75,71 +102,117 @@ static void gst_vst_audio_processor_sub_set_property(GObject * object,
 
 static GstStateChangeReturn gst_vst_audio_processor_change_state(GstElement *
     element, GstStateChange transition);
+static GstPad *gst_vst_audio_processor_request_new_pad(GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_vst_audio_processor_release_pad(GstElement * element,
+    GstPad * pad);
+static void gst_vst_audio_processor_reset_levels(GstVstAudioProcessor *self);
 
-// The different states the audio processor can be in
-typedef enum {
-  STATE_NONE = 0,
-  STATE_CREATED,
-  STATE_INITIALIZED,
-  STATE_SETUP,
-  STATE_ACTIVE,
-  STATE_PROCESSING,
-} State;
+static GstFlowReturn gst_vst_audio_processor_aux_sink_chain(GstPad * pad,
+    GstObject * parent, GstBuffer * buffer);
+static gboolean gst_vst_audio_processor_aux_sink_event(GstPad * pad,
+    GstObject * parent, GstEvent * event);
 
 enum {
   PROP_0 = 0,
   PROP_MAX_SAMPLES_PER_CHUNK,
+  PROP_PROCESS_MODE,
+  PROP_PARALLEL_SEGMENTS,
+  PROP_SEGMENT_DURATION,
+  PROP_SEGMENT_OVERLAP,
+  PROP_USE_SCHEDULER,
+  PROP_SCHEDULER_LOAD,
+  PROP_PARAMETERS,
+  PROP_NOTIFY_INTERVAL,
+  PROP_METER_INTERVAL,
+  PROP_LOCK_MEMORY,
+  PROP_FLUSH_DENORMALS,
+  PROP_QOS_POLICY,
+  PROP_QOS_THRESHOLD,
+  PROP_BYPASS,
+  PROP_BYPASS_CROSSFADE,
+  PROP_BLOCK_SIZE,
+  PROP_SANDBOX,
+  PROP_SANDBOX_MEMORY_LIMIT,
+  PROP_STATE_CROSSFADE,
+  PROP_STATE,
+  PROP_PARAMETER_RAMP_TIME,
+  PROP_ASYNC_OPEN,
+  PROP_ASYNC_OPEN_FALLBACK,
+  PROP_LEVEL_INTERVAL,
+  PROP_LEVEL_META,
 };
 
-#define DEFAULT_MAX_SAMPLES_PER_CHUNK (1024)
-
-// Communication between edit controller and component happens over this. We
-// don't really use this as we don't want to use the GUI provided by the
-// controller.
-class GstVstAudioProcessorComponentHandler: public Vst::IComponentHandler {
-public:
-  GstVstAudioProcessorComponentHandler(GstVstAudioProcessor * processor): processor(processor) { FUNKNOWN_CTOR }
-
-  virtual ~GstVstAudioProcessorComponentHandler() { FUNKNOWN_DTOR }
-
-  DECLARE_FUNKNOWN_METHODS
-
-  tresult PLUGIN_API beginEdit(Vst::ParamID id) override {
-    GST_FIXME_OBJECT(processor, "beginEdit not implemented");
-    return kNotImplemented;
-  }
-  tresult PLUGIN_API performEdit(Vst::ParamID id, Vst::ParamValue valueNormalized) override {
-    GST_FIXME_OBJECT(processor, "performEdit not implemented");
-    return kNotImplemented;
-  }
-  tresult PLUGIN_API endEdit(Vst::ParamID id) override {
-    GST_FIXME_OBJECT(processor, "endEdit not implemented");
-    return kNotImplemented;
-  }
-  tresult PLUGIN_API restartComponent(int32 flags) override {
-    // TODO: Maybe want to do something with the other ones?
-    GST_DEBUG_OBJECT(processor, "restartComponent(0x%08x)", flags);
-
-    if (flags & Vst::kLatencyChanged) {
-      gst_element_post_message(GST_ELEMENT_CAST(processor),
-          gst_message_new_latency(GST_OBJECT_CAST(processor)));
-    }
+enum {
+  SIGNAL_LOAD_STATE,
+  SIGNAL_LOAD_PRESET,
+  LAST_SIGNAL
+};
 
-    return kResultOk;
-  }
+static guint gst_vst_audio_processor_signals[LAST_SIGNAL] = { 0 };
 
-  GstVstAudioProcessor * processor;
-};
+#define DEFAULT_MAX_SAMPLES_PER_CHUNK (1024)
+#define DEFAULT_PROCESS_MODE GST_VST_PROCESS_MODE_PREFETCH
+#define DEFAULT_PARALLEL_SEGMENTS (0)
+#define DEFAULT_SEGMENT_DURATION (10 * GST_SECOND)
+#define DEFAULT_SEGMENT_OVERLAP (1 * GST_SECOND)
+#define DEFAULT_USE_SCHEDULER (FALSE)
+#define DEFAULT_NOTIFY_INTERVAL (0)
+#define DEFAULT_METER_INTERVAL (0)
+#define DEFAULT_LOCK_MEMORY (FALSE)
+#define DEFAULT_FLUSH_DENORMALS (TRUE)
+#define DEFAULT_QOS_POLICY (GST_VST_QOS_POLICY_NONE)
+#define DEFAULT_QOS_THRESHOLD (20 * GST_MSECOND)
+#define DEFAULT_BYPASS (FALSE)
+#define DEFAULT_BYPASS_CROSSFADE (10 * GST_MSECOND)
+#define DEFAULT_BLOCK_SIZE (0)
+#define DEFAULT_SANDBOX (FALSE)
+#define DEFAULT_SANDBOX_MEMORY_LIMIT (0)
+#define DEFAULT_STATE_CROSSFADE (50 * GST_MSECOND)
+#define DEFAULT_PARAMETER_RAMP_TIME (0)
+#define DEFAULT_ASYNC_OPEN (FALSE)
+#define DEFAULT_ASYNC_OPEN_FALLBACK (GST_VST_ASYNC_OPEN_FALLBACK_PASSTHROUGH)
+#define DEFAULT_LEVEL_INTERVAL (0)
+#define DEFAULT_LEVEL_META (FALSE)
+
+// Name of the custom meta with the levels of an output buffer
+#define GST_VST_LEVEL_META "GstVstLevelMeta"
+// Level in dB reported for silence, like the level element does
+#define LEVEL_FLOOR (-700.0)
+
+// Request sink pad for an auxiliary input bus, e.g. a sidechain. Its data is
+// queued until the main sink pad processes the same running time
+typedef struct {
+  guint bus;
+  GstPad *pad;
 
-IMPLEMENT_REFCOUNT(GstVstAudioProcessorComponentHandler);
-DECLARE_CLASS_IID(GstVstAudioProcessorComponentHandler, 0x8f2a46d5, 0x148a4e40, 0xab996b56, 0xc2c615cf);
+  // Protected by aux lock
+  GstAdapter *adapter;
+  // Running time of the first sample in the adapter
+  GstClockTime running_time;
+  GstSegment segment;
+  GstAudioInfo info;
+  gboolean eos;
+  gboolean flushing;
+} GstVstAudioProcessorAuxPad;
 
-tresult GstVstAudioProcessorComponentHandler::queryInterface(const char * iid, void ** obj) {
-  QUERY_INTERFACE(iid, obj, FUnknown::iid, FUnknown);
-  QUERY_INTERFACE(iid, obj, Vst::IComponentHandler::iid, Vst::IComponentHandler);
-  *obj = nullptr;
-  return kNoInterface;
-}
+// Linear ramp of a parameter, in normalized values as seen by the component
+typedef struct {
+  // Value at the start of the next chunk
+  gdouble value;
+  gdouble target;
+  // Change per sample
+  gdouble step;
+  // Samples until target is reached, 0 if not ramping
+  guint64 remaining;
+} GstVstAudioProcessorRamp;
+
+// Parameter change of a vst-parameter-change event, in plain values
+typedef struct {
+  GstClockTime running_time;
+  guint idx;
+  gdouble value;
+} GstVstAudioProcessorParameterChange;
 
 struct _GstVstAudioProcessor {
   GstElement element;
@@ -148,60 +221,171 @@ struct _GstVstAudioProcessor {
 
   // Properties
   gint max_samples_per_chunk;
+  GstVstProcessMode process_mode;
+  guint parallel_segments;
+  GstClockTime segment_duration;
+  GstClockTime segment_overlap;
+  gboolean use_scheduler;
+  GstClockTime notify_interval;
+  GstClockTime meter_interval;
+  gboolean lock_memory;
+  gboolean flush_denormals;
+  GstVstQosPolicy qos_policy;
+  GstClockTime qos_threshold;
+  gboolean bypass;
+  GstClockTime bypass_crossfade;
+  gint block_size;
+  gboolean sandbox;
+  guint64 sandbox_memory_limit;
+  GstClockTime state_crossfade;
+  // Snapshot that is restored instead of the parameter values when opening,
+  // protected by object lock
+  GBytes *state;
+  GstClockTime parameter_ramp_time;
+  gboolean async_open;
+  GstVstAsyncOpenFallback async_open_fallback;
+  GstClockTime level_interval;
+  gboolean level_meta;
 
   // Protected by object lock
+  // Running time before which output is too late according to the last QoS
+  // event, and the proportion from it. Also whether no QoS message was posted
+  // since then
+  GstClockTime earliest_time;
+  gdouble proportion;
+  gboolean qos_message_pending;
+
   Vst::ParameterChanges *parameter_changes;
+  // Written with the object lock and parameter_values_seq, read without
+  // lock via gst_vst_audio_processor_read_parameter_values()
   gdouble *parameter_values;
+  gint parameter_values_seq;
 
   // State
   // Protected by stream lock
+  // Output parameters that changed since the last notification, only used
+  // with notify-interval > 0
+  gboolean *changed_parameters;
+  gboolean have_changed_parameters;
+  // Indices and plain values of the parameters the component changed during
+  // the last process() call, collected before parameter_values is written
+  guint *output_indices;
+  gdouble *output_values;
+  // Per parameter, and the number of parameters that are currently ramping
+  GstVstAudioProcessorRamp *ramps;
+  guint n_ramping;
+  // Input parameter changes of the current chunk while ramping or with
+  // scheduled changes, reused for every chunk
+  Steinberg::Vst::ParameterChanges *ramp_parameter_changes;
+  // Changes of vst-parameter-change events that are not applied yet, sorted
+  // by running time
+  GQueue scheduled_changes;
+
+  // With async-open, the plugin is opened on open_thread while the input is
+  // passed through. opening stays set until the instance took over or
+  // opening failed. Written atomically with object lock, read atomically
+  // without by the streaming thread
+  GThread *open_thread;
+  gboolean opening;
+  // Protected by object lock
+  // Opened instance waiting to take over, and the parameter values of its
+  // restored state if any
+  GstVstInstance *opened_instance;
+  gdouble *opened_parameter_values;
+  gint64 last_notify_time;
+  // Running time at which the next meter message is due, only used with
+  // meter-interval > 0
+  GstClockTime next_meter_time;
+  // Peak and sum of squares per channel of the output since the last
+  // vst-level message and when the next one is due, only used with
+  // level-interval > 0
+  gdouble level_peaks[GST_VST_MAX_CHANNELS];
+  gdouble level_sums[GST_VST_MAX_CHANNELS];
+  guint64 level_samples;
+  GstClockTime next_level_time;
+
   GstSegment segment;
   GstAudioInfo info;
   GstClockTime latency;
 
-  State state;
-  std::shared_ptr<VST3::Hosting::Module> module;
-  IPtr<Vst::IComponent> component;
-  IPtr<Vst::IEditController> edit_controller;
-  IPtr<Vst::IAudioProcessor> audio_processor;
-  IPtr<GstVstAudioProcessorComponentHandler> component_handler;
-
-  // Temporary buffer space used for deinterleaving
-  gpointer in_data[2];
-  gpointer out_data[2];
-  guint data_len;
+  // Input delayed by the latency of the plugin, used instead of the output
+  // of the plugin while bypassing. nullptr if not needed. Also the samples of
+  // silence it still starts with, until then bypass can't be entered
+  GstAdapter *dry_adapter;
+  guint dry_silence_left;
+  // Input that is accumulated until block-size samples are available, and
+  // whether the next block starts after a discontinuity. nullptr if not
+  // accumulating
+  GstAdapter *input_adapter;
+  gboolean input_discont;
+  // Whether the output currently is (or is fading to) the dry path, and the
+  // remaining and total samples of the crossfade. After leaving bypass, the
+  // crossfade only starts once the restarted plugin produced its latency
+  gboolean bypassed;
+  guint crossfade_left;
+  guint crossfade_samples;
+  guint crossfade_delay_left;
+  // Processed and shed samples for QoS statistics
+  guint64 qos_processed;
+  guint64 qos_dropped;
+
+  GstVstInstance instance;
+  // Instance with a newly loaded state that replaces the current one at the
+  // next chunk, and the parameter values of that state. Protected by object
+  // lock
+  GstVstInstance *standby_instance;
+  gdouble *standby_parameter_values;
+  // Replaced instance whose output is crossfaded to the output of the
+  // current one, and the remaining and total samples of that crossfade.
+  // Protected by stream lock
+  GstVstInstance *fading_instance;
+  guint state_crossfade_left;
+  guint state_crossfade_samples;
+  // Instance with a newly loaded state that processes the input next to the
+  // current one until it produced its latency of valid output, its parameter
+  // values and the remaining samples. Protected by stream lock
+  GstVstInstance *priming_instance;
+  gdouble *priming_parameter_values;
+  guint priming_left;
+  // Output of the fading or priming instance for one chunk, protected by
+  // stream lock
+  guint8 *state_data;
+  // Number of get_state() calls reading from the plugin without the object
+  // lock, and set while the current instance is closed. Protected by object
+  // lock
+  guint state_readers;
+  gboolean closing;
+  GCond state_cond;
+  // Only used for offline processing with parallel-segments > 0
+  GstVstSegmentRenderer *segment_renderer;
+  // Only used with use-scheduler=true, between READY and PAUSED
+  GstVstSchedulerClient *scheduler_client;
+
+  // One entry per auxiliary input bus, nullptr if not requested
+  GMutex aux_lock;
+  GCond aux_cond;
+  GstVstAudioProcessorAuxPad **aux_pads;
+  // Set while the main sink pad is flushing, protected by aux lock
+  gboolean flushing;
+  // Interleaved auxiliary input of one chunk, protected by stream lock
+  guint8 *aux_data;
+
+  // One src pad per auxiliary output bus, and their output of the current
+  // chunk. Protected by stream lock
+  GstPad **aux_srcpads;
+  GstBuffer **aux_out_buffers;
+  GstMapInfo *aux_out_maps;
+  GstFlowCombiner *flow_combiner;
 };
 
 struct _GstVstAudioProcessorClass {
   GstElementClass parent_class;
 
   const GstVstAudioProcessorInfo *processor_info;
-};
 
-// Property definition
-typedef struct {
-  Vst::ParamID param_id;
-  const gchar *name;
-  const gchar *nick;
-  const gchar *description;
-  GType type;            // float, bool, int
-  gint32 max_value;      // for int
-  gdouble default_value;
-  gboolean read_only;
-
-  GParamSpec *pspec;
-} GstVstAudioProcessorProperty;
-
-// Class information extracted from component
-struct _GstVstAudioProcessorInfo {
-  const gchar *name;
-  GstCaps *caps;
-  const gchar *path;
-  VST3::UID class_id;
-
-  // properties[0] -> GObject property ID 1
-  GstVstAudioProcessorProperty *properties;
-  guint n_properties;
+  // Action signals
+  gboolean (*load_state) (GstVstAudioProcessor * self, GBytes * state);
+  gboolean (*load_preset) (GstVstAudioProcessor * self, const gchar * location);
 };
 
 GType
@@ -232,6 +416,68 @@ gst_vst_audio_processor_get_type(void)
   return type;
 }
 
+GType
+gst_vst_process_mode_get_type(void)
+{
+  static volatile gsize type = 0;
+
+  if (g_once_init_enter(&type)) {
+    static const GEnumValue values[] = {
+      {GST_VST_PROCESS_MODE_AUTO,
+          "Realtime for live pipelines, offline otherwise", "auto"},
+      {GST_VST_PROCESS_MODE_REALTIME, "Realtime", "realtime"},
+      {GST_VST_PROCESS_MODE_PREFETCH, "Prefetch", "prefetch"},
+      {GST_VST_PROCESS_MODE_OFFLINE, "Offline", "offline"},
+      {0, nullptr, nullptr}
+    };
+
+    auto _type = g_enum_register_static("GstVstProcessMode", values);
+
+    g_once_init_leave(&type, _type);
+  }
+  return type;
+}
+
+GType
+gst_vst_qos_policy_get_type(void)
+{
+  static volatile gsize type = 0;
+
+  if (g_once_init_enter(&type)) {
+    static const GEnumValue values[] = {
+      {GST_VST_QOS_POLICY_NONE, "Always process", "none"},
+      {GST_VST_QOS_POLICY_REALTIME, "Switch the plugin to realtime mode", "realtime"},
+      {GST_VST_QOS_POLICY_BYPASS, "Output the unprocessed input", "bypass"},
+      {GST_VST_QOS_POLICY_DROP, "Output gaps", "drop"},
+      {0, nullptr, nullptr}
+    };
+
+    auto _type = g_enum_register_static("GstVstQosPolicy", values);
+
+    g_once_init_leave(&type, _type);
+  }
+  return type;
+}
+
+GType
+gst_vst_async_open_fallback_get_type(void)
+{
+  static volatile gsize type = 0;
+
+  if (g_once_init_enter(&type)) {
+    static const GEnumValue values[] = {
+      {GST_VST_ASYNC_OPEN_FALLBACK_PASSTHROUGH, "Output the unprocessed input", "passthrough"},
+      {GST_VST_ASYNC_OPEN_FALLBACK_SILENCE, "Output silence", "silence"},
+      {0, nullptr, nullptr}
+    };
+
+    auto _type = g_enum_register_static("GstVstAsyncOpenFallback", values);
+
+    g_once_init_leave(&type, _type);
+  }
+  return type;
+}
+
 static void
 gst_vst_audio_processor_sub_class_init(GstVstAudioProcessorClass * klass)
 {
@@ -254,6 +500,20 @@ gst_vst_audio_processor_sub_class_init(GstVstAudioProcessorClass * klass)
   templ = gst_pad_template_new("src", GST_PAD_SRC, GST_PAD_ALWAYS, processor_info->caps);
   gst_element_class_add_pad_template(element_class, templ);
 
+  if (processor_info->n_aux_inputs > 0) {
+    templ = gst_pad_template_new("aux_sink_%u", GST_PAD_SINK, GST_PAD_REQUEST, processor_info->caps);
+    gst_element_class_add_pad_template(element_class, templ);
+  }
+
+  // The auxiliary outputs can have any number of channels
+  if (processor_info->n_aux_outputs > 0) {
+    auto aux_src_caps = gst_caps_copy(processor_info->caps);
+    gst_caps_set_simple(aux_src_caps, "channels", GST_TYPE_INT_RANGE, 1, G_MAXINT, nullptr);
+    templ = gst_pad_template_new("aux_src_%u", GST_PAD_SRC, GST_PAD_ALWAYS, aux_src_caps);
+    gst_element_class_add_pad_template(element_class, templ);
+    gst_caps_unref(aux_src_caps);
+  }
+
   auto longname = g_strdup_printf("VST3 Audio processor - %s", processor_info->name);
   gst_element_class_set_metadata(element_class,
       processor_info->name,
@@ -268,23 +528,7 @@ gst_vst_audio_processor_sub_class_init(GstVstAudioProcessorClass * klass)
 
     for (auto i = 0U; i < processor_info->n_properties; i++) {
       auto property = &processor_info->properties[i];
-      GParamSpec *param_spec;
-
-      if (property->type == G_TYPE_DOUBLE) {
-        param_spec = g_param_spec_double(property->name, property->nick, property->description,
-            -G_MAXDOUBLE, G_MAXDOUBLE,
-            property->default_value,
-            (GParamFlags) ((property->read_only ? G_PARAM_READABLE : G_PARAM_READWRITE) | GST_PARAM_CONTROLLABLE));
-      } else if (property->type == G_TYPE_BOOLEAN) {
-        param_spec = g_param_spec_boolean(property->name, property->nick, property->description,
-            property->default_value > 0.5,
-            (GParamFlags) ((property->read_only ? G_PARAM_READABLE : G_PARAM_READWRITE) | GST_PARAM_CONTROLLABLE));
-      } else {
-        param_spec = g_param_spec_int(property->name, property->nick, property->description,
-            0, property->max_value,
-            property->default_value,
-            (GParamFlags) ((property->read_only ? G_PARAM_READABLE : G_PARAM_READWRITE) | GST_PARAM_CONTROLLABLE));
-      }
+      auto param_spec = gst_vst_audio_processor_property_new_param_spec(property);
       property->pspec = param_spec;
 
       g_object_class_install_property(gobject_class, i + 1, param_spec);
@@ -311,7 +555,226 @@ gst_vst_audio_processor_class_init(GstVstAudioProcessorClass * klass)
           (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
           GST_PARAM_MUTABLE_READY)));
 
+  g_object_class_install_property (gobject_class, PROP_PROCESS_MODE,
+      g_param_spec_enum ("process-mode", "Process Mode",
+          "Processing mode the plugin is configured for. Offline allows "
+          "high-quality algorithms, realtime asks for low-CPU processing",
+          GST_TYPE_VST_PROCESS_MODE, DEFAULT_PROCESS_MODE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_PARALLEL_SEGMENTS,
+      g_param_spec_uint ("parallel-segments", "Parallel Segments",
+          "Number of segments of the stream that are rendered in parallel by "
+          "separate plugin instances in offline mode (0 = disabled)", 0,
+          G_MAXUINT, DEFAULT_PARALLEL_SEGMENTS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_SEGMENT_DURATION,
+      g_param_spec_uint64 ("segment-duration", "Segment Duration",
+          "Duration of each segment when rendering segments in parallel", 1,
+          G_MAXUINT64, DEFAULT_SEGMENT_DURATION,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_SEGMENT_OVERLAP,
+      g_param_spec_uint64 ("segment-overlap", "Segment Overlap",
+          "Duration of the previous segment that is processed and discarded "
+          "for warming up the instance of each segment. At least the latency "
+          "and tail of the plugin are used", 0,
+          G_MAXUINT64, DEFAULT_SEGMENT_OVERLAP,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_USE_SCHEDULER,
+      g_param_spec_boolean ("use-scheduler", "Use Scheduler",
+          "Run process() calls on the process-wide DSP scheduler instead of "
+          "the streaming thread. Fails to go to PAUSED if the scheduler's "
+          "load budget is exhausted", DEFAULT_USE_SCHEDULER,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_SCHEDULER_LOAD,
+      g_param_spec_double ("scheduler-load", "Scheduler Load",
+          "Average CPU time per time of processed audio as measured by the "
+          "DSP scheduler", 0.0, G_MAXDOUBLE, 0.0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property (gobject_class, PROP_PARAMETERS,
+      g_param_spec_boxed ("parameters", "Parameters",
+          "Values of all plugin parameters, with the property names as field "
+          "names. Setting this applies all contained values at once, at the "
+          "beginning of the same chunk",
+          GST_TYPE_STRUCTURE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property (gobject_class, PROP_NOTIFY_INTERVAL,
+      g_param_spec_uint64 ("notify-interval", "Notify Interval",
+          "Minimum interval between notifications about parameters changed "
+          "by the plugin. If non-zero, all changes are reported together in "
+          "a vst-parameters-changed element message instead of property "
+          "notifications from the streaming thread (0 = notify every change)",
+          0, G_MAXUINT64, DEFAULT_NOTIFY_INTERVAL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING)));
+
+  g_object_class_install_property (gobject_class, PROP_METER_INTERVAL,
+      g_param_spec_uint64 ("meter-interval", "Meter Interval",
+          "Interval in running time at which the values of all read-only "
+          "parameters are posted in a vst-meters element message (0 = disabled)",
+          0, G_MAXUINT64, DEFAULT_METER_INTERVAL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING)));
+
+  g_object_class_install_property (gobject_class, PROP_LOCK_MEMORY,
+      g_param_spec_boolean ("lock-memory", "Lock Memory",
+          "Lock the scratch memory of the plugin instance into RAM and touch "
+          "all of its pages before processing starts", DEFAULT_LOCK_MEMORY,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_FLUSH_DENORMALS,
+      g_param_spec_boolean ("flush-denormals", "Flush Denormals",
+          "Flush denormal floating point numbers to zero while the plugin "
+          "is processing", DEFAULT_FLUSH_DENORMALS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_QOS_POLICY,
+      g_param_spec_enum ("qos-policy", "QoS Policy",
+          "How to shed load when output is later than qos-threshold "
+          "according to QoS events from downstream",
+          GST_TYPE_VST_QOS_POLICY, DEFAULT_QOS_POLICY,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_QOS_THRESHOLD,
+      g_param_spec_uint64 ("qos-threshold", "QoS Threshold",
+          "Lateness after which the qos-policy is applied", 0,
+          G_MAXUINT64, DEFAULT_QOS_THRESHOLD,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING)));
+
+  g_object_class_install_property (gobject_class, PROP_BYPASS,
+      g_param_spec_boolean ("bypass", "Bypass",
+          "Output the input, delayed by the latency of the plugin, without "
+          "calling the plugin at all", DEFAULT_BYPASS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING)));
+
+  g_object_class_install_property (gobject_class, PROP_BYPASS_CROSSFADE,
+      g_param_spec_uint64 ("bypass-crossfade", "Bypass Crossfade",
+          "Duration of the crossfade when entering or leaving bypass", 0,
+          G_MAXUINT64, DEFAULT_BYPASS_CROSSFADE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING)));
+
+  g_object_class_install_property (gobject_class, PROP_BLOCK_SIZE,
+      g_param_spec_int ("block-size", "Block Size",
+          "Accumulate input until this many samples are available and process "
+          "them together, at the cost of the same amount of additional "
+          "latency (0 = process every buffer as it arrives)", 0,
+          G_MAXINT, DEFAULT_BLOCK_SIZE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_SANDBOX,
+      g_param_spec_boolean ("sandbox", "Sandbox",
+          "Run the plugin in a separate helper process so that crashes of the "
+          "plugin don't affect the rest of the pipeline (Linux only)",
+          DEFAULT_SANDBOX,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_SANDBOX_MEMORY_LIMIT,
+      g_param_spec_uint64 ("sandbox-memory-limit", "Sandbox Memory Limit",
+          "Maximum address space of the sandbox helper process in bytes "
+          "(0 = unlimited)", 0, G_MAXUINT64, DEFAULT_SANDBOX_MEMORY_LIMIT,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_STATE_CROSSFADE,
+      g_param_spec_uint64 ("state-crossfade", "State Crossfade",
+          "Duration of the crossfade from the previous to the new state when "
+          "a state is loaded while processing", 0, G_MAXUINT64,
+          DEFAULT_STATE_CROSSFADE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING)));
+
+  g_object_class_install_property (gobject_class, PROP_STATE,
+      g_param_spec_boxed ("state", "State",
+          "Snapshot of the complete state of the plugin in .vstpreset format. "
+          "Setting it in NULL restores it when opening instead of the "
+          "parameter values, otherwise it is loaded like with load-state",
+          G_TYPE_BYTES,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property (gobject_class, PROP_PARAMETER_RAMP_TIME,
+      g_param_spec_uint64 ("parameter-ramp-time", "Parameter Ramp Time",
+          "Duration of the linear ramp towards a new value of a continuous "
+          "parameter (0 = change at the start of the next chunk)", 0, G_MAXUINT64,
+          DEFAULT_PARAMETER_RAMP_TIME,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING)));
+
+  g_object_class_install_property (gobject_class, PROP_ASYNC_OPEN,
+      g_param_spec_boolean ("async-open", "Async Open",
+          "Open the plugin on a background thread instead of blocking the "
+          "change to READY, and output async-open-fallback until it is ready",
+          DEFAULT_ASYNC_OPEN,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_ASYNC_OPEN_FALLBACK,
+      g_param_spec_enum ("async-open-fallback", "Async Open Fallback",
+          "What to output until the plugin opened with async-open is ready",
+          GST_TYPE_VST_ASYNC_OPEN_FALLBACK, DEFAULT_ASYNC_OPEN_FALLBACK,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_LEVEL_INTERVAL,
+      g_param_spec_uint64 ("level-interval", "Level Interval",
+          "Interval in running time at which the peak and RMS levels of the "
+          "output are posted in a vst-level element message (0 = disabled)",
+          0, G_MAXUINT64, DEFAULT_LEVEL_INTERVAL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING)));
+
+#if GST_CHECK_VERSION(1, 20, 0)
+  g_object_class_install_property (gobject_class, PROP_LEVEL_META,
+      g_param_spec_boolean ("level-meta", "Level Meta",
+          "Attach the peak and RMS levels of every output buffer as "
+          GST_VST_LEVEL_META " custom meta", DEFAULT_LEVEL_META,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING)));
+
+  static const gchar *level_meta_tags[] = { GST_META_TAG_AUDIO_STR, nullptr };
+  gst_meta_register_custom(GST_VST_LEVEL_META, level_meta_tags, nullptr, nullptr, nullptr);
+#endif
+
+  // Loads a component state or the contents of a .vstpreset file into a
+  // second instance and switches to it at the next chunk. Blocks the caller
+  // until the new instance is ready, but never the streaming thread
+  gst_vst_audio_processor_signals[SIGNAL_LOAD_STATE] =
+      g_signal_new ("load-state", G_TYPE_FROM_CLASS (klass),
+      (GSignalFlags) (G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION),
+      G_STRUCT_OFFSET (GstVstAudioProcessorClass, load_state), nullptr, nullptr,
+      g_cclosure_marshal_generic, G_TYPE_BOOLEAN, 1, G_TYPE_BYTES);
+
+  // Same as load-state with the contents of a .vstpreset file
+  gst_vst_audio_processor_signals[SIGNAL_LOAD_PRESET] =
+      g_signal_new ("load-preset", G_TYPE_FROM_CLASS (klass),
+      (GSignalFlags) (G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION),
+      G_STRUCT_OFFSET (GstVstAudioProcessorClass, load_preset), nullptr, nullptr,
+      g_cclosure_marshal_generic, G_TYPE_BOOLEAN, 1, G_TYPE_STRING);
+
+  klass->load_state = gst_vst_audio_processor_load_state;
+  klass->load_preset = gst_vst_audio_processor_load_preset;
+
   gstelement_class->change_state = gst_vst_audio_processor_change_state;
+  gstelement_class->request_new_pad = gst_vst_audio_processor_request_new_pad;
+  gstelement_class->release_pad = gst_vst_audio_processor_release_pad;
 }
 
 static void
@@ -323,6 +786,8 @@ gst_vst_audio_processor_init(GstVstAudioProcessor * self, GstVstAudioProcessorCl
       GST_DEBUG_FUNCPTR (gst_vst_audio_processor_sink_chain));
   gst_pad_set_event_function (self->sinkpad,
       GST_DEBUG_FUNCPTR (gst_vst_audio_processor_sink_event));
+  gst_pad_set_iterate_internal_links_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_vst_audio_processor_sink_iterate_internal_links));
   GST_PAD_SET_PROXY_CAPS (self->sinkpad);
   gst_element_add_pad (GST_ELEMENT (self), self->sinkpad);
 
@@ -330,25 +795,94 @@ gst_vst_audio_processor_init(GstVstAudioProcessor * self, GstVstAudioProcessorCl
   self->srcpad = gst_pad_new_from_template (src_templ, "src");
   gst_pad_set_query_function (self->srcpad,
       GST_DEBUG_FUNCPTR (gst_vst_audio_processor_src_query));
+  gst_pad_set_event_function (self->srcpad,
+      GST_DEBUG_FUNCPTR (gst_vst_audio_processor_src_event));
   GST_PAD_SET_PROXY_CAPS (self->srcpad);
   gst_pad_use_fixed_caps (self->srcpad);
   gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
 
-  self->state = STATE_NONE;
-  self->module = nullptr;
-  self->component = nullptr;
-  self->audio_processor = nullptr;
-  self->edit_controller = nullptr;
-  self->component_handler = nullptr;
+  self->flow_combiner = gst_flow_combiner_new();
+  gst_flow_combiner_add_pad(self->flow_combiner, self->srcpad);
+
+  // Auxiliary outputs get their caps from the configuration of the plugin
+  // and events from the main sink pad
+  auto n_aux_outputs = klass->processor_info->n_aux_outputs;
+  self->aux_srcpads = g_new0(GstPad *, n_aux_outputs);
+  self->aux_out_buffers = g_new0(GstBuffer *, n_aux_outputs);
+  self->aux_out_maps = g_new0(GstMapInfo, n_aux_outputs);
+  if (n_aux_outputs > 0) {
+    auto aux_src_templ = gst_element_class_get_pad_template(GST_ELEMENT_CLASS(klass), "aux_src_%u");
+
+    for (auto i = 0U; i < n_aux_outputs; i++) {
+      auto pad_name = g_strdup_printf("aux_src_%u", i);
+      auto pad = gst_pad_new_from_template (aux_src_templ, pad_name);
+      g_free(pad_name);
+
+      gst_pad_set_query_function (pad,
+          GST_DEBUG_FUNCPTR (gst_vst_audio_processor_src_query));
+      gst_pad_use_fixed_caps (pad);
+      gst_element_add_pad (GST_ELEMENT (self), pad);
+      gst_flow_combiner_add_pad(self->flow_combiner, pad);
+      self->aux_srcpads[i] = pad;
+    }
+  }
+
+  self->instance.state = GST_VST_INSTANCE_STATE_NONE;
+
+  g_mutex_init(&self->aux_lock);
+  g_cond_init(&self->aux_cond);
+  g_cond_init(&self->state_cond);
+  self->aux_pads = g_new0(GstVstAudioProcessorAuxPad *, klass->processor_info->n_aux_inputs);
 
   self->max_samples_per_chunk = DEFAULT_MAX_SAMPLES_PER_CHUNK;
+  self->process_mode = DEFAULT_PROCESS_MODE;
+  self->parallel_segments = DEFAULT_PARALLEL_SEGMENTS;
+  self->segment_duration = DEFAULT_SEGMENT_DURATION;
+  self->segment_overlap = DEFAULT_SEGMENT_OVERLAP;
+  self->use_scheduler = DEFAULT_USE_SCHEDULER;
+  self->notify_interval = DEFAULT_NOTIFY_INTERVAL;
+  self->meter_interval = DEFAULT_METER_INTERVAL;
+  self->lock_memory = DEFAULT_LOCK_MEMORY;
+  self->flush_denormals = DEFAULT_FLUSH_DENORMALS;
+  self->qos_policy = DEFAULT_QOS_POLICY;
+  self->qos_threshold = DEFAULT_QOS_THRESHOLD;
+  self->bypass = DEFAULT_BYPASS;
+  self->bypass_crossfade = DEFAULT_BYPASS_CROSSFADE;
+  self->block_size = DEFAULT_BLOCK_SIZE;
+  self->sandbox = DEFAULT_SANDBOX;
+  self->sandbox_memory_limit = DEFAULT_SANDBOX_MEMORY_LIMIT;
+  self->state_crossfade = DEFAULT_STATE_CROSSFADE;
+  self->parameter_ramp_time = DEFAULT_PARAMETER_RAMP_TIME;
+  self->async_open = DEFAULT_ASYNC_OPEN;
+  self->async_open_fallback = DEFAULT_ASYNC_OPEN_FALLBACK;
+  self->level_interval = DEFAULT_LEVEL_INTERVAL;
+  self->level_meta = DEFAULT_LEVEL_META;
+  self->earliest_time = GST_CLOCK_TIME_NONE;
+  self->proportion = 1.0;
+  self->next_meter_time = GST_CLOCK_TIME_NONE;
+  self->next_level_time = GST_CLOCK_TIME_NONE;
 
   // Initialize all properties as stored here with their default values
+  self->changed_parameters = g_new0(gboolean, klass->processor_info->n_properties);
+  self->output_indices = g_new0(guint, klass->processor_info->n_properties);
+  self->output_values = g_new0(gdouble, klass->processor_info->n_properties);
+  self->ramps = g_new0(GstVstAudioProcessorRamp, klass->processor_info->n_properties);
+  self->ramp_parameter_changes = new Vst::ParameterChanges(klass->processor_info->n_properties);
+  g_queue_init(&self->scheduled_changes);
   self->parameter_values = g_new0(gdouble, klass->processor_info->n_properties);
   for (auto i = 0U; i < klass->processor_info->n_properties; i++)
     self->parameter_values[i] = klass->processor_info->properties[i].default_value;
 }
 
+static void
+gst_vst_audio_processor_clear_scheduled_changes(GstVstAudioProcessor *self)
+{
+  gpointer change;
+
+  while ((change = g_queue_pop_head(&self->scheduled_changes)))
+    g_slice_free(GstVstAudioProcessorParameterChange, change);
+}
+
 static void
 gst_vst_audio_processor_finalize(GObject * object)
 {
@@ -357,381 +891,2929 @@ gst_vst_audio_processor_finalize(GObject * object)
   if (self->parameter_changes)
     delete self->parameter_changes;
   g_free(self->parameter_values);
+  // A state that finished loading after the element was shut down
+  if (self->standby_instance) {
+    gst_vst_instance_close(self->standby_instance);
+    delete self->standby_instance;
+  }
+  g_free(self->standby_parameter_values);
+  g_free(self->state_data);
+  if (self->state)
+    g_bytes_unref(self->state);
+  g_free(self->changed_parameters);
+  g_free(self->output_indices);
+  g_free(self->output_values);
+  g_free(self->ramps);
+  delete self->ramp_parameter_changes;
+  gst_vst_audio_processor_clear_scheduled_changes(self);
+
+  gst_flow_combiner_free(self->flow_combiner);
+  g_free(self->aux_srcpads);
+  g_free(self->aux_out_buffers);
+  g_free(self->aux_out_maps);
+
+  // All request pads were released during dispose
+  g_free(self->aux_pads);
+  g_free(self->aux_data);
+  g_clear_object(&self->dry_adapter);
+  g_clear_object(&self->input_adapter);
+  g_mutex_clear(&self->aux_lock);
+  g_cond_clear(&self->aux_cond);
+  g_cond_clear(&self->state_cond);
 
   G_OBJECT_CLASS(parent_class)->finalize(object);
 }
 
-static void
-gst_vst_audio_processor_get_property (GObject * object,
-    guint property_id, GValue * value, GParamSpec * pspec)
+// parameter_values is a seqlock: writers hold the object lock and make the
+// sequence number odd while changing values, readers retry until they saw the
+// same even sequence number before and after copying. This way polling the
+// parameters never blocks the streaming thread
+static inline void
+gst_vst_audio_processor_write_parameter_values_begin(GstVstAudioProcessor *self)
 {
-  auto self = GST_VST_AUDIO_PROCESSOR(object);
+  g_atomic_int_inc(&self->parameter_values_seq);
+  std::atomic_thread_fence(std::memory_order_release);
+}
 
-  switch (property_id) {
-    case PROP_MAX_SAMPLES_PER_CHUNK:
-      g_value_set_int (value, self->max_samples_per_chunk);
-      break;
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
-      break;
-  }
+static inline void
+gst_vst_audio_processor_write_parameter_values_end(GstVstAudioProcessor *self)
+{
+  std::atomic_thread_fence(std::memory_order_release);
+  g_atomic_int_inc(&self->parameter_values_seq);
 }
 
+// Consistent snapshot of the values of all parameters
 static void
-gst_vst_audio_processor_set_property (GObject * object,
-    guint property_id, const GValue * value, GParamSpec * pspec)
+gst_vst_audio_processor_read_parameter_values(GstVstAudioProcessor *self,
+    gdouble * values)
 {
-  auto self = GST_VST_AUDIO_PROCESSOR(object);
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  gint seq;
 
-  switch (property_id) {
-    case PROP_MAX_SAMPLES_PER_CHUNK:
-      self->max_samples_per_chunk = g_value_get_int (value);
-      break;
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
-      break;
-  }
+  do {
+    while ((seq = g_atomic_int_get(&self->parameter_values_seq)) & 1)
+      g_thread_yield();
+    memcpy(values, self->parameter_values, sizeof(gdouble) * klass->processor_info->n_properties);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while (g_atomic_int_get(&self->parameter_values_seq) != seq);
 }
 
-static void
-gst_vst_audio_processor_sub_get_property (GObject * object,
-    guint property_id, GValue * value, GParamSpec * pspec)
+static gdouble
+gst_vst_audio_processor_read_parameter_value(GstVstAudioProcessor *self,
+    guint idx)
+{
+  gdouble value;
+  gint seq;
+
+  do {
+    while ((seq = g_atomic_int_get(&self->parameter_values_seq)) & 1)
+      g_thread_yield();
+    value = self->parameter_values[idx];
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while (g_atomic_int_get(&self->parameter_values_seq) != seq);
+
+  return value;
+}
+
+// Returns the current values of all parameters, with the property names as
+// field names
+static GstStructure *
+gst_vst_audio_processor_get_parameters(GstVstAudioProcessor *self)
 {
-  auto self = GST_VST_AUDIO_PROCESSOR(object);
   auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  auto processor_info = klass->processor_info;
+  auto parameters = gst_structure_new_empty("parameters");
 
-  if (property_id > klass->processor_info->n_properties + 1 || property_id == 0) {
-    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
-    return;
+  // The base class has no parameters
+  if (!processor_info)
+    return parameters;
+
+  std::vector<gdouble> values(processor_info->n_properties);
+  gst_vst_audio_processor_read_parameter_values(self, values.data());
+
+  for (auto i = 0U; i < processor_info->n_properties; i++) {
+    auto property = &processor_info->properties[i];
+
+    if (property->type == G_TYPE_DOUBLE)
+      gst_structure_set(parameters, property->name, G_TYPE_DOUBLE,
+          values[i], nullptr);
+    else if (property->type == G_TYPE_BOOLEAN)
+      gst_structure_set(parameters, property->name, G_TYPE_BOOLEAN,
+          values[i] > 0.5, nullptr);
+    else
+      gst_structure_set(parameters, property->name, G_TYPE_INT,
+          (gint) values[i], nullptr);
   }
 
-  GST_OBJECT_LOCK(self);
-  auto property = &klass->processor_info->properties[property_id - 1];
+  return parameters;
+}
+
+// Looks up the writable parameter with the property name and converts the
+// value to its plain value
+static gboolean
+gst_vst_audio_processor_convert_parameter(GstVstAudioProcessor *self,
+    const gchar * name, const GValue * value, guint * idx, gdouble * plain_value)
+{
+  auto processor_info = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info;
+  auto i = 0U;
+
+  while (i < processor_info->n_properties &&
+      g_strcmp0(processor_info->properties[i].name, name) != 0)
+    i++;
+
+  if (i == processor_info->n_properties || processor_info->properties[i].read_only) {
+    GST_WARNING_OBJECT(self, "No writable parameter '%s'", name);
+    return FALSE;
+  }
+
+  auto property = &processor_info->properties[i];
+  GValue converted = G_VALUE_INIT;
+
+  g_value_init(&converted, property->type);
+  if (!g_value_type_transformable(G_VALUE_TYPE(value), property->type) ||
+      !g_value_transform(value, &converted)) {
+    GST_WARNING_OBJECT(self, "Invalid value of type %s for parameter '%s'",
+        G_VALUE_TYPE_NAME(value), name);
+    g_value_unset(&converted);
+    return FALSE;
+  }
+
+  g_param_value_validate(property->pspec, &converted);
+
+  *idx = i;
   if (property->type == G_TYPE_DOUBLE)
-    g_value_set_double(value, self->parameter_values[property_id - 1]);
+    *plain_value = g_value_get_double(&converted);
   else if (property->type == G_TYPE_BOOLEAN)
-    g_value_set_boolean(value, self->parameter_values[property_id - 1] > 0.5);
+    *plain_value = g_value_get_boolean(&converted);
   else
-    g_value_set_int(value, self->parameter_values[property_id - 1]);
-  GST_OBJECT_UNLOCK(self);
+    *plain_value = g_value_get_int(&converted);
+  g_value_unset(&converted);
+
+  return TRUE;
 }
 
+// Applies all values of the structure at once: they are all queued in the same
+// parameter changes, which the streaming thread picks up together for the
+// next chunk. Nothing is applied if any of the fields is invalid
 static void
-gst_vst_audio_processor_sub_set_property (GObject * object,
-    guint property_id, const GValue * value, GParamSpec * pspec)
+gst_vst_audio_processor_set_parameters(GstVstAudioProcessor *self,
+    const GstStructure * parameters)
 {
-  auto self = GST_VST_AUDIO_PROCESSOR(object);
   auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  auto processor_info = klass->processor_info;
+  auto n_fields = gst_structure_n_fields(parameters);
+  std::vector<guint> indices(n_fields);
+  std::vector<gdouble> values(n_fields);
 
-  if (property_id > klass->processor_info->n_properties + 1 || property_id == 0) {
-    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  if (!processor_info) {
+    GST_WARNING_OBJECT(self, "No parameters available");
     return;
   }
 
-  GST_OBJECT_LOCK(self);
-  auto property = &klass->processor_info->properties[property_id - 1];
+  // Validate and convert everything before changing anything
+  for (auto i = 0; i < n_fields; i++) {
+    auto name = gst_structure_nth_field_name(parameters, i);
 
-  // Store value in our cache
-  if (property->type == G_TYPE_DOUBLE) {
-    self->parameter_values[property_id - 1] = g_value_get_double(value);
-  } else if (property->type == G_TYPE_BOOLEAN) {
-    self->parameter_values[property_id - 1] = g_value_get_boolean(value);
-  } else {
-    self->parameter_values[property_id - 1] = g_value_get_int(value);
+    if (!gst_vst_audio_processor_convert_parameter(self, name,
+          gst_structure_get_value(parameters, name), &indices[i], &values[i]))
+      return;
   }
 
-  // If we have an edit controller, convert our plain values to normalized
-  // values and store the parameter changes and let the edit controller know
-  // about it
-  //
-  // We always use plain values, but controller and component use normalized
-  // values between 0.0 and 1.0
-  if (self->edit_controller) {
+  GST_OBJECT_LOCK(self);
+  gst_vst_audio_processor_write_parameter_values_begin(self);
+  for (auto i = 0; i < n_fields; i++)
+    self->parameter_values[indices[i]] = values[i];
+  gst_vst_audio_processor_write_parameter_values_end(self);
+
+  if (self->instance.edit_controller && n_fields > 0) {
     if (!self->parameter_changes)
       self->parameter_changes = new Vst::ParameterChanges();
 
-    Steinberg::int32 idx = 0;
-    auto queue = self->parameter_changes->addParameterData(property->param_id, idx);
-    auto value = self->edit_controller->plainParamToNormalized(property->param_id,
-        self->parameter_values[property_id - 1]);
-
-    queue->addPoint(0, value, idx);
-    self->edit_controller->setParamNormalized(property->param_id, value);
+    for (auto i = 0; i < n_fields; i++)
+      gst_vst_instance_set_parameter(&self->instance, self->parameter_changes,
+          processor_info->properties[indices[i]].param_id, values[i], 0);
   }
   GST_OBJECT_UNLOCK(self);
+
+  for (auto i = 0; i < n_fields; i++)
+    g_object_notify_by_pspec(G_OBJECT(self), processor_info->properties[indices[i]].pspec);
 }
 
-static gboolean
-gst_vst_audio_processor_open(GstVstAudioProcessor *self)
+static void
+gst_vst_audio_processor_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec)
 {
-  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
-  std::string err;
-  std::string path(klass->processor_info->path);
-
-  self->state = STATE_NONE;
+  auto self = GST_VST_AUDIO_PROCESSOR(object);
 
-  auto mod = VST3::Hosting::Module::create(path, err);
-  if (!mod) {
-    GST_ERROR_OBJECT(self, "Failed to load module '%s': %s", path.c_str(), err.c_str());
-    return FALSE;
+  switch (property_id) {
+    case PROP_MAX_SAMPLES_PER_CHUNK:
+      g_value_set_int (value, self->max_samples_per_chunk);
+      break;
+    case PROP_PROCESS_MODE:
+      g_value_set_enum (value, self->process_mode);
+      break;
+    case PROP_PARALLEL_SEGMENTS:
+      g_value_set_uint (value, self->parallel_segments);
+      break;
+    case PROP_SEGMENT_DURATION:
+      g_value_set_uint64 (value, self->segment_duration);
+      break;
+    case PROP_SEGMENT_OVERLAP:
+      g_value_set_uint64 (value, self->segment_overlap);
+      break;
+    case PROP_USE_SCHEDULER:
+      g_value_set_boolean (value, self->use_scheduler);
+      break;
+    case PROP_SCHEDULER_LOAD:
+      GST_OBJECT_LOCK(self);
+      g_value_set_double (value, self->scheduler_client ?
+          gst_vst_scheduler_client_get_load(self->scheduler_client) : 0.0);
+      GST_OBJECT_UNLOCK(self);
+      break;
+    case PROP_PARAMETERS:
+      g_value_take_boxed (value, gst_vst_audio_processor_get_parameters(self));
+      break;
+    case PROP_NOTIFY_INTERVAL:
+      g_value_set_uint64 (value, self->notify_interval);
+      break;
+    case PROP_METER_INTERVAL:
+      g_value_set_uint64 (value, self->meter_interval);
+      break;
+    case PROP_LOCK_MEMORY:
+      g_value_set_boolean (value, self->lock_memory);
+      break;
+    case PROP_FLUSH_DENORMALS:
+      g_value_set_boolean (value, self->flush_denormals);
+      break;
+    case PROP_QOS_POLICY:
+      g_value_set_enum (value, self->qos_policy);
+      break;
+    case PROP_QOS_THRESHOLD:
+      g_value_set_uint64 (value, self->qos_threshold);
+      break;
+    case PROP_BYPASS:
+      g_value_set_boolean (value, g_atomic_int_get(&self->bypass));
+      break;
+    case PROP_BYPASS_CROSSFADE:
+      g_value_set_uint64 (value, self->bypass_crossfade);
+      break;
+    case PROP_BLOCK_SIZE:
+      g_value_set_int (value, self->block_size);
+      break;
+    case PROP_SANDBOX:
+      g_value_set_boolean (value, self->sandbox);
+      break;
+    case PROP_SANDBOX_MEMORY_LIMIT:
+      g_value_set_uint64 (value, self->sandbox_memory_limit);
+      break;
+    case PROP_STATE_CROSSFADE:
+      g_value_set_uint64 (value, self->state_crossfade);
+      break;
+    case PROP_PARAMETER_RAMP_TIME:
+      g_value_set_uint64 (value, self->parameter_ramp_time);
+      break;
+    case PROP_ASYNC_OPEN:
+      g_value_set_boolean (value, self->async_open);
+      break;
+    case PROP_ASYNC_OPEN_FALLBACK:
+      g_value_set_enum (value, self->async_open_fallback);
+      break;
+    case PROP_LEVEL_INTERVAL:
+      g_value_set_uint64 (value, self->level_interval);
+      break;
+    case PROP_LEVEL_META:
+      g_value_set_boolean (value, self->level_meta);
+      break;
+    case PROP_STATE:
+      g_value_take_boxed (value, gst_vst_audio_processor_get_state(self));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vst_audio_processor_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec)
+{
+  auto self = GST_VST_AUDIO_PROCESSOR(object);
+
+  switch (property_id) {
+    case PROP_MAX_SAMPLES_PER_CHUNK:
+      self->max_samples_per_chunk = g_value_get_int (value);
+      break;
+    case PROP_PROCESS_MODE:
+      self->process_mode = (GstVstProcessMode) g_value_get_enum (value);
+      break;
+    case PROP_PARALLEL_SEGMENTS:
+      self->parallel_segments = g_value_get_uint (value);
+      break;
+    case PROP_SEGMENT_DURATION:
+      self->segment_duration = g_value_get_uint64 (value);
+      break;
+    case PROP_SEGMENT_OVERLAP:
+      self->segment_overlap = g_value_get_uint64 (value);
+      break;
+    case PROP_USE_SCHEDULER:
+      self->use_scheduler = g_value_get_boolean (value);
+      break;
+    case PROP_PARAMETERS:{
+      auto parameters = (const GstStructure *) g_value_get_boxed (value);
+      if (parameters)
+        gst_vst_audio_processor_set_parameters(self, parameters);
+      break;
+    }
+    case PROP_NOTIFY_INTERVAL:
+      self->notify_interval = g_value_get_uint64 (value);
+      break;
+    case PROP_METER_INTERVAL:
+      self->meter_interval = g_value_get_uint64 (value);
+      break;
+    case PROP_LOCK_MEMORY:
+      self->lock_memory = g_value_get_boolean (value);
+      break;
+    case PROP_FLUSH_DENORMALS:
+      self->flush_denormals = g_value_get_boolean (value);
+      break;
+    case PROP_QOS_POLICY:
+      self->qos_policy = (GstVstQosPolicy) g_value_get_enum (value);
+      break;
+    case PROP_QOS_THRESHOLD:
+      self->qos_threshold = g_value_get_uint64 (value);
+      break;
+    case PROP_BYPASS:
+      g_atomic_int_set(&self->bypass, g_value_get_boolean (value));
+      break;
+    case PROP_BYPASS_CROSSFADE:
+      self->bypass_crossfade = g_value_get_uint64 (value);
+      break;
+    case PROP_BLOCK_SIZE:
+      self->block_size = g_value_get_int (value);
+      break;
+    case PROP_SANDBOX:
+      self->sandbox = g_value_get_boolean (value);
+      break;
+    case PROP_SANDBOX_MEMORY_LIMIT:
+      self->sandbox_memory_limit = g_value_get_uint64 (value);
+      break;
+    case PROP_STATE_CROSSFADE:
+      self->state_crossfade = g_value_get_uint64 (value);
+      break;
+    case PROP_PARAMETER_RAMP_TIME:
+      self->parameter_ramp_time = g_value_get_uint64 (value);
+      break;
+    case PROP_ASYNC_OPEN:
+      self->async_open = g_value_get_boolean (value);
+      break;
+    case PROP_ASYNC_OPEN_FALLBACK:
+      self->async_open_fallback = (GstVstAsyncOpenFallback) g_value_get_enum (value);
+      break;
+    case PROP_LEVEL_INTERVAL:
+      self->level_interval = g_value_get_uint64 (value);
+      break;
+    case PROP_LEVEL_META:
+      self->level_meta = g_value_get_boolean (value);
+      break;
+    case PROP_STATE:
+      gst_vst_audio_processor_set_state(self, (GBytes *) g_value_get_boxed (value));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vst_audio_processor_sub_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec)
+{
+  auto self = GST_VST_AUDIO_PROCESSOR(object);
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+
+  if (property_id > klass->processor_info->n_properties + 1 || property_id == 0) {
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    return;
+  }
+
+  auto property = &klass->processor_info->properties[property_id - 1];
+  auto parameter_value = gst_vst_audio_processor_read_parameter_value(self, property_id - 1);
+  if (property->type == G_TYPE_DOUBLE)
+    g_value_set_double(value, parameter_value);
+  else if (property->type == G_TYPE_BOOLEAN)
+    g_value_set_boolean(value, parameter_value > 0.5);
+  else
+    g_value_set_int(value, parameter_value);
+}
+
+static void
+gst_vst_audio_processor_sub_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec)
+{
+  auto self = GST_VST_AUDIO_PROCESSOR(object);
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+
+  if (property_id > klass->processor_info->n_properties + 1 || property_id == 0) {
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    return;
+  }
+
+  GST_OBJECT_LOCK(self);
+  auto property = &klass->processor_info->properties[property_id - 1];
+
+  // Store value in our cache
+  gst_vst_audio_processor_write_parameter_values_begin(self);
+  if (property->type == G_TYPE_DOUBLE) {
+    self->parameter_values[property_id - 1] = g_value_get_double(value);
+  } else if (property->type == G_TYPE_BOOLEAN) {
+    self->parameter_values[property_id - 1] = g_value_get_boolean(value);
+  } else {
+    self->parameter_values[property_id - 1] = g_value_get_int(value);
+  }
+  gst_vst_audio_processor_write_parameter_values_end(self);
+
+  // If we have an edit controller, store the parameter changes and let the
+  // edit controller know about it
+  if (self->instance.edit_controller) {
+    if (!self->parameter_changes)
+      self->parameter_changes = new Vst::ParameterChanges();
+
+    gst_vst_instance_set_parameter(&self->instance, self->parameter_changes,
+        property->param_id, self->parameter_values[property_id - 1], 0);
+  }
+  GST_OBJECT_UNLOCK(self);
+}
+
+// Splits a state into the states of component and edit controller. The state
+// is either the contents of a .vstpreset file or a plain component state
+static gboolean
+gst_vst_audio_processor_parse_state(GstVstAudioProcessor *self, GBytes * state,
+    GBytes ** component_state, GBytes ** controller_state)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  gsize size;
+  auto data = (const guint8 *) g_bytes_get_data(state, &size);
+
+  *component_state = *controller_state = nullptr;
+
+  if (size < 4 || memcmp(data, "VST3", 4) != 0) {
+    *component_state = g_bytes_ref(state);
+    return TRUE;
+  }
+
+  MemoryStream stream((void *) data, size);
+  Vst::PresetFile preset(&stream);
+  TUID class_id;
+
+  if (!preset.readChunkList()) {
+    GST_ERROR_OBJECT(self, "Invalid preset");
+    return FALSE;
+  }
+
+  preset.getClassID().toTUID(class_id);
+  if (memcmp(class_id, klass->processor_info->class_id.data(), sizeof(TUID)) != 0) {
+    GST_ERROR_OBJECT(self, "Preset is for a different plugin");
+    return FALSE;
+  }
+
+  auto entry = preset.getEntry(Vst::kComponentState);
+  if (!entry || entry->offset < 0 || entry->size < 0 || (guint64) (entry->offset + entry->size) > size) {
+    GST_ERROR_OBJECT(self, "Preset contains no component state");
+    return FALSE;
+  }
+  *component_state = g_bytes_new_from_bytes(state, entry->offset, entry->size);
+
+  entry = preset.getEntry(Vst::kControllerState);
+  if (entry && entry->offset >= 0 && entry->size >= 0 && (guint64) (entry->offset + entry->size) <= size)
+    *controller_state = g_bytes_new_from_bytes(state, entry->offset, entry->size);
+
+  return TRUE;
+}
+
+// Stops all ramps and takes the current parameter values of the instance as
+// starting point for new ones. Must be called with the object lock
+static void
+gst_vst_audio_processor_reset_ramps(GstVstAudioProcessor *self)
+{
+  auto processor_info = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info;
+
+  for (auto i = 0U; i < processor_info->n_properties; i++) {
+    auto ramp = &self->ramps[i];
+
+    ramp->value = ramp->target =
+        self->instance.edit_controller->getParamNormalized(processor_info->properties[i].param_id);
+    ramp->step = 0.0;
+    ramp->remaining = 0;
+  }
+  self->n_ramping = 0;
+}
+
+// Makes instance the current one, unless it already is, and takes over the
+// parameter values of its state. Parameter changes that were not processed
+// yet are dropped as the new state replaces them. instance holds the previous
+// one afterwards. Must be called with the stream lock, or while not streaming
+static void
+gst_vst_audio_processor_switch_instance(GstVstAudioProcessor *self,
+    GstVstInstance * instance, const gdouble * values)
+{
+  auto processor_info = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info;
+  std::vector<gboolean> changed(processor_info->n_properties);
+
+  // The controller is used with the object lock from property setters
+  GST_OBJECT_LOCK(self);
+  if (instance != &self->instance)
+    std::swap(self->instance, *instance);
+  gst_vst_audio_processor_reset_ramps(self);
+  if (self->parameter_changes) {
+    delete self->parameter_changes;
+    self->parameter_changes = nullptr;
+  }
+
+  gst_vst_audio_processor_write_parameter_values_begin(self);
+  for (auto i = 0U; i < processor_info->n_properties; i++) {
+    changed[i] = self->parameter_values[i] != values[i];
+    self->parameter_values[i] = values[i];
+  }
+  gst_vst_audio_processor_write_parameter_values_end(self);
+  GST_OBJECT_UNLOCK(self);
+
+  for (auto i = 0U; i < processor_info->n_properties; i++) {
+    if (changed[i])
+      g_object_notify_by_pspec(G_OBJECT(self), processor_info->properties[i].pspec);
+  }
+}
+
+static void
+gst_vst_audio_processor_read_instance_parameters(GstVstAudioProcessor *self,
+    GstVstInstance * instance, gdouble * values)
+{
+  auto processor_info = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info;
+
+  for (auto i = 0U; i < processor_info->n_properties; i++)
+    values[i] = gst_vst_instance_get_parameter(instance, processor_info->properties[i].param_id);
+}
+
+typedef struct {
+  GstVstAudioProcessor *self;
+  GstVstInstance *instance;
+} GstVstAudioProcessorRetiredInstance;
+
+// Waits until get_state() is done reading from the plugin of an instance that
+// was switched away from, and closes it
+static void
+gst_vst_audio_processor_close_switched_instance(GstVstAudioProcessor *self,
+    GstVstInstance * instance)
+{
+  GST_OBJECT_LOCK(self);
+  while (self->state_readers > 0)
+    g_cond_wait(&self->state_cond, GST_OBJECT_GET_LOCK(self));
+  GST_OBJECT_UNLOCK(self);
+
+  gst_vst_instance_close(instance);
+  delete instance;
+}
+
+static gpointer
+gst_vst_audio_processor_close_instance(gpointer user_data)
+{
+  auto retired = (GstVstAudioProcessorRetiredInstance *) user_data;
+
+  gst_vst_audio_processor_close_switched_instance(retired->self, retired->instance);
+  gst_object_unref(retired->self);
+  g_free(retired);
+
+  return nullptr;
+}
+
+// Shutting down an instance can take as long as setting it up, so this
+// happens on a separate thread
+static void
+gst_vst_audio_processor_retire_instance(GstVstAudioProcessor *self,
+    GstVstInstance * instance)
+{
+  auto retired = g_new0(GstVstAudioProcessorRetiredInstance, 1);
+
+  retired->self = (GstVstAudioProcessor *) gst_object_ref(self);
+  retired->instance = instance;
+  g_thread_unref(g_thread_new("vst-retire", gst_vst_audio_processor_close_instance, retired));
+}
+
+// Creates a second instance with the new state, set up and activated for the
+// current configuration, and queues it for replacing the current instance at
+// the next chunk. All expensive work happens here on the calling thread.
+// Before the format is known, the instance is only set up once it replaces
+// the current one
+static gboolean
+gst_vst_audio_processor_prepare_standby(GstVstAudioProcessor *self,
+    const GstAudioInfo * info, GBytes * component_state, GBytes * controller_state)
+{
+  auto processor_info = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info;
+
+  if (processor_info->n_aux_inputs > 0 || processor_info->n_aux_outputs > 0
+      || self->parallel_segments > 0) {
+    GST_WARNING_OBJECT(self, "Can't switch state while processing with "
+        "auxiliary busses or parallel segments");
+    return FALSE;
+  }
+
+  auto standby = new GstVstInstance();
+  auto values = g_new0(gdouble, processor_info->n_properties);
+  auto process_mode = gst_vst_process_mode_resolve(self->process_mode, self->sinkpad);
+
+  gst_vst_instance_set_sandbox(standby, self->sandbox, self->sandbox_memory_limit);
+  gst_vst_instance_set_lock_memory(standby, self->lock_memory);
+  auto configured = GST_AUDIO_INFO_FORMAT(info) != GST_AUDIO_FORMAT_UNKNOWN;
+  if (!gst_vst_instance_open(standby, GST_ELEMENT_CAST(self), processor_info)
+      || (configured && !gst_vst_instance_setup(standby, info, process_mode, self->max_samples_per_chunk))
+      || !gst_vst_instance_set_state(standby, component_state, controller_state)
+      || (configured && !gst_vst_instance_activate(standby))) {
+    GST_ERROR_OBJECT(self, "Failed to prepare instance with new state");
+    gst_vst_instance_close(standby);
+    delete standby;
+    g_free(values);
+    return FALSE;
+  }
+  gst_vst_instance_set_flush_denormals(standby, self->flush_denormals);
+  gst_vst_audio_processor_read_instance_parameters(self, standby, values);
+
+  GST_OBJECT_LOCK(self);
+  std::swap(self->standby_instance, standby);
+  std::swap(self->standby_parameter_values, values);
+  GST_OBJECT_UNLOCK(self);
+
+  // A state that was loaded before but not switched to yet is replaced
+  if (standby) {
+    gst_vst_instance_close(standby);
+    delete standby;
+    g_free(values);
+  }
+
+  GST_DEBUG_OBJECT(self, "New state ready");
+
+  return TRUE;
+}
+
+static gboolean
+gst_vst_audio_processor_load_state(GstVstAudioProcessor *self, GBytes * state)
+{
+  GBytes *component_state, *controller_state;
+  GstAudioInfo info;
+  gboolean streaming;
+  auto ret = FALSE;
+
+  g_return_val_if_fail(state != nullptr, FALSE);
+
+  if (!gst_vst_audio_processor_parse_state(self, state, &component_state, &controller_state))
+    return FALSE;
+
+  GST_OBJECT_LOCK(self);
+  auto element_state = GST_STATE(self);
+  GST_OBJECT_UNLOCK(self);
+
+  if (element_state == GST_STATE_NULL) {
+    GST_WARNING_OBJECT(self, "States can only be loaded in READY or above");
+    goto done;
+  }
+
+  GST_OBJECT_LOCK(self);
+  if (g_atomic_int_get(&self->opening)) {
+    GST_OBJECT_UNLOCK(self);
+    GST_WARNING_OBJECT(self, "Can't load a state while the plugin is still opening");
+    goto done;
+  }
+  GST_OBJECT_UNLOCK(self);
+
+  // Nothing is processed in READY, so the current instance can be used
+  // directly. The state lock keeps the element from going to PAUSED in the
+  // meantime, while the stream lock can't be taken here: the streaming thread
+  // holds it while blocked in a prerolled sink
+  GST_STATE_LOCK(self);
+  GST_OBJECT_LOCK(self);
+  streaming = GST_STATE(self) != GST_STATE_READY || GST_STATE_PENDING(self) != GST_STATE_VOID_PENDING;
+  info = self->info;
+  GST_OBJECT_UNLOCK(self);
+
+  if (!streaming) {
+    auto processor_info = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info;
+    std::vector<gdouble> values(processor_info->n_properties);
+
+    ret = gst_vst_instance_set_state(&self->instance, component_state, controller_state);
+    if (ret) {
+      gst_vst_audio_processor_read_instance_parameters(self, &self->instance, values.data());
+      gst_vst_audio_processor_switch_instance(self, &self->instance, values.data());
+    }
+    GST_STATE_UNLOCK(self);
+    goto done;
+  }
+  GST_STATE_UNLOCK(self);
+
+  ret = gst_vst_audio_processor_prepare_standby(self, &info, component_state, controller_state);
+
+done:
+  g_bytes_unref(component_state);
+  if (controller_state)
+    g_bytes_unref(controller_state);
+
+  return ret;
+}
+
+static gboolean
+gst_vst_audio_processor_load_preset(GstVstAudioProcessor *self,
+    const gchar * location)
+{
+  GError *err = nullptr;
+  gchar *contents;
+  gsize size;
+
+  g_return_val_if_fail(location != nullptr, FALSE);
+
+  if (!g_file_get_contents(location, &contents, &size, &err)) {
+    GST_ERROR_OBJECT(self, "Failed to read preset: %s", err->message);
+    g_clear_error(&err);
+    return FALSE;
+  }
+
+  auto state = g_bytes_new_take(contents, size);
+  auto ret = gst_vst_audio_processor_load_state(self, state);
+  g_bytes_unref(state);
+
+  return ret;
+}
+
+// Returns the state of the plugin in .vstpreset format, or the snapshot that
+// is restored with the next open
+static GBytes *
+gst_vst_audio_processor_get_state(GstVstAudioProcessor *self)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  MemoryStream component_stream, controller_stream, stream;
+
+  // The base class has no state
+  if (!klass->processor_info)
+    return nullptr;
+
+  GST_OBJECT_LOCK(self);
+  if (self->state) {
+    auto state = g_bytes_ref(self->state);
+    GST_OBJECT_UNLOCK(self);
+    return state;
+  }
+
+  if (self->closing || !self->instance.edit_controller) {
+    GST_OBJECT_UNLOCK(self);
+    return nullptr;
+  }
+
+  // The plugin can take long to write its state, or the sandbox to answer,
+  // so only references to the plugin objects are taken with the object lock.
+  // An instance that is switched away from meanwhile is only closed once all
+  // readers are done
+  GstVstInstance view = GstVstInstance();
+  view.element = self->instance.element;
+  view.state = self->instance.state;
+  view.module = self->instance.module;
+  view.component = self->instance.component;
+  view.edit_controller = self->instance.edit_controller;
+  view.sandbox = self->instance.sandbox;
+  self->state_readers++;
+  GST_OBJECT_UNLOCK(self);
+
+  auto have_state = gst_vst_instance_get_state(&view, &component_stream, &controller_stream);
+
+  GST_OBJECT_LOCK(self);
+  if (--self->state_readers == 0)
+    g_cond_broadcast(&self->state_cond);
+  GST_OBJECT_UNLOCK(self);
+
+  if (!have_state)
+    return nullptr;
+
+  component_stream.seek(0, IBStream::kIBSeekSet, nullptr);
+  controller_stream.seek(0, IBStream::kIBSeekSet, nullptr);
+  if (!Vst::PresetFile::savePreset(&stream, FUID::fromTUID(klass->processor_info->class_id.data()),
+      &component_stream, controller_stream.getSize() > 0 ? &controller_stream : nullptr)) {
+    GST_ERROR_OBJECT(self, "Failed to write state");
+    return nullptr;
+  }
+
+  return g_bytes_new(stream.getData(), stream.getSize());
+}
+
+// In NULL the state is kept until the next open, otherwise it is loaded
+// right away
+static void
+gst_vst_audio_processor_set_state(GstVstAudioProcessor *self, GBytes * state)
+{
+  GST_OBJECT_LOCK(self);
+  auto element_state = GST_STATE(self);
+  if (element_state == GST_STATE_NULL) {
+    if (self->state)
+      g_bytes_unref(self->state);
+    self->state = state ? g_bytes_ref(state) : nullptr;
+  }
+  GST_OBJECT_UNLOCK(self);
+
+  if (element_state != GST_STATE_NULL && state)
+    gst_vst_audio_processor_load_state(self, state);
+}
+
+// Called once streaming stopped: a crossfade is cut short and a state that
+// was not switched to yet is switched to right away
+static void
+gst_vst_audio_processor_finish_state_switch(GstVstAudioProcessor *self)
+{
+  if (self->fading_instance) {
+    gst_vst_audio_processor_close_switched_instance(self, self->fading_instance);
+    self->fading_instance = nullptr;
+  }
+  self->state_crossfade_left = 0;
+
+  if (self->priming_instance) {
+    gst_vst_audio_processor_switch_instance(self, self->priming_instance,
+        self->priming_parameter_values);
+    gst_vst_audio_processor_close_switched_instance(self, self->priming_instance);
+    g_free(self->priming_parameter_values);
+    self->priming_instance = nullptr;
+    self->priming_parameter_values = nullptr;
+  }
+  self->priming_left = 0;
+
+  GST_OBJECT_LOCK(self);
+  auto standby = self->standby_instance;
+  auto values = self->standby_parameter_values;
+  self->standby_instance = nullptr;
+  self->standby_parameter_values = nullptr;
+  GST_OBJECT_UNLOCK(self);
+
+  if (standby) {
+    gst_vst_audio_processor_switch_instance(self, standby, values);
+    gst_vst_audio_processor_close_switched_instance(self, standby);
+    g_free(values);
+  }
+}
+
+// Opens the plugin into instance and restores the snapshot set with the
+// state property, if any. values are the parameter values of the restored
+// snapshot afterwards, or nullptr if the cached values are to be used
+static gboolean
+gst_vst_audio_processor_open_instance(GstVstAudioProcessor *self,
+    GstVstInstance * instance, gdouble ** values)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+
+  *values = nullptr;
+
+  gst_vst_instance_set_sandbox(instance, self->sandbox, self->sandbox_memory_limit);
+  if (!gst_vst_instance_open(instance, GST_ELEMENT_CAST(self), klass->processor_info))
+    return FALSE;
+
+  // A snapshot replaces all parameter values
+  GST_OBJECT_LOCK(self);
+  auto state = self->state;
+  self->state = nullptr;
+  GST_OBJECT_UNLOCK(self);
+
+  if (state) {
+    GBytes *component_state, *controller_state;
+    auto restored = gst_vst_audio_processor_parse_state(self, state, &component_state, &controller_state)
+        && gst_vst_instance_set_state(instance, component_state, controller_state);
+
+    if (component_state)
+      g_bytes_unref(component_state);
+    if (controller_state)
+      g_bytes_unref(controller_state);
+    g_bytes_unref(state);
+
+    if (restored) {
+      *values = g_new(gdouble, klass->processor_info->n_properties);
+      gst_vst_audio_processor_read_instance_parameters(self, instance, *values);
+    } else {
+      GST_WARNING_OBJECT(self, "Failed to restore state, using parameter values");
+    }
+  }
+
+  return TRUE;
+}
+
+// Makes the newly opened instance the current one, either with the values of
+// its restored snapshot or with our cached property values
+static void
+gst_vst_audio_processor_use_instance(GstVstAudioProcessor *self,
+    GstVstInstance * instance, const gdouble * values)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+
+  if (values) {
+    gst_vst_audio_processor_switch_instance(self, instance, values);
+    return;
+  }
+
+  std::vector<gdouble> cached_values(klass->processor_info->n_properties);
+
+  // synchronize our cached property values with the component and controller.
+  // A new instance starts with the default values, only the others need to
+  // be changed
+  GST_OBJECT_LOCK(self);
+  if (instance != &self->instance)
+    std::swap(self->instance, *instance);
+  gst_vst_audio_processor_read_parameter_values(self, cached_values.data());
+  if (self->parameter_changes)
+    delete self->parameter_changes;
+  self->parameter_changes = gst_vst_instance_sync_parameters(&self->instance,
+      cached_values.data(), TRUE);
+  // The initial values are applied right away instead of being ramped to
+  gst_vst_audio_processor_reset_ramps(self);
+  GST_OBJECT_UNLOCK(self);
+}
+
+static gpointer
+gst_vst_audio_processor_open_thread(gpointer user_data)
+{
+  auto self = GST_VST_AUDIO_PROCESSOR(user_data);
+  auto instance = new GstVstInstance();
+  gdouble *values;
+
+  if (!gst_vst_audio_processor_open_instance(self, instance, &values)) {
+    delete instance;
+    GST_OBJECT_LOCK(self);
+    g_atomic_int_set(&self->opening, FALSE);
+    GST_OBJECT_UNLOCK(self);
+    GST_ELEMENT_ERROR(self, LIBRARY, INIT, (nullptr), ("Failed to open plugin"));
+    return nullptr;
+  }
+
+  GST_DEBUG_OBJECT(self, "Plugin opened, waiting for it to take over");
+
+  GST_OBJECT_LOCK(self);
+  self->opened_instance = instance;
+  self->opened_parameter_values = values;
+  GST_OBJECT_UNLOCK(self);
+
+  return nullptr;
+}
+
+// Makes the instance opened in the background the current one once it is
+// ready. Returns FALSE if it is not ready yet. Must be called with the
+// stream lock
+static gboolean
+gst_vst_audio_processor_take_over(GstVstAudioProcessor *self)
+{
+  GST_OBJECT_LOCK(self);
+  auto instance = self->opened_instance;
+  auto values = self->opened_parameter_values;
+  self->opened_instance = nullptr;
+  self->opened_parameter_values = nullptr;
+  GST_OBJECT_UNLOCK(self);
+
+  if (!instance)
+    return FALSE;
+
+  GST_DEBUG_OBJECT(self, "Plugin takes over");
+
+  gst_vst_audio_processor_use_instance(self, instance, values);
+  // Only the empty instance from before is left
+  delete instance;
+  g_free(values);
+
+  GST_OBJECT_LOCK(self);
+  g_atomic_int_set(&self->opening, FALSE);
+  GST_OBJECT_UNLOCK(self);
+
+  gst_element_post_message(GST_ELEMENT_CAST(self),
+      gst_message_new_element(GST_OBJECT_CAST(self),
+          gst_structure_new_empty("vst-plugin-active")));
+
+  return TRUE;
+}
+
+// Waits for the plugin to be opened in the background. There is no way to
+// interrupt a plugin while it initializes, so this blocks until it is done
+static void
+gst_vst_audio_processor_finish_open(GstVstAudioProcessor *self)
+{
+  if (!self->open_thread)
+    return;
+
+  g_thread_join(self->open_thread);
+  self->open_thread = nullptr;
+
+  GST_OBJECT_LOCK(self);
+  auto instance = self->opened_instance;
+  self->opened_instance = nullptr;
+  g_clear_pointer(&self->opened_parameter_values, g_free);
+  g_atomic_int_set(&self->opening, FALSE);
+  GST_OBJECT_UNLOCK(self);
+
+  if (instance) {
+    gst_vst_instance_close(instance);
+    delete instance;
+  }
+}
+
+static gboolean
+gst_vst_audio_processor_open(GstVstAudioProcessor *self)
+{
+  auto processor_info = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info;
+  gdouble *values;
+
+  // Auxiliary inputs would have to be consumed in the meantime
+  if (self->async_open && processor_info->n_aux_inputs == 0) {
+    GST_OBJECT_LOCK(self);
+    g_atomic_int_set(&self->opening, TRUE);
+    GST_OBJECT_UNLOCK(self);
+    self->open_thread = g_thread_new("vst-open", gst_vst_audio_processor_open_thread, self);
+    return TRUE;
+  } else if (self->async_open) {
+    GST_WARNING_OBJECT(self, "Opening plugin with auxiliary inputs synchronously");
+  }
+
+  if (!gst_vst_audio_processor_open_instance(self, &self->instance, &values))
+    return FALSE;
+
+  gst_vst_audio_processor_use_instance(self, &self->instance, values);
+  g_free(values);
+
+  return TRUE;
+}
+
+static GstStateChangeReturn
+gst_vst_audio_processor_change_state(GstElement * element,
+    GstStateChange transition)
+{
+  auto self = GST_VST_AUDIO_PROCESSOR(element);
+  auto state_ret = GST_STATE_CHANGE_SUCCESS;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_NULL_TO_READY:
+      GST_OBJECT_LOCK(self);
+      gst_audio_info_init(&self->info);
+      GST_OBJECT_UNLOCK(self);
+      gst_segment_init(&self->segment, GST_FORMAT_TIME);
+      if (!gst_vst_audio_processor_open(self))
+        state_ret = GST_STATE_CHANGE_FAILURE;
+      break;
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      // Auxiliary pads that were already requested start again like after a
+      // flush
+      g_mutex_lock(&self->aux_lock);
+      self->flushing = FALSE;
+      for (auto i = 0U; i < GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info->n_aux_inputs; i++) {
+        auto aux = self->aux_pads[i];
+
+        if (!aux)
+          continue;
+        gst_adapter_clear(aux->adapter);
+        gst_segment_init(&aux->segment, GST_FORMAT_TIME);
+        aux->flushing = FALSE;
+        aux->eos = FALSE;
+      }
+      g_mutex_unlock(&self->aux_lock);
+      gst_flow_combiner_reset(self->flow_combiner);
+      self->next_meter_time = GST_CLOCK_TIME_NONE;
+      self->next_level_time = GST_CLOCK_TIME_NONE;
+      gst_vst_audio_processor_reset_levels(self);
+      GST_OBJECT_LOCK(self);
+      self->earliest_time = GST_CLOCK_TIME_NONE;
+      self->proportion = 1.0;
+      self->qos_message_pending = FALSE;
+      GST_OBJECT_UNLOCK(self);
+      self->qos_processed = self->qos_dropped = 0;
+
+      if (self->use_scheduler) {
+        auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+        auto scheduler_client = gst_vst_scheduler_client_new(gst_vst_scheduler_get_default(),
+            GST_OBJECT_CAST(self), klass->processor_info->name);
+
+        if (!scheduler_client) {
+          GST_ELEMENT_ERROR(self, RESOURCE, BUSY, (nullptr),
+              ("DSP scheduler load budget exhausted"));
+          state_ret = GST_STATE_CHANGE_FAILURE;
+        }
+
+        GST_OBJECT_LOCK(self);
+        self->scheduler_client = scheduler_client;
+        GST_OBJECT_UNLOCK(self);
+      }
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      // Wake up any streaming thread waiting for auxiliary input or for space
+      // in the queue of an auxiliary pad
+      g_mutex_lock(&self->aux_lock);
+      self->flushing = TRUE;
+      for (auto i = 0U; i < GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info->n_aux_inputs; i++) {
+        if (self->aux_pads[i])
+          self->aux_pads[i]->flushing = TRUE;
+      }
+      g_cond_broadcast(&self->aux_cond);
+      g_mutex_unlock(&self->aux_lock);
+      break;
+    default:
+      break;
+  }
+
+  if (state_ret == GST_STATE_CHANGE_FAILURE)
+    return state_ret;
+
+  state_ret = GST_ELEMENT_CLASS(parent_class)->change_state(element, transition);
+  if (state_ret == GST_STATE_CHANGE_FAILURE)
+    return state_ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      if (self->segment_renderer) {
+        gst_vst_segment_renderer_free(self->segment_renderer);
+        self->segment_renderer = nullptr;
+      }
+      gst_vst_audio_processor_finish_state_switch(self);
+      gst_vst_instance_deactivate(&self->instance);
+      g_clear_object(&self->dry_adapter);
+      g_clear_object(&self->input_adapter);
+      gst_vst_audio_processor_clear_scheduled_changes(self);
+
+      GST_OBJECT_LOCK(self);
+      // Make sure the next caps set up processing again with any properties
+      // that were changed in READY
+      gst_audio_info_init(&self->info);
+      if (self->scheduler_client) {
+        gst_vst_scheduler_client_free(self->scheduler_client);
+        self->scheduler_client = nullptr;
+      }
+      GST_OBJECT_UNLOCK(self);
+      break;
+    case GST_STATE_CHANGE_READY_TO_NULL:
+      gst_vst_audio_processor_finish_open(self);
+      gst_vst_audio_processor_finish_state_switch(self);
+      // get_state() might still read from the plugin
+      GST_OBJECT_LOCK(self);
+      self->closing = TRUE;
+      while (self->state_readers > 0)
+        g_cond_wait(&self->state_cond, GST_OBJECT_GET_LOCK(self));
+      GST_OBJECT_UNLOCK(self);
+      gst_vst_instance_close(&self->instance);
+      GST_OBJECT_LOCK(self);
+      self->closing = FALSE;
+      GST_OBJECT_UNLOCK(self);
+      break;
+    default:
+      break;
+  }
+
+  return state_ret;
+}
+
+static GstPad *
+gst_vst_audio_processor_request_new_pad(GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps)
+{
+  auto self = GST_VST_AUDIO_PROCESSOR(element);
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  guint bus = 0;
+
+  g_mutex_lock(&self->aux_lock);
+  if (name) {
+    if (sscanf(name, "aux_sink_%u", &bus) != 1 || bus >= klass->processor_info->n_aux_inputs
+        || self->aux_pads[bus]) {
+      GST_ERROR_OBJECT(self, "Invalid or already existing pad %s", name);
+      g_mutex_unlock(&self->aux_lock);
+      return nullptr;
+    }
+  } else {
+    while (bus < klass->processor_info->n_aux_inputs && self->aux_pads[bus])
+      bus++;
+    if (bus == klass->processor_info->n_aux_inputs) {
+      GST_ERROR_OBJECT(self, "All %u auxiliary inputs are in use",
+          klass->processor_info->n_aux_inputs);
+      g_mutex_unlock(&self->aux_lock);
+      return nullptr;
+    }
+  }
+
+  auto aux = g_new0(GstVstAudioProcessorAuxPad, 1);
+  aux->bus = bus;
+  aux->adapter = gst_adapter_new();
+  aux->running_time = GST_CLOCK_TIME_NONE;
+  gst_segment_init(&aux->segment, GST_FORMAT_TIME);
+  gst_audio_info_init(&aux->info);
+
+  auto pad_name = g_strdup_printf("aux_sink_%u", bus);
+  aux->pad = gst_pad_new_from_template(templ, pad_name);
+  g_free(pad_name);
+  gst_pad_set_element_private(aux->pad, aux);
+  gst_pad_set_chain_function (aux->pad,
+      GST_DEBUG_FUNCPTR (gst_vst_audio_processor_aux_sink_chain));
+  gst_pad_set_event_function (aux->pad,
+      GST_DEBUG_FUNCPTR (gst_vst_audio_processor_aux_sink_event));
+
+  self->aux_pads[bus] = aux;
+  g_mutex_unlock(&self->aux_lock);
+
+  gst_element_add_pad(element, aux->pad);
+
+  return aux->pad;
+}
+
+static void
+gst_vst_audio_processor_release_pad(GstElement * element, GstPad * pad)
+{
+  auto self = GST_VST_AUDIO_PROCESSOR(element);
+  auto aux = (GstVstAudioProcessorAuxPad *) gst_pad_get_element_private(pad);
+
+  // The main sink pad does not wait for this pad anymore from here on, and
+  // the streaming thread of this pad is woken up
+  g_mutex_lock(&self->aux_lock);
+  self->aux_pads[aux->bus] = nullptr;
+  aux->flushing = TRUE;
+  g_cond_broadcast(&self->aux_cond);
+  g_mutex_unlock(&self->aux_lock);
+
+  // Waits for the streaming thread to leave the chain and event functions,
+  // which still use aux
+  gst_pad_set_active(pad, FALSE);
+  gst_element_remove_pad(element, pad);
+
+  g_object_unref(aux->adapter);
+  g_free(aux);
+}
+
+static GstFlowReturn
+gst_vst_audio_processor_aux_sink_chain(GstPad * pad, GstObject * parent,
+    GstBuffer * buffer)
+{
+  auto self = GST_VST_AUDIO_PROCESSOR(parent);
+  auto aux = (GstVstAudioProcessorAuxPad *) gst_pad_get_element_private(pad);
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer) || GST_AUDIO_INFO_BPF(&aux->info) == 0) {
+    GST_ERROR_OBJECT(pad, "Need negotiated caps and buffers with valid timestamps");
+    gst_buffer_unref(buffer);
+    return GST_FLOW_ERROR;
+  }
+
+  auto running_time = gst_segment_to_running_time(&aux->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS(buffer));
+
+  g_mutex_lock(&self->aux_lock);
+  // Queue up to one second but at least two chunks, otherwise wait until the
+  // main sink pad has consumed some data
+  auto max_queued = MAX(aux->info.rate, 2 * self->max_samples_per_chunk) * aux->info.bpf;
+  while (!aux->flushing && gst_adapter_available(aux->adapter) >= (gsize) max_queued)
+    g_cond_wait(&self->aux_cond, &self->aux_lock);
+
+  if (aux->flushing) {
+    g_mutex_unlock(&self->aux_lock);
+    gst_buffer_unref(buffer);
+    return GST_FLOW_FLUSHING;
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID(running_time)) {
+    // Outside the segment
+    gst_buffer_unref(buffer);
+  } else {
+    // The queued samples are assumed to be contiguous
+    if (GST_BUFFER_IS_DISCONT(buffer) || gst_adapter_available(aux->adapter) == 0) {
+      gst_adapter_clear(aux->adapter);
+      aux->running_time = running_time;
+    }
+    gst_adapter_push(aux->adapter, buffer);
+    g_cond_broadcast(&self->aux_cond);
+  }
+  g_mutex_unlock(&self->aux_lock);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+gst_vst_audio_processor_aux_sink_event(GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  auto self = GST_VST_AUDIO_PROCESSOR(parent);
+  auto aux = (GstVstAudioProcessorAuxPad *) gst_pad_get_element_private(pad);
+  gboolean ret = TRUE;
+
+  g_mutex_lock(&self->aux_lock);
+  switch (GST_EVENT_TYPE(event)) {
+    case GST_EVENT_CAPS:{
+      GstCaps *caps;
+      GstAudioInfo info;
+
+      gst_event_parse_caps(event, &caps);
+      ret = gst_audio_info_from_caps(&info, caps);
+      if (ret && !gst_audio_info_is_equal(&info, &aux->info)) {
+        GST_DEBUG_OBJECT(pad, "Got caps %" GST_PTR_FORMAT, caps);
+        gst_adapter_clear(aux->adapter);
+        aux->info = info;
+      }
+      break;
+    }
+    case GST_EVENT_SEGMENT:
+      gst_event_copy_segment(event, &aux->segment);
+      ret = aux->segment.format == GST_FORMAT_TIME;
+      aux->eos = FALSE;
+      break;
+    case GST_EVENT_FLUSH_START:
+      aux->flushing = TRUE;
+      g_cond_broadcast(&self->aux_cond);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      gst_adapter_clear(aux->adapter);
+      gst_segment_init(&aux->segment, GST_FORMAT_TIME);
+      aux->flushing = FALSE;
+      aux->eos = FALSE;
+      break;
+    case GST_EVENT_EOS:
+      aux->eos = TRUE;
+      g_cond_broadcast(&self->aux_cond);
+      break;
+    default:
+      break;
+  }
+  g_mutex_unlock(&self->aux_lock);
+
+  // Nothing is forwarded from the auxiliary pads
+  gst_event_unref(event);
+
+  return ret;
+}
+
+// Fills the auxiliary inputs of the instance with the samples for the
+// chunk of n_samples starting at running_time. Waits until each linked
+// auxiliary pad has queued enough data or is at EOS, missing samples are
+// silent
+static GstFlowReturn
+gst_vst_audio_processor_collect_aux_inputs(GstVstAudioProcessor *self,
+    GstClockTime running_time, guint n_samples)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  auto rate = self->info.rate;
+  auto end_running_time = running_time + gst_util_uint64_scale_int(n_samples, GST_SECOND, rate);
+
+  for (auto bus = 0U; bus < klass->processor_info->n_aux_inputs; bus++) {
+    gboolean have_data = FALSE;
+
+    g_mutex_lock(&self->aux_lock);
+    while (TRUE) {
+      // Might be released while waiting
+      auto aux = self->aux_pads[bus];
+
+      if (self->flushing) {
+        g_mutex_unlock(&self->aux_lock);
+        return GST_FLOW_FLUSHING;
+      }
+
+      if (!aux || !GST_CLOCK_TIME_IS_VALID(running_time) || !gst_pad_is_linked(aux->pad))
+        break;
+
+      if (aux->info.rate != rate ||
+          GST_AUDIO_INFO_FORMAT(&aux->info) != GST_AUDIO_INFO_FORMAT(&self->info)) {
+        // Not negotiated yet, or not usable
+        if (GST_AUDIO_INFO_BPF(&aux->info) != 0) {
+          g_mutex_unlock(&self->aux_lock);
+          GST_ELEMENT_ERROR(self, CORE, NEGOTIATION, (nullptr),
+              ("Auxiliary input %u has a different rate or format than the main input", bus));
+          return GST_FLOW_NOT_NEGOTIATED;
+        }
+        if (aux->eos || aux->flushing)
+          break;
+        g_cond_wait(&self->aux_cond, &self->aux_lock);
+        continue;
+      }
+
+      // Drop everything before the chunk
+      auto bpf = aux->info.bpf;
+      auto available = gst_adapter_available(aux->adapter) / bpf;
+      if (available > 0 && aux->running_time < running_time) {
+        auto n_drop = MIN(available, gst_util_uint64_scale_int(running_time - aux->running_time, rate, GST_SECOND));
+        gst_adapter_flush(aux->adapter, n_drop * bpf);
+        aux->running_time += gst_util_uint64_scale_int(n_drop, GST_SECOND, rate);
+        available -= n_drop;
+      }
+
+      auto queued_end = aux->running_time + gst_util_uint64_scale_int(available, GST_SECOND, rate);
+      if (aux->eos || aux->flushing || (available > 0 && queued_end >= end_running_time)) {
+        if (available > 0) {
+          // Silence until the first queued sample, then as much as is queued
+          auto offset = (guint) MIN(n_samples, aux->running_time > running_time ?
+              gst_util_uint64_scale_int(aux->running_time - running_time, rate, GST_SECOND) : 0);
+          auto n_copy = (guint) MIN(available, n_samples - offset);
+
+          if (gst_vst_instance_get_aux_input_channels(&self->instance, bus) != aux->info.channels) {
+            // Takes effect with the next chunk, when the instance is set up again
+            GST_DEBUG_OBJECT(aux->pad, "Channels changed, reconfiguring");
+          } else if (n_copy > 0) {
+            memset(self->aux_data, 0, n_samples * bpf);
+            gst_adapter_copy(aux->adapter, self->aux_data + offset * bpf, 0, n_copy * bpf);
+            gst_adapter_flush(aux->adapter, n_copy * bpf);
+            // The silence before the queued samples was not taken from the
+            // adapter
+            aux->running_time += gst_util_uint64_scale_int(n_copy, GST_SECOND, rate);
+            g_cond_broadcast(&self->aux_cond);
+            have_data = TRUE;
+          }
+        }
+        break;
+      }
+
+      g_cond_wait(&self->aux_cond, &self->aux_lock);
+    }
+    g_mutex_unlock(&self->aux_lock);
+
+    gst_vst_instance_set_aux_input(&self->instance, bus,
+        have_data ? self->aux_data : nullptr, n_samples);
+  }
+
+  return GST_FLOW_OK;
+}
+
+// Sets up the instance again if the channels of any auxiliary pad changed.
+// Must be called from the streaming thread of the main sink pad
+static gboolean
+gst_vst_audio_processor_update_aux_channels(GstVstAudioProcessor *self)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  gboolean changed = FALSE;
+
+  g_mutex_lock(&self->aux_lock);
+  for (auto bus = 0U; bus < klass->processor_info->n_aux_inputs; bus++) {
+    auto aux = self->aux_pads[bus];
+
+    if (aux && aux->info.channels != 0 &&
+        aux->info.channels != gst_vst_instance_get_aux_input_channels(&self->instance, bus)) {
+      gst_vst_instance_set_aux_input_channels(&self->instance, bus, aux->info.channels);
+      changed = TRUE;
+    }
+  }
+  g_mutex_unlock(&self->aux_lock);
+
+  if (!changed)
+    return TRUE;
+
+  GST_DEBUG_OBJECT(self, "Auxiliary input channels changed");
+
+  return gst_vst_instance_setup(&self->instance, &self->info,
+      self->instance.process_mode, self->max_samples_per_chunk);
+}
+
+// Only the main src pad corresponds to the main sink pad. The auxiliary src
+// pads get their own caps and stream-start events
+static GstIterator *
+gst_vst_audio_processor_sink_iterate_internal_links(GstPad * pad,
+    GstObject * parent)
+{
+  auto self = GST_VST_AUDIO_PROCESSOR(parent);
+  GValue val = G_VALUE_INIT;
+
+  g_value_init(&val, GST_TYPE_PAD);
+  g_value_set_object(&val, self->srcpad);
+  auto it = gst_iterator_new_single(GST_TYPE_PAD, &val);
+  g_value_unset(&val);
+
+  return it;
+}
+
+// Forwards an event from the main sink pad to all auxiliary src pads
+static void
+gst_vst_audio_processor_push_aux_src_event(GstVstAudioProcessor *self,
+    GstEvent * event)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+
+  for (auto i = 0U; i < klass->processor_info->n_aux_outputs; i++) {
+    auto aux_event = gst_event_ref(event);
+
+    // Every output is a separate stream
+    if (GST_EVENT_TYPE(event) == GST_EVENT_STREAM_START) {
+      const gchar *stream_id;
+      guint group_id;
+
+      gst_event_parse_stream_start(event, &stream_id);
+      auto aux_stream_id = g_strdup_printf("%s/aux_src_%u", stream_id, i);
+      gst_event_unref(aux_event);
+      aux_event = gst_event_new_stream_start(aux_stream_id);
+      g_free(aux_stream_id);
+      if (gst_event_parse_group_id(event, &group_id))
+        gst_event_set_group_id(aux_event, group_id);
+    }
+
+    gst_pad_push_event(self->aux_srcpads[i], aux_event);
+  }
+}
+
+// Sets the caps of all auxiliary src pads according to the number of
+// channels the plugin configured for each output bus
+static void
+gst_vst_audio_processor_set_aux_src_caps(GstVstAudioProcessor *self)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+
+  for (auto i = 0U; i < klass->processor_info->n_aux_outputs; i++) {
+    auto channels = gst_vst_instance_get_aux_output_channels(&self->instance, i);
+    GstAudioInfo info;
+
+    if (channels == 0)
+      continue;
+
+    gst_audio_info_set_format(&info, GST_AUDIO_INFO_FORMAT(&self->info),
+        self->info.rate, channels, nullptr);
+    auto caps = gst_audio_info_to_caps(&info);
+    GST_DEBUG_OBJECT(self->aux_srcpads[i], "Setting caps %" GST_PTR_FORMAT, caps);
+    gst_pad_push_event(self->aux_srcpads[i], gst_event_new_caps(caps));
+    gst_caps_unref(caps);
+  }
+}
+
+// Allocates the output buffers of the auxiliary outputs for the next chunk
+// and passes them to the instance
+static void
+gst_vst_audio_processor_prepare_aux_outputs(GstVstAudioProcessor *self,
+    guint n_samples)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  auto bps = self->info.bpf / self->info.channels;
+
+  for (auto i = 0U; i < klass->processor_info->n_aux_outputs; i++) {
+    auto channels = gst_vst_instance_get_aux_output_channels(&self->instance, i);
+
+    // Nobody cares about this output
+    if (channels == 0 || !gst_pad_is_linked(self->aux_srcpads[i]))
+      continue;
+
+    self->aux_out_buffers[i] = gst_buffer_new_and_alloc(n_samples * channels * bps);
+    gst_buffer_map(self->aux_out_buffers[i], &self->aux_out_maps[i], GST_MAP_WRITE);
+    gst_vst_instance_set_aux_output(&self->instance, i, self->aux_out_maps[i].data);
+  }
+}
+
+// Pushes the output of the last chunk on the auxiliary src pads, or drops it
+// if n_out_samples is 0
+static GstFlowReturn
+gst_vst_audio_processor_push_aux_outputs(GstVstAudioProcessor *self,
+    guint n_out_samples, GstClockTime pts, GstClockTime duration, GstFlowReturn ret)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  auto bps = self->info.bpf / self->info.channels;
+
+  for (auto i = 0U; i < klass->processor_info->n_aux_outputs; i++) {
+    auto buffer = self->aux_out_buffers[i];
+
+    if (!buffer)
+      continue;
+
+    self->aux_out_buffers[i] = nullptr;
+    gst_buffer_unmap(buffer, &self->aux_out_maps[i]);
+
+    if (n_out_samples == 0) {
+      gst_buffer_unref(buffer);
+      continue;
+    }
+
+    auto channels = gst_vst_instance_get_aux_output_channels(&self->instance, i);
+    gst_buffer_set_size(buffer, n_out_samples * channels * bps);
+    GST_BUFFER_PTS(buffer) = pts;
+    GST_BUFFER_DURATION(buffer) = duration;
+
+    ret = gst_flow_combiner_update_pad_flow(self->flow_combiner, self->aux_srcpads[i],
+        gst_pad_push(self->aux_srcpads[i], buffer));
+  }
+
+  return ret;
+}
+
+// Posts one element message with the current values of all output parameters
+// that changed since the last one
+static void
+gst_vst_audio_processor_post_changed_parameters(GstVstAudioProcessor *self)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+
+  if (!self->have_changed_parameters)
+    return;
+
+  auto s = gst_structure_new_empty("vst-parameters-changed");
+
+  for (auto i = 0U; i < klass->processor_info->n_properties; i++) {
+    auto property = &klass->processor_info->properties[i];
+
+    if (!self->changed_parameters[i])
+      continue;
+    self->changed_parameters[i] = FALSE;
+
+    auto value = gst_vst_audio_processor_read_parameter_value(self, i);
+    if (property->type == G_TYPE_DOUBLE)
+      gst_structure_set(s, property->name, G_TYPE_DOUBLE, value, nullptr);
+    else if (property->type == G_TYPE_BOOLEAN)
+      gst_structure_set(s, property->name, G_TYPE_BOOLEAN, value > 0.5, nullptr);
+    else
+      gst_structure_set(s, property->name, G_TYPE_INT, (gint) value, nullptr);
+  }
+
+  self->have_changed_parameters = FALSE;
+  self->last_notify_time = g_get_monotonic_time();
+
+  gst_element_post_message(GST_ELEMENT_CAST(self),
+      gst_message_new_element(GST_OBJECT_CAST(self), s));
+}
+
+// Whether a message that is posted every interval of running time is due,
+// and if so updates when the next one is due. Stays on the grid of the
+// interval, but doesn't try to catch up after gaps
+static gboolean
+interval_due(GstClockTime running_time, GstClockTime interval,
+    GstClockTime * next_time)
+{
+  if (GST_CLOCK_TIME_IS_VALID(*next_time) && running_time < *next_time)
+    return FALSE;
+
+  if (!GST_CLOCK_TIME_IS_VALID(*next_time) || running_time - *next_time >= interval)
+    *next_time = running_time + interval;
+  else
+    *next_time += interval;
+
+  return TRUE;
+}
+
+// Posts the values of all read-only parameters if the meter interval elapsed
+// at the end of the chunk that was just processed. The message carries the
+// times of the end of the chunk so that it can be aligned with playback
+static void
+gst_vst_audio_processor_post_meters(GstVstAudioProcessor *self,
+    GstClockTime timestamp)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  auto processor_info = klass->processor_info;
+  auto meter_interval = self->meter_interval;
+
+  if (meter_interval == 0)
+    return;
+
+  auto running_time = gst_segment_to_running_time(&self->segment, GST_FORMAT_TIME, timestamp);
+  if (!GST_CLOCK_TIME_IS_VALID(running_time))
+    return;
+
+  if (!interval_due(running_time, meter_interval, &self->next_meter_time))
+    return;
+
+  std::vector<gdouble> values(processor_info->n_properties);
+  gst_vst_audio_processor_read_parameter_values(self, values.data());
+
+  auto s = gst_structure_new("vst-meters",
+      "timestamp", G_TYPE_UINT64, timestamp,
+      "stream-time", G_TYPE_UINT64,
+      gst_segment_to_stream_time(&self->segment, GST_FORMAT_TIME, timestamp),
+      "running-time", G_TYPE_UINT64, running_time,
+      nullptr);
+
+  for (auto i = 0U; i < processor_info->n_properties; i++) {
+    auto property = &processor_info->properties[i];
+
+    if (!property->read_only)
+      continue;
+
+    if (property->type == G_TYPE_DOUBLE)
+      gst_structure_set(s, property->name, G_TYPE_DOUBLE, values[i], nullptr);
+    else if (property->type == G_TYPE_BOOLEAN)
+      gst_structure_set(s, property->name, G_TYPE_BOOLEAN, values[i] > 0.5, nullptr);
+    else
+      gst_structure_set(s, property->name, G_TYPE_INT, (gint) values[i], nullptr);
+  }
+
+  gst_element_post_message(GST_ELEMENT_CAST(self),
+      gst_message_new_element(GST_OBJECT_CAST(self), s));
+}
+
+// Sets the peak and RMS levels per channel in dB as peak and rms arrays, like
+// in the messages of the level element. Silence is reported as LEVEL_FLOOR
+// instead of -inf, also like there
+static void
+set_levels(GstStructure * s, const gdouble * peaks, const gdouble * sums,
+    gint channels, guint64 n_samples)
+{
+  GValue peak_array = G_VALUE_INIT, rms_array = G_VALUE_INIT, value = G_VALUE_INIT;
+
+  g_value_init(&peak_array, GST_TYPE_ARRAY);
+  g_value_init(&rms_array, GST_TYPE_ARRAY);
+  g_value_init(&value, G_TYPE_DOUBLE);
+
+  for (auto c = 0; c < channels; c++) {
+    g_value_set_double(&value, MAX(20.0 * std::log10(peaks[c]), LEVEL_FLOOR));
+    gst_value_array_append_value(&peak_array, &value);
+    g_value_set_double(&value, MAX(10.0 * std::log10(sums[c] / n_samples), LEVEL_FLOOR));
+    gst_value_array_append_value(&rms_array, &value);
+  }
+
+  gst_structure_take_value(s, "peak", &peak_array);
+  gst_structure_take_value(s, "rms", &rms_array);
+  g_value_unset(&value);
+}
+
+// Takes the levels the instance measured for an output buffer of the main
+// bus, attaches them to it and adds them to the next vst-level message
+static void
+gst_vst_audio_processor_add_levels(GstVstAudioProcessor *self,
+    GstBuffer * out_buffer, guint n_samples)
+{
+  auto instance = &self->instance;
+
+#if GST_CHECK_VERSION(1, 20, 0)
+  if (self->level_meta) {
+    auto meta = gst_buffer_add_custom_meta(out_buffer, GST_VST_LEVEL_META);
+
+    set_levels(gst_custom_meta_get_structure(meta), instance->level_peaks,
+        instance->level_sums, self->info.channels, n_samples);
+  }
+#endif
+
+  if (self->level_interval > 0) {
+    for (auto c = 0; c < self->info.channels; c++) {
+      self->level_peaks[c] = MAX(self->level_peaks[c], instance->level_peaks[c]);
+      self->level_sums[c] += instance->level_sums[c];
+    }
+    self->level_samples += n_samples;
+  }
+}
+
+static void
+gst_vst_audio_processor_reset_levels(GstVstAudioProcessor *self)
+{
+  for (auto c = 0; c < GST_VST_MAX_CHANNELS; c++)
+    self->level_peaks[c] = self->level_sums[c] = 0.0;
+  self->level_samples = 0;
+}
+
+// Posts the levels of the output since the last vst-level message if the
+// next one is due. Output that was not processed by the plugin, e.g. while
+// bypassed, is not measured
+static void
+gst_vst_audio_processor_post_levels(GstVstAudioProcessor *self,
+    GstClockTime timestamp)
+{
+  auto level_interval = self->level_interval;
+
+  if (level_interval == 0 || self->level_samples == 0)
+    return;
+
+  auto running_time = gst_segment_to_running_time(&self->segment, GST_FORMAT_TIME, timestamp);
+  if (!GST_CLOCK_TIME_IS_VALID(running_time))
+    return;
+
+  if (!interval_due(running_time, level_interval, &self->next_level_time))
+    return;
+
+  auto s = gst_structure_new("vst-level",
+      "timestamp", G_TYPE_UINT64, timestamp,
+      "stream-time", G_TYPE_UINT64,
+      gst_segment_to_stream_time(&self->segment, GST_FORMAT_TIME, timestamp),
+      "running-time", G_TYPE_UINT64, running_time,
+      "duration", G_TYPE_UINT64,
+      gst_util_uint64_scale(self->level_samples, GST_SECOND, self->info.rate),
+      nullptr);
+  set_levels(s, self->level_peaks, self->level_sums, self->info.channels,
+      self->level_samples);
+  gst_vst_audio_processor_reset_levels(self);
+
+  gst_element_post_message(GST_ELEMENT_CAST(self),
+      gst_message_new_element(GST_OBJECT_CAST(self), s));
+}
+
+// Caches the values of all parameters the component changed during the last
+// process() call and notifies anybody interested
+static void
+gst_vst_audio_processor_update_output_parameters(GstVstAudioProcessor *self,
+    Vst::ParameterChanges &out_parameter_changes)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  auto edit_controller = self->instance.edit_controller.get();
+  auto notify_interval = self->notify_interval;
+
+  auto out_changes_count = out_parameter_changes.getParameterCount();
+  auto n_output_values = 0U;
+  if (out_changes_count == 0)
+    return;
+
+  // The plugin is called before taking any lock, so that neither readers of
+  // the parameter values nor property setters wait for it
+  for (auto i = 0; i < out_changes_count; i++) {
+    auto queue = out_parameter_changes.getParameterData(i);
+    auto point_count = queue->getPointCount();
+    if (point_count > 0) {
+      Vst::ParamValue value;
+      Steinberg::int32 sample_offset = 0;
+
+      if (queue->getPoint(point_count - 1, sample_offset, value) == kResultOk) {
+        GstVstAudioProcessorProperty *prop = nullptr;
+        auto param_id = queue->getParameterId();
+        auto plain_value = edit_controller->normalizedParamToPlain(param_id, value);
+
+        guint k;
+        for (k = 0; k < klass->processor_info->n_properties; k++) {
+          if (klass->processor_info->properties[k].param_id == param_id) {
+            prop = &klass->processor_info->properties[k];
+            break;
+          }
+        }
+
+        // Cache the new value and remember to notify anybody interested
+        if (prop) {
+          self->output_indices[n_output_values] = k;
+          self->output_values[n_output_values] = plain_value;
+          n_output_values++;
+          self->changed_parameters[k] = TRUE;
+          self->have_changed_parameters = TRUE;
+          // Later ramps start from the value the component set itself
+          if (self->ramps[k].remaining == 0)
+            self->ramps[k].value = self->ramps[k].target = value;
+        }
+
+        // And let the edit controller know about this change too
+        edit_controller->setParamNormalized(param_id, value);
+      }
+    }
+  }
+
+  // Notifications are only sent once the lock is released again
+  GST_OBJECT_LOCK(self);
+  gst_vst_audio_processor_write_parameter_values_begin(self);
+  for (auto i = 0U; i < n_output_values; i++)
+    self->parameter_values[self->output_indices[i]] = self->output_values[i];
+  gst_vst_audio_processor_write_parameter_values_end(self);
+  GST_OBJECT_UNLOCK(self);
+
+  // Notify right away, or with the next batch
+  if (notify_interval == 0 && self->have_changed_parameters) {
+    for (auto k = 0U; k < klass->processor_info->n_properties; k++) {
+      if (!self->changed_parameters[k])
+        continue;
+      self->changed_parameters[k] = FALSE;
+      g_object_notify_by_pspec(G_OBJECT(self), klass->processor_info->properties[k].pspec);
+    }
+    self->have_changed_parameters = FALSE;
+  }
+}
+
+// Posts the changes collected with notify-interval > 0 once the interval
+// passed. Called for every chunk, also if the plugin changed nothing during
+// it, so that the last changes before the plugin stops are not held back
+static void
+gst_vst_audio_processor_post_due_parameters(GstVstAudioProcessor *self)
+{
+  auto notify_interval = self->notify_interval;
+
+  if (notify_interval > 0 && self->have_changed_parameters &&
+      g_get_monotonic_time() - self->last_notify_time >= (gint64) (notify_interval / GST_USECOND))
+    gst_vst_audio_processor_post_changed_parameters(self);
+}
+
+// Arguments of a process() call that is run by the scheduler
+typedef struct {
+  GstVstInstance *instance;
+  gconstpointer in_data;
+  gpointer out_data;
+  guint n_samples;
+  gint64 sample_position;
+  gboolean input_silent;
+  Vst::IParameterChanges *in_parameter_changes;
+  Vst::IParameterChanges *out_parameter_changes;
+
+  guint n_out_samples;
+  tresult res;
+} GstVstAudioProcessorProcessCall;
+
+static void
+gst_vst_audio_processor_process_call(gpointer user_data)
+{
+  auto call = (GstVstAudioProcessorProcessCall *) user_data;
+
+  call->res = gst_vst_instance_process(call->instance, call->in_data,
+      call->out_data, call->n_samples, call->sample_position, call->input_silent,
+      call->in_parameter_changes, call->out_parameter_changes, &call->n_out_samples);
+}
+
+// Processes one chunk, either directly on the streaming thread or on the
+// DSP scheduler if the element is registered with it
+static tresult
+gst_vst_audio_processor_process(GstVstAudioProcessor *self,
+    gconstpointer in_data, gpointer out_data, guint n_samples,
+    gint64 sample_position, gboolean input_silent,
+    Vst::IParameterChanges * in_parameter_changes,
+    Vst::IParameterChanges * out_parameter_changes, guint * n_out_samples)
+{
+  if (!self->scheduler_client)
+    return gst_vst_instance_process(&self->instance, in_data, out_data,
+        n_samples, sample_position, input_silent, in_parameter_changes,
+        out_parameter_changes, n_out_samples);
+
+  GstVstAudioProcessorProcessCall call = {
+    &self->instance, in_data, out_data, n_samples, sample_position,
+    input_silent, in_parameter_changes, out_parameter_changes, 0, kResultOk
+  };
+
+  gst_vst_scheduler_client_run(self->scheduler_client,
+      gst_util_uint64_scale_int(n_samples, GST_SECOND, self->info.rate),
+      gst_vst_audio_processor_process_call, &call);
+  *n_out_samples = call.n_out_samples;
+
+  return call.res;
+}
+
+// Hands the buffer to the segment renderer, together with the property
+// values at its beginning. Pending parameter changes are not needed anymore
+// as each segment's instance is synchronized with these values
+static GstFlowReturn
+gst_vst_audio_processor_chain_segments(GstVstAudioProcessor *self,
+    GstBuffer * in_buffer)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  auto stream_time = gst_segment_to_stream_time(&self->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS(in_buffer));
+
+  gst_object_sync_values(GST_OBJECT_CAST(self), stream_time);
+
+  // Segments are rendered with the parameter values of their start, so timed
+  // changes only apply from the next buffer on here
+  auto running_time = gst_segment_to_running_time(&self->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS(in_buffer));
+  while (GST_CLOCK_TIME_IS_VALID(running_time) && !g_queue_is_empty(&self->scheduled_changes)) {
+    auto change = (GstVstAudioProcessorParameterChange *) g_queue_peek_head(&self->scheduled_changes);
+
+    if (change->running_time > running_time)
+      break;
+
+    g_queue_pop_head(&self->scheduled_changes);
+    GST_OBJECT_LOCK(self);
+    gst_vst_audio_processor_write_parameter_values_begin(self);
+    self->parameter_values[change->idx] = change->value;
+    gst_vst_audio_processor_write_parameter_values_end(self);
+    GST_OBJECT_UNLOCK(self);
+    g_object_notify_by_pspec(G_OBJECT(self), klass->processor_info->properties[change->idx].pspec);
+    g_slice_free(GstVstAudioProcessorParameterChange, change);
+  }
+
+  auto parameter_values = g_new(gdouble, klass->processor_info->n_properties);
+  gst_vst_audio_processor_read_parameter_values(self, parameter_values);
+  GST_OBJECT_LOCK(self);
+  if (self->parameter_changes) {
+    delete self->parameter_changes;
+    self->parameter_changes = nullptr;
+  }
+  GST_OBJECT_UNLOCK(self);
+
+  auto ret = gst_vst_segment_renderer_chain(self->segment_renderer, in_buffer,
+      parameter_values);
+  g_free(parameter_values);
+
+  return ret;
+}
+
+// Renders and pushes the rest of the input queued in the segment renderer.
+// Errors can't be returned from an event, so they are posted instead. Returns
+// FALSE if the output is incomplete
+static gboolean
+gst_vst_audio_processor_drain_segments(GstVstAudioProcessor *self)
+{
+  if (!self->segment_renderer)
+    return TRUE;
+
+  auto ret = gst_vst_segment_renderer_drain(self->segment_renderer);
+  if (ret == GST_FLOW_OK)
+    return TRUE;
+
+  GST_DEBUG_OBJECT(self, "Draining segments failed: %s", gst_flow_get_name(ret));
+  if (ret == GST_FLOW_NOT_LINKED || ret < GST_FLOW_EOS)
+    GST_ELEMENT_ERROR(self, STREAM, FAILED, (nullptr),
+        ("Rendering the remaining segments failed: %s", gst_flow_get_name(ret)));
+
+  return FALSE;
+}
+
+// Returns whether the delayed input is needed: while bypass is enabled, left
+// or crossfaded, and with the bypass QoS policy that can need it at any time
+static gboolean
+gst_vst_audio_processor_needs_dry(GstVstAudioProcessor *self)
+{
+  return g_atomic_int_get(&self->bypass) || self->bypassed || self->crossfade_left > 0 ||
+      self->crossfade_delay_left > 0 || self->qos_policy == GST_VST_QOS_POLICY_BYPASS;
+}
+
+// Restarts the dry path with silence for the latency of the plugin if it is
+// needed, otherwise stops it so that no input is kept around
+static void
+gst_vst_audio_processor_reset_dry(GstVstAudioProcessor *self)
+{
+  self->dry_silence_left = 0;
+
+  if (!gst_vst_audio_processor_needs_dry(self)) {
+    g_clear_object(&self->dry_adapter);
+    return;
+  }
+
+  if (!self->dry_adapter)
+    self->dry_adapter = gst_adapter_new();
+  gst_adapter_clear(self->dry_adapter);
+
+  auto latency_samples = gst_util_uint64_scale(self->latency, self->info.rate, GST_SECOND);
+  if (latency_samples > 0) {
+    auto silence = gst_buffer_new_and_alloc(latency_samples * self->info.bpf);
+    GstMapInfo map;
+
+    gst_buffer_map(silence, &map, GST_MAP_WRITE);
+    gst_audio_format_fill_silence(self->info.finfo, map.data, map.size);
+    gst_buffer_unmap(silence, &map);
+    gst_adapter_push(self->dry_adapter, silence);
+    self->dry_silence_left = latency_samples;
+  }
+}
+
+// Starts the dry path once it is needed and stops it once it is not anymore
+static void
+gst_vst_audio_processor_update_dry(GstVstAudioProcessor *self)
+{
+  if (gst_vst_audio_processor_needs_dry(self) != (self->dry_adapter != nullptr))
+    gst_vst_audio_processor_reset_dry(self);
+}
+
+// Feeds one chunk of the input into the dry path
+static void
+gst_vst_audio_processor_feed_dry(GstVstAudioProcessor *self, GstBuffer * in_buffer,
+    gsize offset, guint n_samples)
+{
+  if (!self->dry_adapter)
+    return;
+
+  gst_adapter_push(self->dry_adapter, gst_buffer_copy_region(in_buffer,
+      GST_BUFFER_COPY_MEMORY, offset, n_samples * self->info.bpf));
+}
+
+// Takes one chunk of the delayed input from the dry path
+static GstBuffer *
+gst_vst_audio_processor_take_dry(GstVstAudioProcessor *self, guint n_samples)
+{
+  self->dry_silence_left -= MIN(self->dry_silence_left, n_samples);
+  return gst_adapter_take_buffer(self->dry_adapter, n_samples * self->info.bpf);
+}
+
+// Drops one chunk of the delayed input from the dry path if the output of the
+// plugin is used instead
+static void
+gst_vst_audio_processor_flush_dry(GstVstAudioProcessor *self, guint n_samples)
+{
+  if (!self->dry_adapter)
+    return;
+
+  self->dry_silence_left -= MIN(self->dry_silence_left, n_samples);
+  gst_adapter_flush(self->dry_adapter, n_samples * self->info.bpf);
+}
+
+// Pushes one chunk of the delayed input instead of the output of the plugin.
+// Auxiliary outputs get a gap as there is nothing to bypass to them
+static GstFlowReturn
+gst_vst_audio_processor_push_dry(GstVstAudioProcessor *self, guint n_samples,
+    GstClockTime pts, GstClockTime duration)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  auto out_buffer = gst_vst_audio_processor_take_dry(self, n_samples);
+
+  out_buffer = gst_buffer_make_writable(out_buffer);
+  GST_BUFFER_PTS(out_buffer) = pts;
+  GST_BUFFER_DURATION(out_buffer) = duration;
+  GST_BUFFER_FLAG_UNSET(out_buffer, GST_BUFFER_FLAG_DISCONT);
+
+  auto ret = gst_flow_combiner_update_pad_flow(self->flow_combiner, self->srcpad,
+      gst_pad_push(self->srcpad, out_buffer));
+
+  for (auto i = 0U; i < klass->processor_info->n_aux_outputs; i++)
+    gst_pad_push_event(self->aux_srcpads[i], gst_event_new_gap(pts, duration));
+
+  return ret;
+}
+
+// Mixes interleaved dry samples into the output with a linear crossfade. pos
+// is the position in the crossfade of total samples of the first sample, and
+// is negative if the crossfade only starts later
+template<typename T>
+static void
+crossfade(T * out, const T * dry, guint n_samples, gint channels, gint64 pos,
+    guint total, gboolean to_dry)
+{
+  for (auto i = 0U; i < n_samples; i++) {
+    auto dry_gain = total > 0 ? (T) CLAMP(pos + i, 0, (gint64) total) / (T) total
+        : (T) (pos + i >= 0);
+
+    if (!to_dry)
+      dry_gain = 1 - dry_gain;
+
+    for (auto c = 0; c < channels; c++, out++, dry++)
+      *out = *out + (*dry - *out) * dry_gain;
+  }
+}
+
+// Takes one chunk of the dry path and crossfades the output of the plugin
+// with it, towards the dry path when entering bypass and towards the plugin
+// when leaving it. Until the crossfade starts, the dry path replaces the
+// output
+static void
+gst_vst_audio_processor_crossfade_dry(GstVstAudioProcessor *self,
+    GstBuffer * out_buffer, guint n_out_samples, guint chunk_size)
+{
+  auto dry_buffer = gst_vst_audio_processor_take_dry(self, chunk_size);
+  auto n_samples = MIN(n_out_samples, chunk_size);
+  auto pos = (gint64) self->crossfade_samples - self->crossfade_left - self->crossfade_delay_left;
+  auto delay = MIN(self->crossfade_delay_left, chunk_size);
+  GstMapInfo out_map, dry_map;
+
+  gst_buffer_map(out_buffer, &out_map, GST_MAP_READWRITE);
+  gst_buffer_map(dry_buffer, &dry_map, GST_MAP_READ);
+  if (GST_AUDIO_INFO_FORMAT(&self->info) == GST_AUDIO_FORMAT_F32)
+    crossfade((gfloat *) out_map.data, (const gfloat *) dry_map.data, n_samples,
+        self->info.channels, pos, self->crossfade_samples, self->bypassed);
+  else
+    crossfade((gdouble *) out_map.data, (const gdouble *) dry_map.data, n_samples,
+        self->info.channels, pos, self->crossfade_samples, self->bypassed);
+  gst_buffer_unmap(dry_buffer, &dry_map);
+  gst_buffer_unmap(out_buffer, &out_map);
+  gst_buffer_unref(dry_buffer);
+
+  self->crossfade_delay_left -= delay;
+  self->crossfade_left -= MIN(self->crossfade_left, chunk_size - delay);
+}
+
+// Takes a newly loaded state if there is one. Its instance first processes
+// the input next to the current one until its output is valid, as it would
+// otherwise fade in from the silence it primes its latency with. Once primed,
+// the element switches to it at the start of the next chunk and crossfades
+// from the output of the previous instance
+static void
+gst_vst_audio_processor_switch_to_standby(GstVstAudioProcessor *self,
+    const guint8 * in_data, guint chunk_size, gint64 sample_position,
+    gboolean input_silent)
+{
+  GST_OBJECT_LOCK(self);
+  auto standby = self->standby_instance;
+  auto values = self->standby_parameter_values;
+  self->standby_instance = nullptr;
+  self->standby_parameter_values = nullptr;
+  GST_OBJECT_UNLOCK(self);
+
+  if (standby) {
+    // The configuration changed while the state was loaded
+    if (!gst_audio_info_is_equal(&standby->info, &self->info)
+        || standby->process_mode != self->instance.process_mode
+        || standby->data_len != self->instance.data_len) {
+      GST_DEBUG_OBJECT(self, "Setting up instance with new state again");
+      if (!gst_vst_instance_setup(standby, &self->info, self->instance.process_mode, self->instance.data_len)
+          || !gst_vst_instance_activate(standby)) {
+        GST_WARNING_OBJECT(self, "Failed to set up instance with new state, keeping the current one");
+        gst_vst_audio_processor_retire_instance(self, standby);
+        g_free(values);
+        return;
+      }
+    }
+
+    // A state that is still priming is replaced by the newer one
+    if (self->priming_instance) {
+      gst_vst_audio_processor_retire_instance(self, self->priming_instance);
+      g_free(self->priming_parameter_values);
+    }
+    self->priming_instance = standby;
+    self->priming_parameter_values = values;
+    self->priming_left = gst_util_uint64_scale(gst_vst_instance_get_latency(standby),
+        self->info.rate, GST_SECOND);
+    GST_DEBUG_OBJECT(self, "Priming instance with new state for %u samples", self->priming_left);
+  }
+
+  if (!self->priming_instance)
+    return;
+
+  if (self->priming_left > 0) {
+    guint n_samples = 0;
+
+    auto res = gst_vst_instance_process(self->priming_instance, in_data, self->state_data,
+        chunk_size, sample_position, input_silent, nullptr,
+        gst_vst_instance_get_out_parameter_changes(self->priming_instance), &n_samples);
+    if (res != kResultOk) {
+      GST_WARNING_OBJECT(self, "Failed to prime instance with new state, keeping the current one");
+      gst_vst_audio_processor_retire_instance(self, self->priming_instance);
+      g_free(self->priming_parameter_values);
+      self->priming_instance = nullptr;
+      self->priming_parameter_values = nullptr;
+      self->priming_left = 0;
+    } else {
+      self->priming_left -= MIN(self->priming_left, chunk_size);
+    }
+    return;
+  }
+
+  GST_DEBUG_OBJECT(self, "Switching to new state");
+
+  standby = self->priming_instance;
+  self->priming_instance = nullptr;
+
+  auto latency = gst_vst_instance_get_latency(&self->instance);
+  gst_vst_audio_processor_switch_instance(self, standby, self->priming_parameter_values);
+  g_free(self->priming_parameter_values);
+  self->priming_parameter_values = nullptr;
+
+  // A crossfade that was not finished yet is cut short
+  if (self->fading_instance)
+    gst_vst_audio_processor_retire_instance(self, self->fading_instance);
+  self->fading_instance = nullptr;
+
+  self->state_crossfade_samples = gst_util_uint64_scale(self->state_crossfade, self->info.rate, GST_SECOND);
+  self->state_crossfade_left = self->state_crossfade_samples;
+  if (self->state_crossfade_samples > 0)
+    self->fading_instance = standby;
+  else
+    gst_vst_audio_processor_retire_instance(self, standby);
+
+  if (gst_vst_instance_get_latency(&self->instance) != latency)
+    gst_element_post_message(GST_ELEMENT_CAST(self),
+        gst_message_new_latency(GST_OBJECT_CAST(self)));
+}
+
+// Processes the chunk with the previous instance too and fades from its
+// output to the output of the current instance
+static void
+gst_vst_audio_processor_crossfade_state(GstVstAudioProcessor *self,
+    const guint8 * in_data, GstBuffer * out_buffer, guint n_out_samples,
+    guint chunk_size, gint64 sample_position, gboolean input_silent)
+{
+  auto instance = self->fading_instance;
+  auto pos = self->state_crossfade_samples - self->state_crossfade_left;
+  GstMapInfo out_map;
+  guint n_old_samples = 0;
+
+  auto res = gst_vst_instance_process(instance, in_data, self->state_data, chunk_size,
+      sample_position, input_silent, nullptr,
+      gst_vst_instance_get_out_parameter_changes(instance), &n_old_samples);
+
+  if (res == kResultOk) {
+    auto n_samples = MIN(n_out_samples, n_old_samples);
+
+    gst_buffer_map(out_buffer, &out_map, GST_MAP_READWRITE);
+    if (GST_AUDIO_INFO_FORMAT(&self->info) == GST_AUDIO_FORMAT_F32)
+      crossfade((gfloat *) out_map.data, (const gfloat *) self->state_data, n_samples,
+          self->info.channels, pos, self->state_crossfade_samples, FALSE);
+    else
+      crossfade((gdouble *) out_map.data, (const gdouble *) self->state_data, n_samples,
+          self->info.channels, pos, self->state_crossfade_samples, FALSE);
+    gst_buffer_unmap(out_buffer, &out_map);
+  }
+
+  self->state_crossfade_left -= MIN(self->state_crossfade_left, chunk_size);
+  if (self->state_crossfade_left == 0 || res != kResultOk) {
+    gst_vst_audio_processor_retire_instance(self, instance);
+    self->fading_instance = nullptr;
+    self->state_crossfade_left = 0;
+  }
+}
+
+// Stores the latency of the plugin and lets the pipeline know if it changed
+static void
+gst_vst_audio_processor_update_latency(GstVstAudioProcessor *self,
+    GstClockTime latency)
+{
+  if (latency == self->latency)
+    return;
+
+  self->latency = latency;
+  GST_DEBUG_OBJECT(self, "Latency changed to %" GST_TIME_FORMAT, GST_TIME_ARGS(latency));
+  gst_element_post_message(GST_ELEMENT_CAST(self), gst_message_new_latency(GST_OBJECT_CAST(self)));
+}
+
+// Pushes the input, or silence of the same duration, while the plugin is
+// still being opened in the background. Auxiliary outputs get a gap
+static GstFlowReturn
+gst_vst_audio_processor_push_unopened(GstVstAudioProcessor *self,
+    GstBuffer * in_buffer)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  auto pts = GST_BUFFER_PTS(in_buffer);
+  auto duration = gst_util_uint64_scale(gst_buffer_get_size(in_buffer) / self->info.bpf,
+      GST_SECOND, self->info.rate);
+
+  if (self->async_open_fallback == GST_VST_ASYNC_OPEN_FALLBACK_SILENCE) {
+    GstMapInfo map;
+
+    in_buffer = gst_buffer_make_writable(in_buffer);
+    gst_buffer_map(in_buffer, &map, GST_MAP_WRITE);
+    gst_audio_format_fill_silence(self->info.finfo, map.data, map.size);
+    gst_buffer_unmap(in_buffer, &map);
+    GST_BUFFER_FLAG_SET(in_buffer, GST_BUFFER_FLAG_GAP);
+  }
+
+  for (auto i = 0U; i < klass->processor_info->n_aux_outputs; i++)
+    gst_pad_push_event(self->aux_srcpads[i], gst_event_new_gap(pts, duration));
+
+  return gst_flow_combiner_update_pad_flow(self->flow_combiner, self->srcpad,
+      gst_pad_push(self->srcpad, in_buffer));
+}
+
+// Sets up the plugin that just took over from the fallback for the current
+// configuration. The pipeline has to adapt to its latency now, which was not
+// known during the fallback. After passthrough the plugin starts like when
+// leaving bypass: the dry path, delayed by the new latency, is output until
+// the plugin has processed its latency and then its output fades in
+static gboolean
+gst_vst_audio_processor_start_opened(GstVstAudioProcessor *self)
+{
+  auto process_mode = gst_vst_process_mode_resolve(self->process_mode, self->sinkpad);
+
+  gst_vst_instance_set_lock_memory(&self->instance, self->lock_memory);
+  gst_vst_instance_set_flush_denormals(&self->instance, self->flush_denormals);
+  if (!gst_vst_instance_setup(&self->instance, &self->info, process_mode,
+        self->max_samples_per_chunk))
+    return FALSE;
+
+  gst_vst_audio_processor_update_latency(self, gst_vst_instance_get_latency(&self->instance));
+
+  if (self->async_open_fallback == GST_VST_ASYNC_OPEN_FALLBACK_PASSTHROUGH) {
+    self->bypassed = TRUE;
+    self->crossfade_left = self->crossfade_delay_left = 0;
+  }
+  gst_vst_audio_processor_reset_dry(self);
+
+  return TRUE;
+}
+
+// Applies changes of the bypass property. Entering bypass waits until the
+// dry path that was started for it has the aligned input, and leaving bypass
+// restarts the plugin, as its state is from before bypass was entered. Its
+// output is only faded in after its latency, before that it is not valid yet
+static void
+gst_vst_audio_processor_update_bypass(GstVstAudioProcessor *self)
+{
+  auto bypass = g_atomic_int_get(&self->bypass);
+
+  if (bypass == self->bypassed)
+    return;
+
+  if (bypass && self->crossfade_left == 0 && (!self->dry_adapter || self->dry_silence_left > 0))
+    return;
+
+  GST_DEBUG_OBJECT(self, "%s bypass", bypass ? "Entering" : "Leaving");
+
+  self->bypassed = bypass;
+  self->crossfade_samples = gst_util_uint64_scale(self->bypass_crossfade, self->info.rate, GST_SECOND);
+  // A crossfade that was not finished yet continues from the same gain
+  self->crossfade_left = self->crossfade_left > 0 ?
+      self->crossfade_samples - MIN(self->crossfade_left, self->crossfade_samples) : self->crossfade_samples;
+
+  self->crossfade_delay_left = 0;
+
+  if (!bypass) {
+    gst_vst_instance_deactivate(&self->instance);
+    self->crossfade_delay_left = gst_util_uint64_scale(self->latency, self->info.rate, GST_SECOND);
+  }
+}
+
+// Returns the QoS policy that has to be applied to the chunk at pts, or
+// GST_VST_QOS_POLICY_NONE if it is not late
+static GstVstQosPolicy
+gst_vst_audio_processor_check_qos(GstVstAudioProcessor *self, GstClockTime pts,
+    GstClockTime duration)
+{
+  auto qos_policy = self->qos_policy;
+
+  // Nothing is processed while bypassed anyway
+  if (qos_policy == GST_VST_QOS_POLICY_NONE || (self->bypassed && self->crossfade_left == 0))
+    return GST_VST_QOS_POLICY_NONE;
+
+  // Nothing left to shed
+  if (qos_policy == GST_VST_QOS_POLICY_REALTIME && self->instance.process_mode == Vst::kRealtime)
+    return GST_VST_QOS_POLICY_NONE;
+
+  auto running_time = gst_segment_to_running_time(&self->segment, GST_FORMAT_TIME, pts);
+
+  GST_OBJECT_LOCK(self);
+  auto earliest_time = self->earliest_time;
+  GST_OBJECT_UNLOCK(self);
+
+  if (!GST_CLOCK_TIME_IS_VALID(running_time) || !GST_CLOCK_TIME_IS_VALID(earliest_time) ||
+      running_time + duration + self->qos_threshold > earliest_time)
+    return GST_VST_QOS_POLICY_NONE;
+
+  GST_LOG_OBJECT(self, "Chunk at %" GST_TIME_FORMAT " is too late, earliest time %"
+      GST_TIME_FORMAT, GST_TIME_ARGS(running_time), GST_TIME_ARGS(earliest_time));
+
+  return qos_policy;
+}
+
+// Lets the application know that samples were not processed. Only one
+// message with the accumulated statistics is posted per QoS event, as every
+// event can make many chunks late
+static void
+gst_vst_audio_processor_post_qos(GstVstAudioProcessor *self, GstClockTime pts,
+    GstClockTime duration)
+{
+  GST_OBJECT_LOCK(self);
+  auto pending = self->qos_message_pending;
+  auto earliest_time = self->earliest_time;
+  auto proportion = self->proportion;
+  self->qos_message_pending = FALSE;
+  GST_OBJECT_UNLOCK(self);
+
+  if (!pending)
+    return;
+
+  auto running_time = gst_segment_to_running_time(&self->segment, GST_FORMAT_TIME, pts);
+  auto stream_time = gst_segment_to_stream_time(&self->segment, GST_FORMAT_TIME, pts);
+
+  auto jitter = GST_CLOCK_TIME_IS_VALID(earliest_time) && GST_CLOCK_TIME_IS_VALID(running_time) ?
+      GST_CLOCK_DIFF(running_time, earliest_time) : 0;
+  auto total = self->qos_processed + self->qos_dropped;
+
+  auto message = gst_message_new_qos(GST_OBJECT_CAST(self), FALSE, running_time,
+      stream_time, pts, duration);
+  gst_message_set_qos_values(message, jitter, proportion,
+      total > 0 ? (gint) gst_util_uint64_scale(self->qos_processed, 1000000, total) : 1000000);
+  gst_message_set_qos_stats(message, GST_FORMAT_DEFAULT, self->qos_processed,
+      self->qos_dropped);
+  gst_element_post_message(GST_ELEMENT_CAST(self), message);
+}
+
+// Reconfigures the plugin for realtime processing, which allows it to use
+// cheaper algorithms
+static gboolean
+gst_vst_audio_processor_switch_to_realtime(GstVstAudioProcessor *self,
+    GstClockTime pts, GstClockTime duration)
+{
+  GST_INFO_OBJECT(self, "Falling behind, switching to realtime processing");
+
+  if (!gst_vst_instance_setup(&self->instance, &self->info, Vst::kRealtime,
+        self->max_samples_per_chunk) ||
+      !gst_vst_instance_activate(&self->instance))
+    return FALSE;
+
+  gst_vst_audio_processor_post_qos(self, pts, duration);
+
+  return TRUE;
+}
+
+// Outputs one chunk without processing it: either the input delayed by the
+// latency of the plugin or a gap
+static GstFlowReturn
+gst_vst_audio_processor_push_degraded(GstVstAudioProcessor *self,
+    GstVstQosPolicy qos_policy, guint chunk_size, GstClockTime pts,
+    GstClockTime duration)
+{
+  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+  auto ret = GST_FLOW_OK;
+
+  self->qos_dropped += chunk_size;
+  gst_vst_audio_processor_post_qos(self, pts, duration);
+
+  if (qos_policy == GST_VST_QOS_POLICY_BYPASS) {
+    ret = gst_vst_audio_processor_push_dry(self, chunk_size, pts, duration);
+  } else {
+    gst_vst_audio_processor_flush_dry(self, chunk_size);
+    gst_pad_push_event(self->srcpad, gst_event_new_gap(pts, duration));
+
+    // There is nothing that could be bypassed to the auxiliary outputs
+    for (auto i = 0U; i < klass->processor_info->n_aux_outputs; i++)
+      gst_pad_push_event(self->aux_srcpads[i], gst_event_new_gap(pts, duration));
+  }
+
+  return ret;
+}
+
+// Turns the pending changes of continuous parameters into linear ramps over
+// parameter-ramp-time, starting from the value the component has right now,
+// and continues the ramps that are in progress over this chunk. All other
+// changes are applied at the start of the chunk as before. Takes ownership
+// of parameter_changes and returns the changes for the component. Must be
+// called with the stream lock
+static Vst::ParameterChanges *
+gst_vst_audio_processor_ramp_parameters(GstVstAudioProcessor *self,
+    Vst::ParameterChanges * parameter_changes, guint chunk_size)
+{
+  auto processor_info = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info;
+  auto ramp_samples = gst_util_uint64_scale(self->parameter_ramp_time, self->info.rate, GST_SECOND);
+
+  if (!parameter_changes && self->n_ramping == 0)
+    return nullptr;
+  if (parameter_changes && ramp_samples <= 1 && self->n_ramping == 0) {
+    // Only keep track of the values for later ramps
+    for (auto i = 0; i < parameter_changes->getParameterCount(); i++) {
+      auto queue = parameter_changes->getParameterData(i);
+      auto n_points = queue->getPointCount();
+      Steinberg::int32 offset;
+      Vst::ParamValue value;
+
+      if (n_points == 0 || queue->getPoint(n_points - 1, offset, value) != kResultOk)
+        continue;
+      for (auto k = 0U; k < processor_info->n_properties; k++) {
+        if (processor_info->properties[k].param_id == queue->getParameterId()) {
+          self->ramps[k].value = self->ramps[k].target = value;
+          break;
+        }
+      }
+    }
+    return parameter_changes;
+  }
+
+  auto ramped = self->ramp_parameter_changes;
+  ramped->clearQueue();
+
+  if (parameter_changes) {
+    for (auto i = 0; i < parameter_changes->getParameterCount(); i++) {
+      auto queue = parameter_changes->getParameterData(i);
+      auto param_id = queue->getParameterId();
+      auto n_points = queue->getPointCount();
+      Steinberg::int32 offset, idx;
+      Vst::ParamValue value;
+
+      if (n_points == 0 || queue->getPoint(n_points - 1, offset, value) != kResultOk)
+        continue;
+
+      guint k;
+      for (k = 0; k < processor_info->n_properties; k++) {
+        if (processor_info->properties[k].param_id == param_id)
+          break;
+      }
+      if (k == processor_info->n_properties) {
+        ramped->addParameterData(param_id, idx)->addPoint(0, value, idx);
+        continue;
+      }
+
+      // Only the last value counts, a ramp in progress continues from
+      // where it is right now
+      auto ramp = &self->ramps[k];
+      if (ramp->remaining > 0)
+        self->n_ramping--;
+
+      if (ramp_samples > 1 && processor_info->properties[k].type == G_TYPE_DOUBLE
+          && value != ramp->value) {
+        ramp->target = value;
+        ramp->step = (value - ramp->value) / ramp_samples;
+        ramp->remaining = ramp_samples;
+        self->n_ramping++;
+      } else {
+        ramp->value = ramp->target = value;
+        ramp->remaining = 0;
+        ramped->addParameterData(param_id, idx)->addPoint(0, value, idx);
+      }
+    }
+    delete parameter_changes;
+  }
+
+  // The component interpolates linearly between the points, so two points
+  // per chunk are enough
+  for (auto k = 0U; k < processor_info->n_properties && self->n_ramping > 0; k++) {
+    auto ramp = &self->ramps[k];
+    Steinberg::int32 idx;
+
+    if (ramp->remaining == 0)
+      continue;
+
+    auto queue = ramped->addParameterData(processor_info->properties[k].param_id, idx);
+    queue->addPoint(0, ramp->value, idx);
+
+    if (ramp->remaining <= chunk_size) {
+      queue->addPoint(ramp->remaining - 1, ramp->target, idx);
+      ramp->value = ramp->target;
+      ramp->remaining = 0;
+      self->n_ramping--;
+    } else {
+      queue->addPoint(chunk_size - 1, ramp->value + ramp->step * (chunk_size - 1), idx);
+      ramp->value += ramp->step * chunk_size;
+      ramp->remaining -= chunk_size;
+    }
+  }
+
+  return ramped;
+}
+
+// Adds the changes of vst-parameter-change events that are due before the
+// end of this chunk at their sample offsets. Changes for earlier running
+// times, e.g. from while the plugin was bypassed, are applied at the start of
+// the chunk. A timed change ends any ramp of its parameter. Takes ownership
+// of parameter_changes and returns the changes for the component. Must be
+// called with the stream lock
+static Vst::ParameterChanges *
+gst_vst_audio_processor_schedule_parameters(GstVstAudioProcessor *self,
+    Vst::ParameterChanges * parameter_changes, GstClockTime running_time,
+    guint chunk_size)
+{
+  auto processor_info = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info;
+  std::vector<GstVstAudioProcessorParameterChange *> due;
+  std::vector<Steinberg::int32> offsets;
+
+  while (GST_CLOCK_TIME_IS_VALID(running_time) && self->instance.edit_controller &&
+      !g_queue_is_empty(&self->scheduled_changes)) {
+    auto change = (GstVstAudioProcessorParameterChange *) g_queue_peek_head(&self->scheduled_changes);
+    guint64 offset = 0;
+
+    if (change->running_time > running_time)
+      offset = gst_util_uint64_scale(change->running_time - running_time, self->info.rate, GST_SECOND);
+    if (offset >= chunk_size)
+      break;
+
+    due.push_back((GstVstAudioProcessorParameterChange *) g_queue_pop_head(&self->scheduled_changes));
+    offsets.push_back((Steinberg::int32) offset);
   }
 
-  auto factory = mod->getFactory();
+  // Otherwise the ramps would add points after the timed changes
+  for (auto change : due) {
+    auto ramp = &self->ramps[change->idx];
 
-  auto component = factory.createInstance<Vst::IComponent>(klass->processor_info->class_id);
-  if (!component) {
-    GST_ERROR_OBJECT(self, "Failed to create instance for '%s'", klass->processor_info->name);
-    return FALSE;
+    if (ramp->remaining > 0) {
+      ramp->remaining = 0;
+      self->n_ramping--;
+    }
   }
 
-  auto res = component->initialize(gStandardPluginContext);
-  if (res != kResultOk) {
-    GST_ERROR_OBJECT(self, "Component can't be initialized: 0x%08x", res);
-    return FALSE;
+  parameter_changes = gst_vst_audio_processor_ramp_parameters(self, parameter_changes, chunk_size);
+  if (due.empty())
+    return parameter_changes;
+  if (!parameter_changes) {
+    parameter_changes = self->ramp_parameter_changes;
+    parameter_changes->clearQueue();
   }
 
-  // Check if this supports the IAudioProcessor interface
-  IPtr<Vst::IAudioProcessor> audio_processor;
-  Vst::IAudioProcessor *audio_processor_ptr = nullptr;
-  if (component->queryInterface(Vst::IAudioProcessor::iid, (void **) &audio_processor_ptr) != kResultOk
-      || !audio_processor_ptr) {
-    GST_ERROR_OBJECT(self, "Component does not implement IAudioProcessor interface");
-    return FALSE;
-  }
-  audio_processor = shared(audio_processor_ptr);
-
-  // Get the controller
-  IPtr<Vst::IEditController> edit_controller;
-  Vst::IEditController *edit_controller_ptr = nullptr;
-  if (component->queryInterface(Vst::IEditController::iid, (void**) &edit_controller_ptr) != kResultOk
-      || !edit_controller_ptr) {
-    FUID controller_cid;
-
-    // ask for the associated controller class ID
-    if (component->getControllerClassId(controller_cid) == kResultOk && controller_cid.isValid ()) {
-      // create its controller part created from the factory
-      edit_controller = factory.createInstance<Vst::IEditController>(controller_cid.toTUID());
-      if (edit_controller) {
-        // initialize the component with our context
-        res = edit_controller->initialize(gStandardPluginContext);
-        if (res != kResultOk) {
-          GST_ERROR_OBJECT(self, "Can't initialize edit controller: 0x%08x", res);
-          return FALSE;
-        }
-      }
+  GST_OBJECT_LOCK(self);
+  gst_vst_audio_processor_write_parameter_values_begin(self);
+  for (auto i = 0U; i < due.size(); i++) {
+    auto ramp = &self->ramps[due[i]->idx];
+
+    // Started by a property change during this chunk
+    if (ramp->remaining > 0) {
+      ramp->remaining = 0;
+      self->n_ramping--;
     }
-  } else {
-    edit_controller = shared(edit_controller_ptr);
+
+    // Points are interpolated linearly from the start of the chunk, so the
+    // previous value is held until right before the change. A change at the
+    // same offset already has its hold point
+    auto param_id = processor_info->properties[due[i]->idx].param_id;
+    auto held = offsets[i] == 0;
+    for (auto j = 0U; j < i && !held; j++)
+      held = due[j]->idx == due[i]->idx && offsets[j] == offsets[i];
+    if (!held) {
+      Steinberg::int32 idx = 0;
+      parameter_changes->addParameterData(param_id, idx)->addPoint(offsets[i] - 1, ramp->value, idx);
+    }
+
+    self->parameter_values[due[i]->idx] = due[i]->value;
+    ramp->value = ramp->target = gst_vst_instance_set_parameter(&self->instance,
+        parameter_changes, param_id, due[i]->value, offsets[i]);
   }
+  gst_vst_audio_processor_write_parameter_values_end(self);
+  GST_OBJECT_UNLOCK(self);
 
-  if (!edit_controller) {
-    GST_ERROR_OBJECT(self, "No edit controller found");
-    return FALSE;
+  for (auto change : due) {
+    g_object_notify_by_pspec(G_OBJECT(self), processor_info->properties[change->idx].pspec);
+    g_slice_free(GstVstAudioProcessorParameterChange, change);
   }
 
-  // activate busses, just in case
-  res = component->activateBus(Vst::MediaTypes::kAudio, Vst::BusDirections::kInput, 0, TRUE);
-  if (res != kResultOk) {
-    GST_ERROR_OBJECT(self, "Failed to activate input bus: 0x%08x", res);
-    return FALSE;
+  return parameter_changes;
+}
+
+// Processes one chunk of the input buffer and pushes the output downstream.
+// in_place_map is the writable mapping of an input buffer that is a single
+// chunk, or nullptr. If the input buffer was processed in place and pushed,
+// it was unmapped and consumed is set
+static GstFlowReturn
+gst_vst_audio_processor_process_chunk(GstVstAudioProcessor *self,
+    GstBuffer * in_buffer, GstMapInfo * in_place_map, const guint8 * in_data,
+    guint chunk_size, gint64 sample_position, GstClockTime pts,
+    GstClockTime duration, gboolean * consumed)
+{
+  auto ret = GST_FLOW_OK;
+
+  gst_vst_audio_processor_switch_to_standby(self, in_data, chunk_size, sample_position,
+      GST_BUFFER_FLAG_IS_SET(in_buffer, GST_BUFFER_FLAG_GAP));
+
+  // Check if we have any pending input parameter changes
+  GST_OBJECT_LOCK(self);
+  auto parameter_changes = self->parameter_changes;
+  self->parameter_changes = nullptr;
+  GST_OBJECT_UNLOCK(self);
+  parameter_changes = gst_vst_audio_processor_schedule_parameters(self, parameter_changes,
+      gst_segment_to_running_time(&self->segment, GST_FORMAT_TIME, pts), chunk_size);
+
+  // Space for any output parameter changes
+  auto &out_parameter_changes = *gst_vst_instance_get_out_parameter_changes(&self->instance);
+
+  // And process into the input buffer if nothing needs the input afterwards,
+  // otherwise into a new output buffer
+  auto in_place = in_place_map && !gst_vst_audio_processor_needs_dry(self) && !self->fading_instance;
+  auto input_silent = GST_BUFFER_FLAG_IS_SET(in_buffer, GST_BUFFER_FLAG_GAP);
+  GstBuffer *out_buffer;
+  GstMapInfo out_map;
+  guint n_out_samples = 0;
+
+  if (in_place) {
+    out_buffer = in_buffer;
+    out_map = *in_place_map;
+  } else {
+    out_buffer = gst_buffer_new_and_alloc(chunk_size * self->info.bpf);
+    gst_buffer_map(out_buffer, &out_map, GST_MAP_WRITE);
   }
-  res = component->activateBus(Vst::MediaTypes::kAudio, Vst::BusDirections::kOutput, 0, TRUE);
-  if (res != kResultOk) {
-    GST_ERROR_OBJECT(self, "Failed to activate output bus: 0x%08x", res);
-    return FALSE;
+  gst_vst_audio_processor_prepare_aux_outputs(self, chunk_size);
+  gst_vst_instance_set_measure_levels(&self->instance,
+      self->level_meta || self->level_interval > 0);
+  auto res = gst_vst_audio_processor_process(self, (gconstpointer) in_data,
+      (gpointer) out_map.data, chunk_size, sample_position, input_silent,
+      parameter_changes, &out_parameter_changes, &n_out_samples);
+  if (in_place) {
+    gst_buffer_unmap(in_buffer, in_place_map);
+    *consumed = TRUE;
+    GST_BUFFER_FLAG_UNSET(out_buffer, GST_BUFFER_FLAG_GAP);
+#if GST_CHECK_VERSION(1, 20, 0)
+    // Levels of upstream are not the levels of our output
+    GstCustomMeta *level_meta;
+    while ((level_meta = gst_buffer_get_custom_meta(out_buffer, GST_VST_LEVEL_META)))
+      gst_buffer_remove_meta(out_buffer, (GstMeta *) level_meta);
+#endif
+  } else {
+    gst_buffer_unmap(out_buffer, &out_map);
   }
 
-  self->component_handler = owned(new GstVstAudioProcessorComponentHandler(self));
+  // We have to delete the pointer here, the processor does not do that.
+  // The ramped changes are kept for the next chunk
+  if (parameter_changes && parameter_changes != self->ramp_parameter_changes)
+    delete parameter_changes;
 
-  // the host set its handler to the controller
-  edit_controller->setComponentHandler(self->component_handler);
+  // Update out parameter changes
+  gst_vst_audio_processor_update_output_parameters(self, out_parameter_changes);
 
-  // connect the 2 components
-  Vst::IConnectionPoint* iConnectionPointComponent = nullptr;
-  Vst::IConnectionPoint* iConnectionPointController = nullptr;
-  component->queryInterface(Vst::IConnectionPoint::iid, (void**)&iConnectionPointComponent);
-  edit_controller->queryInterface(Vst::IConnectionPoint::iid, (void**)&iConnectionPointController);
-  if (iConnectionPointComponent && iConnectionPointController) {
-    iConnectionPointComponent->connect(iConnectionPointController);
-    iConnectionPointController->connect(iConnectionPointComponent);
+  if (res != kResultOk) {
+    gst_vst_audio_processor_push_aux_outputs(self, 0, GST_CLOCK_TIME_NONE,
+        GST_CLOCK_TIME_NONE, GST_FLOW_OK);
+    gst_buffer_unref(out_buffer);
+    return GST_FLOW_ERROR;
   }
 
-  // synchronize controller to component by using setComponentState
-  MemoryStream stream;
-  if (component->getState(&stream) == kResultOk) {
-    stream.truncate();
-    edit_controller->setComponentState(&stream);
+  // If there's output, push it downstream
+  // FIXME: We assume that input length == output length currently
+  // for the timestamp calculation. This is not necessarily true:
+  // there could be latency involved. But none of the plugins this was
+  // tested with makes use of that
+  if (n_out_samples != chunk_size) {
+    GST_FIXME_OBJECT(self, "Output number of samples different than input: %u != %u", n_out_samples, chunk_size);
   }
 
-  // synchronize our cached property values with the component and controller
-  self->parameter_changes = new Vst::ParameterChanges();
-  for (auto i = 0U; i < klass->processor_info->n_properties; i++) {
-    auto property = &klass->processor_info->properties[i];
+  auto crossfading = self->fading_instance || self->crossfade_left > 0 || self->crossfade_delay_left > 0;
 
-    if (property->read_only)
-      continue;
+  if (self->fading_instance)
+    gst_vst_audio_processor_crossfade_state(self, in_data, out_buffer, n_out_samples,
+        chunk_size, sample_position, input_silent);
+
+  // Fade between the dry path and the plugin while entering or leaving
+  // bypass, otherwise the dry path is not needed
+  if (self->crossfade_left > 0 || self->crossfade_delay_left > 0)
+    gst_vst_audio_processor_crossfade_dry(self, out_buffer, n_out_samples, chunk_size);
+  else
+    gst_vst_audio_processor_flush_dry(self, chunk_size);
+
+  // The levels were measured while interleaving the output of the plugin,
+  // only a crossfade needs another pass over the final output
+  if (self->instance.measure_levels && n_out_samples > 0) {
+    if (crossfading) {
+      gst_buffer_map(out_buffer, &out_map, GST_MAP_READ);
+      gst_vst_instance_measure_levels(&self->instance, out_map.data, n_out_samples);
+      gst_buffer_unmap(out_buffer, &out_map);
+    }
+    gst_vst_audio_processor_add_levels(self, out_buffer, n_out_samples);
+  }
+
+  if (n_out_samples > 0) {
+    gst_buffer_set_size(out_buffer, n_out_samples * self->info.bpf);
 
-    Steinberg::int32 idx = 0;
-    auto queue = self->parameter_changes->addParameterData(property->param_id, idx);
-    auto value = edit_controller->plainParamToNormalized(property->param_id,
-        self->parameter_values[i]);
+    GST_BUFFER_PTS(out_buffer) = pts;
+    GST_BUFFER_DURATION(out_buffer) = duration;
 
-    queue->addPoint(0, value, idx);
-    edit_controller->setParamNormalized(property->param_id, value);
+    ret = gst_flow_combiner_update_pad_flow(self->flow_combiner, self->srcpad,
+        gst_pad_push(self->srcpad, out_buffer));
+  } else {
+    gst_buffer_unref(out_buffer);
   }
 
-  self->state = STATE_INITIALIZED;
-  self->module = mod;
-  self->component = component;
-  self->audio_processor = audio_processor;
-  self->edit_controller = edit_controller;
+  ret = gst_vst_audio_processor_push_aux_outputs(self, n_out_samples, pts, duration, ret);
+  self->qos_processed += chunk_size;
 
-  return TRUE;
+  return ret;
 }
 
-static GstStateChangeReturn
-gst_vst_audio_processor_change_state(GstElement * element,
-    GstStateChange transition)
+static GstFlowReturn
+gst_vst_audio_processor_sink_chain(GstPad * pad, GstObject * parent,
+    GstBuffer * in_buffer)
 {
-  auto self = GST_VST_AUDIO_PROCESSOR(element);
-  auto state_ret = GST_STATE_CHANGE_SUCCESS;
+  auto self = GST_VST_AUDIO_PROCESSOR(parent);
+  auto opening = g_atomic_int_get(&self->opening);
 
-  switch (transition) {
-    case GST_STATE_CHANGE_NULL_TO_READY:
-      gst_audio_info_init(&self->info);
-      gst_segment_init(&self->segment, GST_FORMAT_TIME);
-      if (!gst_vst_audio_processor_open(self))
-        state_ret = GST_STATE_CHANGE_FAILURE;
-      break;
-    default:
-      break;
+  // Opening the plugin in the background failed, which was reported already
+  if (!opening && self->instance.state < GST_VST_INSTANCE_STATE_INITIALIZED) {
+    gst_buffer_unref(in_buffer);
+    return GST_FLOW_ERROR;
   }
 
-  state_ret = GST_ELEMENT_CLASS(parent_class)->change_state(element, transition);
-  if (state_ret == GST_STATE_CHANGE_FAILURE)
-    return state_ret;
+  // While opening in the background the instance is only set up once it
+  // takes over
+  if (opening ? GST_AUDIO_INFO_FORMAT(&self->info) == GST_AUDIO_FORMAT_UNKNOWN
+      : self->instance.state < GST_VST_INSTANCE_STATE_SETUP) {
+    gst_buffer_unref(in_buffer);
+    GST_ERROR_OBJECT(self, "Not negotiated yet");
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
 
-  switch (transition) {
-    case GST_STATE_CHANGE_PAUSED_TO_READY:
-      if (self->state >= STATE_PROCESSING)
-        self->audio_processor->setProcessing(false);
-      if (self->state >= STATE_ACTIVE)
-        self->component->setActive(false);
-      self->state = STATE_SETUP;
-      break;
-    case GST_STATE_CHANGE_READY_TO_NULL:
-      if (self->state >= STATE_SETUP) {
-        self->component->terminate();
-        self->edit_controller->terminate();
-      }
-      self->state = STATE_NONE;
-      self->audio_processor = nullptr;
-      self->component = nullptr;
-      self->edit_controller = nullptr;
-      self->module = nullptr;
-      self->component_handler = nullptr;
-
-      g_free(self->in_data[0]);
-      self->in_data[0] = nullptr;
-      g_free(self->in_data[1]);
-      self->in_data[1] = nullptr;
-      g_free(self->out_data[0]);
-      self->out_data[0] = nullptr;
-      g_free(self->out_data[1]);
-      self->out_data[1] = nullptr;
-      self->data_len = 0;
-      break;
-    default:
-      break;
+  if (!GST_BUFFER_PTS_IS_VALID (in_buffer)) {
+    GST_ERROR_OBJECT(self, "Need buffers with valid timestamps");
+    gst_buffer_unref(in_buffer);
+    return GST_FLOW_ERROR;
   }
 
-  return state_ret;
+  if (self->segment_renderer)
+    return gst_vst_audio_processor_chain_segments(self, in_buffer);
+
+  if (self->input_adapter)
+    return gst_vst_audio_processor_chain_blocks(self, in_buffer);
+
+  return gst_vst_audio_processor_chain_buffer(self, in_buffer);
 }
 
-static void
-deinterleave_data(GstVstAudioProcessor *self, gconstpointer in_data, guint len)
+// Accumulates the input until a whole block is available and processes all
+// complete blocks
+static GstFlowReturn
+gst_vst_audio_processor_chain_blocks(GstVstAudioProcessor *self,
+    GstBuffer * in_buffer)
 {
-  if (self->info.finfo->format == GST_AUDIO_FORMAT_F32) {
-    if (self->info.channels == 1) {
-      memcpy (self->in_data[0], in_data, len * self->info.bpf);
-    } else {
-      const float *f_in_data = (const float *) in_data;
+  auto ret = GST_FLOW_OK;
 
-      for (auto i = 0; i < 2; i++) {
-        float *f_out_data = (float *) self->in_data[i];
+  // Whatever is left belongs before the discontinuity
+  if (GST_BUFFER_IS_DISCONT(in_buffer)) {
+    ret = gst_vst_audio_processor_drain_blocks(self);
+    self->input_discont = TRUE;
+  }
 
-        for (auto j = 0U; j < len; j++) {
-          f_out_data[j] = f_in_data[i + j * 2];
-        }
-      }
-    }
-  } else {
-    if (self->info.channels == 1) {
-      memcpy (self->in_data[0], in_data, len * self->info.bpf);
-    } else {
-      const double *f_in_data = (const double *) in_data;
+  gst_adapter_push(self->input_adapter, in_buffer);
 
-      for (auto i = 0; i < 2; i++) {
-        double *f_out_data = (double *) self->in_data[i];
+  auto block_bytes = (gsize) self->block_size * self->info.bpf;
+  while (ret == GST_FLOW_OK && gst_adapter_available(self->input_adapter) >= block_bytes)
+    ret = gst_vst_audio_processor_chain_buffer(self,
+        gst_vst_audio_processor_take_block(self, block_bytes));
 
-        for (auto j = 0U; j < len; j++) {
-          f_out_data[j] = f_in_data[i + j * 2];
-        }
-      }
-    }
-  }
+  return ret;
 }
 
-static void
-interleave_data(GstVstAudioProcessor *self, gpointer out_data, guint len)
+// Takes the next size bytes from the input adapter, timestamped according
+// to the input buffer they started in
+static GstBuffer *
+gst_vst_audio_processor_take_block(GstVstAudioProcessor *self, gsize size)
 {
-  if (self->info.finfo->format == GST_AUDIO_FORMAT_F32) {
-    if (self->info.channels == 1) {
-      memcpy (out_data, self->out_data[0], len * self->info.bpf);
-    } else {
-      float *f_out_data = (float *) out_data;
-
-      for (auto i = 0; i < 2; i++) {
-        const float *f_in_data = (const float *) self->out_data[i];
-
-        for (auto j = 0U; j < len; j++) {
-          f_out_data[i + j * 2] = f_in_data[j];
-        }
-      }
-    }
-  } else {
-    if (self->info.channels == 1) {
-      memcpy (out_data, self->out_data[0], len * self->info.bpf);
-    } else {
-      double *f_out_data = (double *) out_data;
+  guint64 distance;
+  auto pts = gst_adapter_prev_pts(self->input_adapter, &distance);
+  auto block = gst_adapter_take_buffer(self->input_adapter, size);
+
+  block = gst_buffer_make_writable(block);
+  if (GST_CLOCK_TIME_IS_VALID(pts))
+    pts += gst_util_uint64_scale(distance / self->info.bpf, GST_SECOND, self->info.rate);
+  GST_BUFFER_PTS(block) = pts;
+  GST_BUFFER_DURATION(block) = gst_util_uint64_scale(size / self->info.bpf,
+      GST_SECOND, self->info.rate);
+  if (self->input_discont)
+    GST_BUFFER_FLAG_SET(block, GST_BUFFER_FLAG_DISCONT);
+  else
+    GST_BUFFER_FLAG_UNSET(block, GST_BUFFER_FLAG_DISCONT);
+  self->input_discont = FALSE;
 
-      for (auto i = 0; i < 2; i++) {
-        const double *f_in_data = (const double *) self->out_data[i];
+  return block;
+}
 
-        for (auto j = 0U; j < len; j++) {
-          f_out_data[i + j * 2] = f_in_data[j];
-        }
-      }
-    }
+// Processes whatever is left in the input adapter, e.g. at EOS
+static GstFlowReturn
+gst_vst_audio_processor_drain_blocks(GstVstAudioProcessor *self)
+{
+  if (!self->input_adapter || self->instance.state < GST_VST_INSTANCE_STATE_SETUP)
+    return GST_FLOW_OK;
+
+  auto available = gst_adapter_available(self->input_adapter);
+  available -= available % self->info.bpf;
+  if (available == 0)
+    return GST_FLOW_OK;
+
+  auto block = gst_vst_audio_processor_take_block(self, available);
+  if (!GST_BUFFER_PTS_IS_VALID(block)) {
+    gst_buffer_unref(block);
+    return GST_FLOW_OK;
   }
+
+  return gst_vst_audio_processor_chain_buffer(self, block);
 }
 
+// Processes one buffer in chunks of at most max-samples-per-chunk
 static GstFlowReturn
-gst_vst_audio_processor_sink_chain(GstPad * pad, GstObject * parent,
+gst_vst_audio_processor_chain_buffer(GstVstAudioProcessor *self,
     GstBuffer * in_buffer)
 {
-  auto self = GST_VST_AUDIO_PROCESSOR(parent);
-  auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
   auto ret = GST_FLOW_OK;
 
-  if (self->state < STATE_SETUP) {
-    gst_buffer_unref(in_buffer);
-    GST_ERROR_OBJECT(self, "Not negotiated yet");
-    return GST_FLOW_NOT_NEGOTIATED;
-  }
-
-  if (!GST_BUFFER_PTS_IS_VALID (in_buffer)) {
-    GST_ERROR_OBJECT(self, "Need buffers with valid timestamps");
+  if (g_atomic_int_get(&self->opening)) {
+    if (!gst_vst_audio_processor_take_over(self))
+      return gst_vst_audio_processor_push_unopened(self, in_buffer);
+    if (!gst_vst_audio_processor_start_opened(self)) {
+      gst_buffer_unref(in_buffer);
+      return GST_FLOW_ERROR;
+    }
+  } else if (self->instance.state < GST_VST_INSTANCE_STATE_SETUP) {
+    // Opening in the background failed since the buffer was checked
     gst_buffer_unref(in_buffer);
     return GST_FLOW_ERROR;
   }
@@ -739,41 +3821,53 @@ gst_vst_audio_processor_sink_chain(GstPad * pad, GstObject * parent,
   // FIXME: Can we drain somehow? We should on disconts
   if (GST_BUFFER_IS_DISCONT (in_buffer)) {
     GST_DEBUG_OBJECT(self, "Discontinuity, restarting component");
-    if (self->state >= STATE_PROCESSING)
-      self->audio_processor->setProcessing(false);
-    if (self->state >= STATE_ACTIVE)
-      self->component->setActive(false);
+    gst_vst_instance_deactivate(&self->instance);
+    gst_vst_audio_processor_reset_dry(self);
   }
 
-  if (self->state < STATE_ACTIVE) {
-    GST_DEBUG_OBJECT(self, "Activating component");
-    auto res = self->component->setActive(true);
-    if (res != kResultOk) {
-      GST_ERROR_OBJECT(self, "Failed to set active: %08x", res);
-      gst_buffer_unref(in_buffer);
-      return GST_FLOW_ERROR;
-    }
+  auto n_aux_inputs = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self)->processor_info->n_aux_inputs;
 
-    self->state = STATE_ACTIVE;
-  }
+  // While bypassed the input is forwarded as is, or through the dry path if
+  // it has to be delayed. Auxiliary inputs still have to be consumed chunk by
+  // chunk though
+  gst_vst_audio_processor_update_dry(self);
+  gst_vst_audio_processor_update_bypass(self);
+  if (self->bypassed && self->crossfade_left == 0 && n_aux_inputs == 0) {
+    auto n_samples = (guint) (gst_buffer_get_size(in_buffer) / self->info.bpf);
+    auto pts = GST_BUFFER_PTS(in_buffer);
+    auto duration = gst_util_uint64_scale(n_samples, GST_SECOND, self->info.rate);
 
-  if (self->state < STATE_PROCESSING) {
-    GST_DEBUG_OBJECT(self, "Set component to processing");
-    auto res = self->audio_processor->setProcessing(true);
-    if (res != kResultOk && res != kNotImplemented) {
-      GST_ERROR_OBJECT(self, "Failed to set processing: %08x", res);
-      gst_buffer_unref(in_buffer);
-      return GST_FLOW_ERROR;
+    gst_vst_audio_processor_post_due_parameters(self);
+
+    if (gst_adapter_available(self->dry_adapter) == 0) {
+      auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+
+      for (auto i = 0U; i < klass->processor_info->n_aux_outputs; i++)
+        gst_pad_push_event(self->aux_srcpads[i], gst_event_new_gap(pts, duration));
+      return gst_flow_combiner_update_pad_flow(self->flow_combiner, self->srcpad,
+          gst_pad_push(self->srcpad, in_buffer));
     }
 
-    self->state = STATE_PROCESSING;
+    gst_adapter_push(self->dry_adapter, in_buffer);
+    return gst_vst_audio_processor_push_dry(self, n_samples, pts, duration);
+  }
+
+  if (!gst_vst_audio_processor_update_aux_channels(self) ||
+      !gst_vst_instance_activate(&self->instance)) {
+    gst_buffer_unref(in_buffer);
+    return GST_FLOW_ERROR;
   }
 
   // We process the input buffer in chunks of at most the configured
   // max-samples-per-chunk, and while doing so keep track of our current
-  // timestamp, stream time and sample position
+  // timestamp, stream time and sample position. An input buffer of a single
+  // chunk that is ours can be processed in place
   GstMapInfo in_map;
-  gst_buffer_map(in_buffer, &in_map, GST_MAP_READ);
+  auto consumed = FALSE;
+  auto in_place = gst_buffer_get_size(in_buffer) / self->info.bpf <= self->instance.data_len &&
+      gst_buffer_is_writable(in_buffer) && gst_buffer_map(in_buffer, &in_map, GST_MAP_READWRITE);
+  if (!in_place)
+    gst_buffer_map(in_buffer, &in_map, GST_MAP_READ);
 
   auto in_data = in_map.data;
   auto num_samples = in_map.size / self->info.bpf;
@@ -786,144 +3880,123 @@ gst_vst_audio_processor_sink_chain(GstPad * pad, GstObject * parent,
     gst_object_sync_values(GST_OBJECT_CAST(self), stream_time +
         gst_util_uint64_scale(sample_position - sample_start_position, GST_SECOND, self->info.rate));
 
-    auto chunk_size = MIN(self->data_len, num_samples);
-
-    // Fill input buffers and metadata
-    deinterleave_data(self, (gconstpointer) in_data, chunk_size);
-    Vst::AudioBusBuffers input;
-    input.numChannels = self->info.channels;
-    input.silenceFlags = GST_BUFFER_FLAG_IS_SET(in_buffer, GST_BUFFER_FLAG_GAP) ? G_MAXUINT64 : 0;
-    if (self->info.finfo->format == GST_AUDIO_FORMAT_F32)
-      input.channelBuffers32 = (Vst::Sample32 **) self->in_data;
-    else
-      input.channelBuffers64 = (Vst::Sample64 **) self->in_data;
-
-    // Fill output buffer metadata
-    Vst::AudioBusBuffers output;
-    output.numChannels = self->info.channels;
-    output.silenceFlags = 0;
-    if (self->info.finfo->format == GST_AUDIO_FORMAT_F32)
-      output.channelBuffers32 = (Vst::Sample32 **) self->out_data;
-    else
-      output.channelBuffers64 = (Vst::Sample64 **) self->out_data;
-
-    // Set up process context with information about the system state
-    Vst::ProcessContext process_context;
-    process_context.state = Vst::ProcessContext::kPlaying |
-        Vst::ProcessContext::kRecording |
-        Vst::ProcessContext::kSystemTimeValid;
-    process_context.sampleRate = self->info.rate;
-    process_context.projectTimeSamples = sample_position;
-    // FIXME: Should we pretend real-time processing here?
-    process_context.systemTime = gst_util_get_timestamp();
-
-    // Set up process data
-    Vst::ProcessData data;
-    data.processMode = Vst::kPrefetch;
-    data.symbolicSampleSize = self->info.finfo->format == GST_AUDIO_FORMAT_F32 ? Vst::kSample32 : Vst::kSample64;
-    data.numSamples = chunk_size;
-    data.numInputs = 1;
-    data.numOutputs = 1;
-    data.inputs = &input;
-    data.outputs = &output;
-    data.processContext = &process_context;
-
-    // Check if we have any pending input parameter changes
-    GST_OBJECT_LOCK(self);
-    auto parameter_changes = self->parameter_changes;
-    self->parameter_changes = nullptr;
-    GST_OBJECT_UNLOCK(self);
-    data.inputParameterChanges = parameter_changes;
-
-    // Allocate space for any output parameter changes
-    Vst::ParameterChanges out_parameter_changes;
-    data.outputParameterChanges = &out_parameter_changes;
-
-    // And finally do the actual processing of this chunk
-    auto res = self->audio_processor->process(data);
-
-    // We have to delete the pointer here, the processor does not do that
-    if (parameter_changes) {
-      delete parameter_changes;
-      data.inputParameterChanges = nullptr;
-    }
-
-    // Update out parameter changes
-    auto out_changes_count = out_parameter_changes.getParameterCount();
-    for (auto i = 0; i < out_changes_count; i++) {
-      auto queue = out_parameter_changes.getParameterData(i);
-      auto point_count = queue->getPointCount();
-      if (point_count > 0) {
-        Vst::ParamValue value;
-        Steinberg::int32 sample_offset = 0;
-
-        if (queue->getPoint(point_count - 1, sample_offset, value) == kResultOk) {
-          GstVstAudioProcessorProperty *prop = nullptr;
-          auto param_id = queue->getParameterId();
-          auto plain_value = self->edit_controller->normalizedParamToPlain(param_id, value);
-
-          guint k;
-          for (k = 0; k < klass->processor_info->n_properties; k++) {
-            if (klass->processor_info->properties[k].param_id == param_id) {
-              prop = &klass->processor_info->properties[k];
-              break;
-            }
-          }
-
-          // Cache the new value and notify anybody interested
-          if (prop) {
-            self->parameter_values[k] = plain_value;
-            g_object_notify_by_pspec(G_OBJECT(self), prop->pspec);
+    auto chunk_size = (guint) MIN(self->instance.data_len, num_samples);
+    auto pts = GST_BUFFER_PTS(in_buffer) +
+        gst_util_uint64_scale(sample_position - sample_start_position, GST_SECOND, self->info.rate);
+    auto duration = gst_util_uint64_scale(chunk_size, GST_SECOND, self->info.rate);
 
-          }
-
-          // And let the edit controller know about this change too
-          self->edit_controller->setParamNormalized(param_id, value);
-        }
-      }
-    }
+    // A finished crossfade or a changed QoS policy can stop or start the dry
+    // path within the buffer
+    gst_vst_audio_processor_update_dry(self);
 
-    if (res != kResultOk) {
+    // Shed load if we're too late
+    auto qos_policy = gst_vst_audio_processor_check_qos(self, pts, duration);
+    if (qos_policy == GST_VST_QOS_POLICY_REALTIME &&
+        !gst_vst_audio_processor_switch_to_realtime(self, pts, duration)) {
       ret = GST_FLOW_ERROR;
       break;
     }
 
-    // If there's output, allocate a new buffer and fill it
-    // FIXME: We assume that input length == output length currently
-    // for the timestamp calculation. This is not necessarily true:
-    // there could be latency involved. But none of the plugins this was
-    // tested with makes use of that
-    if (data.numSamples != (gint) chunk_size) {
-      GST_FIXME_OBJECT(self, "Output number of samples different than input: %d != %lu", data.numSamples, chunk_size);
-    }
+    // Get the same time range from all auxiliary inputs
+    if (n_aux_inputs > 0) {
+      auto running_time = gst_segment_to_running_time(&self->segment, GST_FORMAT_TIME, pts);
 
-    if (data.numSamples > 0) {
-      auto out_buffer = gst_buffer_new_and_alloc(data.numSamples * self->info.bpf);
-      GstMapInfo out_map;
+      ret = gst_vst_audio_processor_collect_aux_inputs(self, running_time, chunk_size);
+      if (ret != GST_FLOW_OK)
+        break;
+    }
 
-      gst_buffer_map(out_buffer, &out_map, GST_MAP_WRITE);
-      auto out_data = out_map.data;
-      interleave_data(self, (gpointer) out_data, data.numSamples);
-      gst_buffer_unmap(out_buffer, &out_map);
+    gst_vst_audio_processor_feed_dry(self, in_buffer, in_data - in_map.data, chunk_size);
 
-      GST_BUFFER_PTS(out_buffer) = GST_BUFFER_PTS(in_buffer) +
-          gst_util_uint64_scale(sample_position - sample_start_position, GST_SECOND, self->info.rate);
-      GST_BUFFER_DURATION(out_buffer) = gst_util_uint64_scale(chunk_size, GST_SECOND, self->info.rate);
+    if (self->bypassed && self->crossfade_left == 0)
+      ret = gst_vst_audio_processor_push_dry(self, chunk_size, pts, duration);
+    else if (qos_policy == GST_VST_QOS_POLICY_BYPASS || qos_policy == GST_VST_QOS_POLICY_DROP)
+      ret = gst_vst_audio_processor_push_degraded(self, qos_policy, chunk_size,
+          pts, duration);
+    else
+      ret = gst_vst_audio_processor_process_chunk(self, in_buffer, in_place ? &in_map : nullptr,
+          in_data, chunk_size, sample_position, pts, duration, &consumed);
+    if (ret != GST_FLOW_OK)
+      break;
 
-      ret = gst_pad_push(self->srcpad, out_buffer);
-    }
+    gst_vst_audio_processor_post_due_parameters(self);
+    gst_vst_audio_processor_post_meters(self, pts + duration);
+    gst_vst_audio_processor_post_levels(self, pts + duration);
 
     num_samples -= chunk_size;
     in_data += chunk_size * self->info.bpf;
     sample_position += chunk_size;
   } while (ret == GST_FLOW_OK && num_samples > 0);
 
-  gst_buffer_unmap(in_buffer, &in_map);
-  gst_buffer_unref(in_buffer);
+  if (!consumed) {
+    gst_buffer_unmap(in_buffer, &in_map);
+    gst_buffer_unref(in_buffer);
+  }
 
   return ret;
 }
 
+static gint
+compare_running_times(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  auto change_a = (const GstVstAudioProcessorParameterChange *) a;
+  auto change_b = (const GstVstAudioProcessorParameterChange *) b;
+
+  // Changes for the same running time stay in the order they arrived
+  return change_a->running_time <= change_b->running_time ? -1 : 1;
+}
+
+// Queues the parameter changes of a vst-parameter-change event until the
+// chunk that contains their running time is processed. Returns FALSE if the
+// event is meant for another element
+static gboolean
+gst_vst_audio_processor_queue_parameter_changes(GstVstAudioProcessor *self,
+    const GstStructure * structure)
+{
+  auto target = gst_structure_get_string(structure, "target");
+
+  if (target) {
+    GST_OBJECT_LOCK(self);
+    auto is_target = g_strcmp0(target, GST_OBJECT_NAME(self)) == 0;
+    GST_OBJECT_UNLOCK(self);
+    if (!is_target)
+      return FALSE;
+  }
+
+  GstClockTime running_time = 0;
+  if (gst_structure_has_field(structure, "running-time") &&
+      (!gst_structure_get_uint64(structure, "running-time", &running_time) ||
+       !GST_CLOCK_TIME_IS_VALID(running_time))) {
+    GST_WARNING_OBJECT(self, "Invalid running time in %" GST_PTR_FORMAT, structure);
+    return TRUE;
+  }
+
+  // Nothing is applied if any of the fields is invalid
+  auto n_fields = gst_structure_n_fields(structure);
+  std::vector<GstVstAudioProcessorParameterChange> changes;
+
+  for (auto i = 0; i < n_fields; i++) {
+    auto name = gst_structure_nth_field_name(structure, i);
+    GstVstAudioProcessorParameterChange change;
+
+    if (g_str_equal(name, "running-time") || g_str_equal(name, "target"))
+      continue;
+    if (!gst_vst_audio_processor_convert_parameter(self, name,
+          gst_structure_get_value(structure, name), &change.idx, &change.value))
+      return TRUE;
+
+    change.running_time = running_time;
+    changes.push_back(change);
+  }
+
+  for (auto &change : changes)
+    g_queue_insert_sorted(&self->scheduled_changes,
+        g_slice_dup(GstVstAudioProcessorParameterChange, &change),
+        compare_running_times, nullptr);
+
+  return TRUE;
+}
+
 static gboolean
 gst_vst_audio_processor_sink_event(GstPad * pad, GstObject * parent,
     GstEvent * event)
@@ -944,67 +4017,96 @@ gst_vst_audio_processor_sink_event(GstPad * pad, GstObject * parent,
       if (ret && changed) {
         GST_DEBUG_OBJECT(self, "Got caps %" GST_PTR_FORMAT, caps);
 
+        // Accumulated input is for the previous configuration
+        gst_vst_audio_processor_drain_blocks(self);
+
+        // Read by gst_vst_audio_processor_load_state() from other threads
+        GST_OBJECT_LOCK(self);
         self->info = info;
+        GST_OBJECT_UNLOCK(self);
 
-        // Need to shut down the component to be able to configure any new
-        // sample rate, channel configuration or sample format
         // FIXME: Can we drain somehow?
-        if (self->state >= STATE_PROCESSING)
-          self->audio_processor->setProcessing(false);
-        if (self->state >= STATE_ACTIVE)
-          self->component->setActive(false);
-        self->state = STATE_SETUP;
-
-        Vst::SpeakerArrangement arrangement[1] = { info.channels == 1 ? Vst::SpeakerArr::kMono : Vst::SpeakerArr::kStereo };
-        auto res = self->audio_processor->setBusArrangements(arrangement, 1, arrangement, 1);
-        if (res != kResultOk) {
-          GST_ERROR_OBJECT(self, "Failed to set bus arrangments: 0x%08x", res);
-          self->state = STATE_INITIALIZED;
-          ret = FALSE;
-          gst_event_unref(event);
-          break;
+        auto process_mode = gst_vst_process_mode_resolve(self->process_mode, self->sinkpad);
+        GST_DEBUG_OBJECT(self, "Using process mode %d", process_mode);
+
+        // Everything pending was for the previous configuration
+        if (self->segment_renderer) {
+          auto drained = gst_vst_audio_processor_drain_segments(self);
+
+          gst_vst_segment_renderer_free(self->segment_renderer);
+          self->segment_renderer = nullptr;
+          if (!drained) {
+            ret = FALSE;
+            gst_event_unref(event);
+            break;
+          }
         }
 
-        Vst::ProcessSetup setup = {
-          Vst::kPrefetch,
-          info.finfo->format == GST_AUDIO_FORMAT_F32 ? Vst::kSample32 : Vst::kSample64,
-          self->max_samples_per_chunk,
-          (double) info.rate
-        };
-
-        res = self->audio_processor->setupProcessing(setup);
-        if (res != kResultOk) {
-          GST_ERROR_OBJECT(self, "Failed to setup processing: %08x", res);
-          self->state = STATE_INITIALIZED;
+        // A plugin that is still being opened is set up once it takes over
+        if (g_atomic_int_get(&self->opening))
+          gst_vst_audio_processor_take_over(self);
+        auto opening = g_atomic_int_get(&self->opening);
+
+        gst_vst_instance_set_lock_memory(&self->instance, self->lock_memory);
+        gst_vst_instance_set_flush_denormals(&self->instance, self->flush_denormals);
+        if (!opening && (self->instance.state < GST_VST_INSTANCE_STATE_INITIALIZED ||
+              !gst_vst_instance_setup(&self->instance, &info, process_mode,
+                self->max_samples_per_chunk))) {
           ret = FALSE;
           gst_event_unref(event);
           break;
         }
 
-        // Reallocate our buffers for both channel
-        auto bps = info.bpf / info.channels;
-        g_free(self->in_data[0]);
-        self->in_data[0] = g_malloc0(bps * self->max_samples_per_chunk);
-        g_free(self->in_data[1]);
-        self->in_data[1] = info.channels == 2 ? g_malloc0(bps * self->max_samples_per_chunk) : nullptr;
-        g_free(self->out_data[0]);
-        self->out_data[0] = g_malloc0(bps * self->max_samples_per_chunk);
-        g_free(self->out_data[1]);
-        self->out_data[1] = info.channels == 2 ? g_malloc0(bps * self->max_samples_per_chunk) : nullptr;
-        self->data_len = self->max_samples_per_chunk;
-
-        // Update latency
-        auto latency_samples = self->audio_processor->getLatencySamples();
-        auto latency = gst_util_uint64_scale_int(latency_samples, GST_SECOND, info.rate);
-        if (latency != self->latency) {
-          self->latency = latency;
-          GST_DEBUG_OBJECT(self, "Latency changed to %" GST_TIME_FORMAT, GST_TIME_ARGS(latency));
-          gst_element_post_message(GST_ELEMENT_CAST(self), gst_message_new_latency(GST_OBJECT_CAST(self)));
+        auto klass = GST_VST_AUDIO_PROCESSOR_GET_CLASS(self);
+        gst_vst_audio_processor_set_aux_src_caps(self);
+
+        if (klass->processor_info->n_aux_inputs > 0) {
+          g_free(self->aux_data);
+          self->aux_data = (guint8 *) g_malloc(self->max_samples_per_chunk * GST_VST_MAX_CHANNELS * (info.bpf / info.channels));
+        }
+        g_free(self->state_data);
+        self->state_data = (guint8 *) g_malloc(self->max_samples_per_chunk * info.bpf);
+
+        auto latency = opening ? 0 : gst_vst_instance_get_latency(&self->instance);
+        gst_vst_audio_processor_update_latency(self, latency);
+        gst_vst_audio_processor_reset_dry(self);
+        gst_vst_audio_processor_reset_levels(self);
+
+        if (self->block_size > 0) {
+          if (!self->input_adapter)
+            self->input_adapter = gst_adapter_new();
+          gst_adapter_clear(self->input_adapter);
+          self->input_discont = TRUE;
+        } else {
+          g_clear_object(&self->input_adapter);
         }
 
-        GST_DEBUG_OBJECT(self, "Finished setup for new caps");
+        if (self->parallel_segments > 0 && process_mode == Vst::kOffline &&
+            klass->processor_info->n_aux_inputs == 0 &&
+            klass->processor_info->n_aux_outputs == 0) {
+          // The warm-up has to cover at least the latency and tail of the
+          // plugin for the output to be the same as with a single instance
+          auto min_overlap = gst_util_uint64_scale_int(latency, info.rate, GST_SECOND) +
+              (opening ? 0 : gst_vst_instance_get_tail_samples(&self->instance));
+          auto overlap = MAX(gst_util_uint64_scale_int(self->segment_overlap, info.rate, GST_SECOND),
+              min_overlap);
+          auto segment_samples = gst_util_uint64_scale_int(self->segment_duration, info.rate, GST_SECOND);
+
+          self->segment_renderer = gst_vst_segment_renderer_new(GST_ELEMENT_CAST(self),
+              self->srcpad, klass->processor_info, &info, self->max_samples_per_chunk,
+              self->parallel_segments, (guint) MIN(segment_samples, G_MAXUINT),
+              (guint) MIN(overlap, G_MAXUINT));
+          if (!self->segment_renderer) {
+            ret = FALSE;
+            gst_event_unref(event);
+            break;
+          }
+        } else if (self->parallel_segments > 0) {
+          GST_WARNING_OBJECT(self, "Parallel segments are only used in offline mode "
+              "for plugins without auxiliary inputs or outputs");
+        }
 
-        self->state = STATE_SETUP;
+        GST_DEBUG_OBJECT(self, "Finished setup for new caps");
       } else if (!ret) {
         GST_ERROR_OBJECT(self, "Invalid caps");
         ret = FALSE;
@@ -1020,30 +4122,85 @@ gst_vst_audio_processor_sink_event(GstPad * pad, GstObject * parent,
 
       break;
     }
+    case GST_EVENT_STREAM_START:
+      gst_vst_audio_processor_push_aux_src_event(self, event);
+      ret = gst_pad_event_default(pad, parent, event);
+      break;
+    case GST_EVENT_FLUSH_START:
+      // Stop waiting for auxiliary input
+      g_mutex_lock(&self->aux_lock);
+      self->flushing = TRUE;
+      g_cond_broadcast(&self->aux_cond);
+      g_mutex_unlock(&self->aux_lock);
+      gst_vst_audio_processor_push_aux_src_event(self, event);
+      ret = gst_pad_event_default(pad, parent, event);
+      break;
     case GST_EVENT_FLUSH_STOP:
+      g_mutex_lock(&self->aux_lock);
+      self->flushing = FALSE;
+      g_mutex_unlock(&self->aux_lock);
       gst_segment_init(&self->segment, GST_FORMAT_TIME);
+      self->next_meter_time = GST_CLOCK_TIME_NONE;
+      self->next_level_time = GST_CLOCK_TIME_NONE;
+      gst_vst_audio_processor_reset_levels(self);
+      GST_OBJECT_LOCK(self);
+      self->earliest_time = GST_CLOCK_TIME_NONE;
+      self->qos_message_pending = FALSE;
+      GST_OBJECT_UNLOCK(self);
       // Shut down component, it will be started again on next buffer
       // FIXME: Is there a better way of flushing?
-      if (self->state >= STATE_PROCESSING)
-        self->audio_processor->setProcessing(false);
-      if (self->state >= STATE_ACTIVE)
-        self->component->setActive(false);
-      self->state = STATE_SETUP;
+      gst_vst_instance_deactivate(&self->instance);
+      self->crossfade_left = self->crossfade_delay_left = 0;
+      gst_vst_audio_processor_reset_dry(self);
+      if (self->input_adapter) {
+        gst_adapter_clear(self->input_adapter);
+        self->input_discont = TRUE;
+      }
+      if (self->segment_renderer)
+        gst_vst_segment_renderer_flush(self->segment_renderer);
+      gst_vst_audio_processor_clear_scheduled_changes(self);
+      gst_flow_combiner_reset(self->flow_combiner);
+      gst_vst_audio_processor_push_aux_src_event(self, event);
       ret = gst_pad_event_default(pad, parent, event);
       break;
     case GST_EVENT_SEGMENT:
       gst_event_copy_segment(event, &self->segment);
+      self->next_meter_time = GST_CLOCK_TIME_NONE;
+      self->next_level_time = GST_CLOCK_TIME_NONE;
       if (self->segment.format != GST_FORMAT_TIME) {
         gst_event_unref(event);
         ret = FALSE;
       } else {
+        gst_vst_audio_processor_push_aux_src_event(self, event);
         ret = gst_pad_event_default(pad, parent, event);
       }
       break;
+    case GST_EVENT_GAP:
+      gst_vst_audio_processor_push_aux_src_event(self, event);
+      ret = gst_pad_event_default(pad, parent, event);
+      break;
     case GST_EVENT_EOS:
       // FIXME: Can we drain somehow?
+      // Don't let downstream think that truncated output is complete
+      if (!gst_vst_audio_processor_drain_segments(self)) {
+        gst_event_unref(event);
+        ret = FALSE;
+        break;
+      }
+      gst_vst_audio_processor_drain_blocks(self);
+      gst_vst_audio_processor_post_changed_parameters(self);
+      gst_vst_audio_processor_push_aux_src_event(self, event);
       ret = gst_pad_event_default(pad, parent, event);
       break;
+    case GST_EVENT_CUSTOM_DOWNSTREAM:
+      if (gst_event_has_name(event, GST_VST_PARAMETER_CHANGE_EVENT) &&
+          gst_vst_audio_processor_queue_parameter_changes(self, gst_event_get_structure(event))) {
+        gst_event_unref(event);
+        ret = TRUE;
+      } else {
+        ret = gst_pad_event_default(pad, parent, event);
+      }
+      break;
     default:
       ret = gst_pad_event_default(pad, parent, event);
       break;
@@ -1052,6 +4209,42 @@ gst_vst_audio_processor_sink_event(GstPad * pad, GstObject * parent,
   return ret;
 }
 
+static gboolean
+gst_vst_audio_processor_src_event(GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  auto self = GST_VST_AUDIO_PROCESSOR(parent);
+
+  switch (GST_EVENT_TYPE(event)) {
+    case GST_EVENT_QOS:{
+      GstQOSType type;
+      gdouble proportion;
+      GstClockTimeDiff diff;
+      GstClockTime timestamp;
+
+      gst_event_parse_qos(event, &type, &proportion, &diff, &timestamp);
+
+      GST_OBJECT_LOCK(self);
+      self->proportion = proportion;
+      self->qos_message_pending = TRUE;
+      if (GST_CLOCK_TIME_IS_VALID(timestamp)) {
+        if (diff < 0 && (GstClockTime) -diff > timestamp)
+          self->earliest_time = 0;
+        else
+          self->earliest_time = timestamp + diff;
+      } else {
+        self->earliest_time = GST_CLOCK_TIME_NONE;
+      }
+      GST_OBJECT_UNLOCK(self);
+      break;
+    }
+    default:
+      break;
+  }
+
+  return gst_pad_event_default(pad, parent, event);
+}
+
 static gboolean
 gst_vst_audio_processor_src_query(GstPad * pad,
     GstObject * parent, GstQuery * query)
@@ -1073,6 +4266,9 @@ gst_vst_audio_processor_src_query(GstPad * pad,
             GST_TIME_ARGS(min), GST_TIME_ARGS(max));
 
         latency = self->latency;
+        // Accumulating input delays it by up to one block
+        if (self->block_size > 0 && self->info.rate > 0)
+          latency += gst_util_uint64_scale_int(self->block_size, GST_SECOND, self->info.rate);
 
         GST_DEBUG_OBJECT(self, "Our latency: min %" GST_TIME_FORMAT
             ", max %" GST_TIME_FORMAT,
@@ -1289,7 +4485,9 @@ gst_vst_audio_processor_register(GstPlugin * plugin)
   const gchar *paths_env_var;
   const gchar *search_default_paths_env_var;
   const gchar *blacklist_env_var;
+  const gchar *multi_stream_env_var;
   gboolean search_default_paths = TRUE;
+  gboolean multi_stream = FALSE;
   VST3::Hosting::Module::PathList paths;
   std::map<std::string, std::string> blacklist;
 
@@ -1318,6 +4516,14 @@ gst_vst_audio_processor_register(GstPlugin * plugin)
 
   GST_INFO ("Search default paths: %d", search_default_paths);
 
+  multi_stream_env_var = g_getenv("GST_VST3_MULTI_STREAM");
+  if (multi_stream_env_var)
+    multi_stream = !g_ascii_strcasecmp(multi_stream_env_var, "yes");
+  gst_plugin_add_dependency_simple (plugin, "GST_VST3_MULTI_STREAM", NULL, NULL,
+      GST_PLUGIN_DEPENDENCY_FLAG_NONE);
+
+  GST_INFO ("Register multi-stream elements: %d", multi_stream);
+
   register_system_dependencies(plugin);
 
   audio_processor_info_quark = g_quark_from_static_string ("gst-vst-audio-processor-info");
@@ -1452,13 +4658,14 @@ gst_vst_audio_processor_register(GstPlugin * plugin)
         continue;
       }
 
-      // Get input audio bus. We only support components with a single audio
-      // input and no event inputs
+      // Get input audio busses. We support components with a main audio
+      // input, any number of auxiliary audio inputs and no event inputs
       auto count = component->getBusCount(Vst::MediaTypes::kAudio, Vst::BusDirections::kInput);
-      if (count != 1) {
+      if (count < 1) {
         GST_DEBUG("\t Unsupported number of audio input busses %d", count);
         continue;
       }
+      auto n_aux_inputs = count - 1;
 
       count = component->getBusCount(Vst::MediaTypes::kEvent, Vst::BusDirections::kInput);
       if (count != 0) {
@@ -1473,15 +4680,19 @@ gst_vst_audio_processor_register(GstPlugin * plugin)
         continue;
       }
 
-      // TODO: Anything we can do with the bus info?
+      if (n_aux_inputs > 0 && bus_info.busType != Vst::BusTypes::kMain) {
+        GST_DEBUG("\t First audio input bus is not the main bus");
+        continue;
+      }
 
-      // Get output audio bus. We only support components with a single audio
-      // output and no event outputs
+      // Get output audio busses. We support components with a main audio
+      // output, any number of auxiliary audio outputs and no event outputs
       count = component->getBusCount(Vst::MediaTypes::kAudio, Vst::BusDirections::kOutput);
-      if (count != 1) {
+      if (count < 1) {
         GST_DEBUG("\t Unsupported number of audio output busses %d", count);
         continue;
       }
+      auto n_aux_outputs = count - 1;
 
       count = component->getBusCount(Vst::MediaTypes::kEvent, Vst::BusDirections::kOutput);
       if (count != 0) {
@@ -1495,7 +4706,10 @@ gst_vst_audio_processor_register(GstPlugin * plugin)
         continue;
       }
 
-      // TODO: Anything we can do with the bus info?
+      if (n_aux_outputs > 0 && bus_info.busType != Vst::BusTypes::kMain) {
+        GST_DEBUG("\t First audio output bus is not the main bus");
+        continue;
+      }
 
       // Check which sample sizes the component supports
       auto caps = gst_caps_new_empty();
@@ -1515,23 +4729,34 @@ gst_vst_audio_processor_register(GstPlugin * plugin)
             "rate=(int) [0, MAX]"));
       }
 
-      // Check if the component can do mono-mono and/or stereo-stereo
-      Vst::SpeakerArrangement inputs[1];
-      Vst::SpeakerArrangement outputs[1];
+      // Check if the component can do mono-mono and/or stereo-stereo. The
+      // auxiliary inputs get the same arrangement for this check, auxiliary
+      // outputs keep the arrangement the component prefers
+      std::vector<Vst::SpeakerArrangement> inputs(1 + n_aux_inputs);
+      std::vector<Vst::SpeakerArrangement> outputs(1 + n_aux_outputs);
+
+      for (auto i = 1U; i < outputs.size(); i++) {
+        if (audio_processor->getBusArrangement(Vst::BusDirections::kOutput, i, outputs[i]) != kResultOk)
+          outputs[i] = Vst::SpeakerArr::kStereo;
+      }
 
       GValue channels = G_VALUE_INIT;
       GValue tmp = G_VALUE_INIT;
       g_value_init(&channels, GST_TYPE_LIST);
       g_value_init(&tmp, G_TYPE_INT);
 
-      inputs[0] = outputs[0] = Vst::SpeakerArr::kMono;
-      if (audio_processor->setBusArrangements(inputs, 1, outputs, 1) == kResultOk) {
+      std::fill(inputs.begin(), inputs.end(), Vst::SpeakerArr::kMono);
+      outputs[0] = Vst::SpeakerArr::kMono;
+      if (audio_processor->setBusArrangements(inputs.data(), inputs.size(),
+            outputs.data(), outputs.size()) == kResultOk) {
         g_value_set_int(&tmp, 1);
         gst_value_list_append_value(&channels, &tmp);
       }
 
-      inputs[0] = outputs[0] = Vst::SpeakerArr::kStereo;
-      if (audio_processor->setBusArrangements(inputs, 1, outputs, 1) == kResultOk) {
+      std::fill(inputs.begin(), inputs.end(), Vst::SpeakerArr::kStereo);
+      outputs[0] = Vst::SpeakerArr::kStereo;
+      if (audio_processor->setBusArrangements(inputs.data(), inputs.size(),
+            outputs.data(), outputs.size()) == kResultOk) {
         g_value_set_int(&tmp, 2);
         gst_value_list_append_value(&channels, &tmp);
       }
@@ -1621,6 +4846,8 @@ gst_vst_audio_processor_register(GstPlugin * plugin)
       processor_info->class_id = class_info.ID();
       processor_info->properties = properties;
       processor_info->n_properties = n_properties;
+      processor_info->n_aux_inputs = n_aux_inputs;
+      processor_info->n_aux_outputs = n_aux_outputs;
 
       g_type_set_qdata(type, audio_processor_info_quark, processor_info);
 
@@ -1629,6 +4856,22 @@ gst_vst_audio_processor_register(GstPlugin * plugin)
 
       gst_element_register(plugin, element_name.c_str(), GST_RANK_NONE, type);
 
+      if (!multi_stream) {
+        edit_controller->terminate();
+        component->terminate();
+        continue;
+      }
+
+      // And the multi-stream variant for the same class
+      g_type_query(gst_vst_multi_audio_processor_get_type(), &type_query);
+      auto multi_type_name = create_type_name(type_query.type_name, class_info.name().c_str());
+      auto multi_type = gst_vst_multi_audio_processor_register_subtype(multi_type_name.c_str(),
+          processor_info);
+      auto multi_element_name =
+          create_element_name("vstmultiaudioprocessor-", processor_info->name);
+
+      gst_element_register(plugin, multi_element_name.c_str(), GST_RANK_NONE, multi_type);
+
       edit_controller->terminate();
       component->terminate();
     }
@@ -39,11 +39,52 @@ G_BEGIN_DECLS
 #define GST_IS_VST_AUDIO_PROCESSOR_CLASS(klass) \
   (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_VST_AUDIO_PROCESSOR))
 
+#define GST_TYPE_VST_PROCESS_MODE \
+  (gst_vst_process_mode_get_type())
+
+typedef enum {
+  GST_VST_PROCESS_MODE_AUTO = 0,
+  GST_VST_PROCESS_MODE_REALTIME,
+  GST_VST_PROCESS_MODE_PREFETCH,
+  GST_VST_PROCESS_MODE_OFFLINE,
+} GstVstProcessMode;
+
+#define GST_TYPE_VST_QOS_POLICY \
+  (gst_vst_qos_policy_get_type())
+
+typedef enum {
+  GST_VST_QOS_POLICY_NONE = 0,
+  GST_VST_QOS_POLICY_REALTIME,
+  GST_VST_QOS_POLICY_BYPASS,
+  GST_VST_QOS_POLICY_DROP,
+} GstVstQosPolicy;
+
+#define GST_TYPE_VST_ASYNC_OPEN_FALLBACK \
+  (gst_vst_async_open_fallback_get_type())
+
+typedef enum {
+  GST_VST_ASYNC_OPEN_FALLBACK_PASSTHROUGH = 0,
+  GST_VST_ASYNC_OPEN_FALLBACK_SILENCE,
+} GstVstAsyncOpenFallback;
+
+// Name of the serialized custom downstream event that changes parameters at
+// a running time, sample-accurately:
+//
+//   vst-parameter-change, running-time=(guint64)..., gain=(double)0.5, ...
+//
+// All fields besides running-time and the optional target (the name of the
+// element that should apply it) are parameter values as in the parameters
+// property. Without running-time the values apply to the next sample
+#define GST_VST_PARAMETER_CHANGE_EVENT "vst-parameter-change"
+
 typedef struct _GstVstAudioProcessor GstVstAudioProcessor;
 typedef struct _GstVstAudioProcessorClass GstVstAudioProcessorClass;
 typedef struct _GstVstAudioProcessorInfo GstVstAudioProcessorInfo;
 
 GType gst_vst_audio_processor_get_type(void);
+GType gst_vst_process_mode_get_type(void);
+GType gst_vst_qos_policy_get_type(void);
+GType gst_vst_async_open_fallback_get_type(void);
 
 void gst_vst_audio_processor_register(GstPlugin * plugin);
 
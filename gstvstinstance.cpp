@@ -0,0 +1,1297 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "plugin.h"
+#include "gstvstinstance.h"
+#include "gstvsttracer.h"
+
+#include <common/memorystream.h>
+#include <vst/vstcomponent.h>
+#include <vst/vsteditcontroller.h>
+#include <pluginterfaces/vst/ivstprocesscontext.h>
+
+#include <cmath>
+#include <map>
+#include <vector>
+
+#if defined(G_OS_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define HAVE_MXCSR 1
+#endif
+
+GST_DEBUG_CATEGORY_EXTERN(gst_vst_audio_processor_debug);
+#define GST_CAT_DEFAULT gst_vst_audio_processor_debug
+
+using namespace Steinberg;
+
+// Communication between edit controller and component happens over this. We
+// don't really use this as we don't want to use the GUI provided by the
+// controller.
+class GstVstComponentHandler: public Vst::IComponentHandler {
+public:
+  GstVstComponentHandler(GstElement * element): element(element) { FUNKNOWN_CTOR }
+
+  virtual ~GstVstComponentHandler() { FUNKNOWN_DTOR }
+
+  DECLARE_FUNKNOWN_METHODS
+
+  tresult PLUGIN_API beginEdit(Vst::ParamID id) override {
+    GST_FIXME_OBJECT(element, "beginEdit not implemented");
+    return kNotImplemented;
+  }
+  tresult PLUGIN_API performEdit(Vst::ParamID id, Vst::ParamValue valueNormalized) override {
+    GST_FIXME_OBJECT(element, "performEdit not implemented");
+    return kNotImplemented;
+  }
+  tresult PLUGIN_API endEdit(Vst::ParamID id) override {
+    GST_FIXME_OBJECT(element, "endEdit not implemented");
+    return kNotImplemented;
+  }
+  tresult PLUGIN_API restartComponent(int32 flags) override {
+    // TODO: Maybe want to do something with the other ones?
+    GST_DEBUG_OBJECT(element, "restartComponent(0x%08x)", flags);
+
+    if ((flags & Vst::kLatencyChanged) && element) {
+      gst_element_post_message(element,
+          gst_message_new_latency(GST_OBJECT_CAST(element)));
+    }
+
+    return kResultOk;
+  }
+
+  GstElement * element;
+};
+
+IMPLEMENT_REFCOUNT(GstVstComponentHandler);
+DECLARE_CLASS_IID(GstVstComponentHandler, 0x8f2a46d5, 0x148a4e40, 0xab996b56, 0xc2c615cf);
+
+tresult GstVstComponentHandler::queryInterface(const char * iid, void ** obj) {
+  QUERY_INTERFACE(iid, obj, FUnknown::iid, FUnknown);
+  QUERY_INTERFACE(iid, obj, Vst::IComponentHandler::iid, Vst::IComponentHandler);
+  *obj = nullptr;
+  return kNoInterface;
+}
+
+GParamSpec *
+gst_vst_audio_processor_property_new_param_spec(const GstVstAudioProcessorProperty * property)
+{
+  auto flags = (GParamFlags) ((property->read_only ? G_PARAM_READABLE : G_PARAM_READWRITE) | GST_PARAM_CONTROLLABLE);
+
+  if (property->type == G_TYPE_DOUBLE) {
+    return g_param_spec_double(property->name, property->nick, property->description,
+        -G_MAXDOUBLE, G_MAXDOUBLE,
+        property->default_value, flags);
+  } else if (property->type == G_TYPE_BOOLEAN) {
+    return g_param_spec_boolean(property->name, property->nick, property->description,
+        property->default_value > 0.5, flags);
+  } else {
+    return g_param_spec_int(property->name, property->nick, property->description,
+        0, property->max_value,
+        property->default_value, flags);
+  }
+}
+
+// Selects the VST process mode for the configured property value. For "auto"
+// this asks upstream of sinkpad whether the pipeline is live
+Vst::ProcessModes
+gst_vst_process_mode_resolve(GstVstProcessMode process_mode, GstPad * sinkpad)
+{
+  switch (process_mode) {
+    case GST_VST_PROCESS_MODE_REALTIME:
+      return Vst::kRealtime;
+    case GST_VST_PROCESS_MODE_PREFETCH:
+      return Vst::kPrefetch;
+    case GST_VST_PROCESS_MODE_OFFLINE:
+      return Vst::kOffline;
+    case GST_VST_PROCESS_MODE_AUTO:
+    default:
+      break;
+  }
+
+  auto query = gst_query_new_latency();
+  gboolean live = FALSE;
+
+  if (gst_pad_peer_query(sinkpad, query))
+    gst_query_parse_latency(query, &live, nullptr, nullptr);
+  gst_query_unref(query);
+
+  GST_DEBUG_OBJECT(sinkpad, "Upstream is %slive", live ? "" : "not ");
+
+  return live ? Vst::kRealtime : Vst::kOffline;
+}
+
+// Creates the component in a helper process, and only the edit controller
+// in this process. The controller is kept here as parameter conversions are
+// needed synchronously from the element
+static gboolean
+open_sandboxed(GstVstInstance * instance, std::shared_ptr<VST3::Hosting::Module> mod)
+{
+  auto element = instance->element;
+  auto processor_info = instance->processor_info;
+  TUID controller_cid;
+
+  if (processor_info->n_aux_inputs > 0 || processor_info->n_aux_outputs > 0) {
+    GST_ERROR_OBJECT(element, "Auxiliary busses are not supported in the sandbox");
+    return FALSE;
+  }
+
+  auto sandbox = gst_vst_sandbox_new(element, processor_info, instance->sandbox_memory_limit);
+  if (!sandbox)
+    return FALSE;
+
+  IPtr<Vst::IEditController> edit_controller;
+  if (gst_vst_sandbox_get_controller_class_id(sandbox, controller_cid))
+    edit_controller = mod->getFactory().createInstance<Vst::IEditController>(controller_cid);
+  if (!edit_controller) {
+    GST_ERROR_OBJECT(element, "No separate edit controller found, can't sandbox '%s'",
+        processor_info->name);
+    gst_vst_sandbox_free(sandbox);
+    return FALSE;
+  }
+
+  GST_VST_TRACER_PRE(element, processor_info->name, GST_VST_TRACER_CALL_INITIALIZE, 0);
+  auto res = edit_controller->initialize(gStandardPluginContext);
+  GST_VST_TRACER_POST(element, processor_info->name, GST_VST_TRACER_CALL_INITIALIZE, 0, res);
+  if (res != kResultOk) {
+    GST_ERROR_OBJECT(element, "Can't initialize edit controller: 0x%08x", res);
+    gst_vst_sandbox_free(sandbox);
+    return FALSE;
+  }
+
+  instance->component_handler = owned(new GstVstComponentHandler(element));
+  instance->flush_denormals = TRUE;
+  edit_controller->setComponentHandler(instance->component_handler);
+
+  // The controller can't be connected to the component, but can at least
+  // start from the same state
+  MemoryStream stream;
+  if (gst_vst_sandbox_get_state(sandbox, &stream)) {
+    stream.seek(0, IBStream::kIBSeekSet, nullptr);
+    edit_controller->setComponentState(&stream);
+  }
+
+  instance->out_parameter_changes = new Vst::ParameterChanges(processor_info->n_properties);
+
+  instance->state = GST_VST_INSTANCE_STATE_INITIALIZED;
+  instance->module = mod;
+  instance->sandbox = sandbox;
+  instance->edit_controller = edit_controller;
+
+  return TRUE;
+}
+
+// Modules are only loaded once per process and then kept for all following
+// instances, as loading runs the initialization of the module every time.
+// This matters when many pipelines are run one after another, e.g. when
+// rendering offline
+static VST3::Hosting::Module::Ptr
+load_module(GstVstInstance * instance, const std::string & path, std::string & err)
+{
+  static GMutex lock;
+  // Never freed: unloading modules while the process exits is asking for
+  // trouble
+  static auto modules = new std::map<std::string, VST3::Hosting::Module::Ptr>();
+  auto processor_info = instance->processor_info;
+
+  g_mutex_lock(&lock);
+  auto it = modules->find(path);
+  if (it != modules->end()) {
+    auto mod = it->second;
+    g_mutex_unlock(&lock);
+    return mod;
+  }
+
+  GST_VST_TRACER_PRE(instance->element, processor_info->name, GST_VST_TRACER_CALL_MODULE_CREATE, 0);
+  auto mod = VST3::Hosting::Module::create(path, err);
+  GST_VST_TRACER_POST(instance->element, processor_info->name, GST_VST_TRACER_CALL_MODULE_CREATE, 0,
+      mod ? kResultOk : kResultFalse);
+  if (mod)
+    (*modules)[path] = mod;
+  g_mutex_unlock(&lock);
+
+  return mod;
+}
+
+gboolean
+gst_vst_instance_open(GstVstInstance * instance, GstElement * element,
+    const GstVstAudioProcessorInfo * processor_info)
+{
+  std::string err;
+  std::string path(processor_info->path);
+
+  instance->element = element;
+  instance->processor_info = processor_info;
+  instance->state = GST_VST_INSTANCE_STATE_NONE;
+
+  auto mod = load_module(instance, path, err);
+  if (!mod) {
+    GST_ERROR_OBJECT(element, "Failed to load module '%s': %s", path.c_str(), err.c_str());
+    return FALSE;
+  }
+
+  if (instance->use_sandbox)
+    return open_sandboxed(instance, mod);
+
+  auto factory = mod->getFactory();
+
+  auto component = factory.createInstance<Vst::IComponent>(processor_info->class_id);
+  if (!component) {
+    GST_ERROR_OBJECT(element, "Failed to create instance for '%s'", processor_info->name);
+    return FALSE;
+  }
+
+  GST_VST_TRACER_PRE(element, processor_info->name, GST_VST_TRACER_CALL_INITIALIZE, 0);
+  auto res = component->initialize(gStandardPluginContext);
+  GST_VST_TRACER_POST(element, processor_info->name, GST_VST_TRACER_CALL_INITIALIZE, 0, res);
+  if (res != kResultOk) {
+    GST_ERROR_OBJECT(element, "Component can't be initialized: 0x%08x", res);
+    return FALSE;
+  }
+
+  // Check if this supports the IAudioProcessor interface
+  IPtr<Vst::IAudioProcessor> audio_processor;
+  Vst::IAudioProcessor *audio_processor_ptr = nullptr;
+  if (component->queryInterface(Vst::IAudioProcessor::iid, (void **) &audio_processor_ptr) != kResultOk
+      || !audio_processor_ptr) {
+    GST_ERROR_OBJECT(element, "Component does not implement IAudioProcessor interface");
+    component->terminate();
+    return FALSE;
+  }
+  audio_processor = shared(audio_processor_ptr);
+
+  // Get the controller
+  IPtr<Vst::IEditController> edit_controller;
+  Vst::IEditController *edit_controller_ptr = nullptr;
+  if (component->queryInterface(Vst::IEditController::iid, (void**) &edit_controller_ptr) != kResultOk
+      || !edit_controller_ptr) {
+    FUID controller_cid;
+
+    // ask for the associated controller class ID
+    if (component->getControllerClassId(controller_cid) == kResultOk && controller_cid.isValid ()) {
+      // create its controller part created from the factory
+      edit_controller = factory.createInstance<Vst::IEditController>(controller_cid.toTUID());
+      if (edit_controller) {
+        // initialize the component with our context
+        GST_VST_TRACER_PRE(element, processor_info->name, GST_VST_TRACER_CALL_INITIALIZE, 0);
+        res = edit_controller->initialize(gStandardPluginContext);
+        GST_VST_TRACER_POST(element, processor_info->name, GST_VST_TRACER_CALL_INITIALIZE, 0, res);
+        if (res != kResultOk) {
+          GST_ERROR_OBJECT(element, "Can't initialize edit controller: 0x%08x", res);
+          component->terminate();
+          return FALSE;
+        }
+      }
+    }
+  } else {
+    edit_controller = shared(edit_controller_ptr);
+  }
+
+  if (!edit_controller) {
+    GST_ERROR_OBJECT(element, "No edit controller found");
+    component->terminate();
+    return FALSE;
+  }
+
+  // activate busses, just in case
+  res = component->activateBus(Vst::MediaTypes::kAudio, Vst::BusDirections::kInput, 0, TRUE);
+  if (res != kResultOk) {
+    GST_ERROR_OBJECT(element, "Failed to activate input bus: 0x%08x", res);
+    component->terminate();
+    edit_controller->terminate();
+    return FALSE;
+  }
+  for (auto i = 0U; i < processor_info->n_aux_inputs; i++) {
+    res = component->activateBus(Vst::MediaTypes::kAudio, Vst::BusDirections::kInput, i + 1, TRUE);
+    if (res != kResultOk)
+      GST_WARNING_OBJECT(element, "Failed to activate auxiliary input bus %u: 0x%08x", i, res);
+  }
+  res = component->activateBus(Vst::MediaTypes::kAudio, Vst::BusDirections::kOutput, 0, TRUE);
+  if (res != kResultOk) {
+    GST_ERROR_OBJECT(element, "Failed to activate output bus: 0x%08x", res);
+    component->terminate();
+    edit_controller->terminate();
+    return FALSE;
+  }
+  for (auto i = 0U; i < processor_info->n_aux_outputs; i++) {
+    res = component->activateBus(Vst::MediaTypes::kAudio, Vst::BusDirections::kOutput, i + 1, TRUE);
+    if (res != kResultOk)
+      GST_WARNING_OBJECT(element, "Failed to activate auxiliary output bus %u: 0x%08x", i, res);
+  }
+
+  instance->component_handler = owned(new GstVstComponentHandler(element));
+  instance->flush_denormals = TRUE;
+
+  // the host set its handler to the controller
+  edit_controller->setComponentHandler(instance->component_handler);
+
+  // connect the 2 components
+  Vst::IConnectionPoint* iConnectionPointComponent = nullptr;
+  Vst::IConnectionPoint* iConnectionPointController = nullptr;
+  component->queryInterface(Vst::IConnectionPoint::iid, (void**)&iConnectionPointComponent);
+  edit_controller->queryInterface(Vst::IConnectionPoint::iid, (void**)&iConnectionPointController);
+  if (iConnectionPointComponent && iConnectionPointController) {
+    iConnectionPointComponent->connect(iConnectionPointController);
+    iConnectionPointController->connect(iConnectionPointComponent);
+  }
+
+  // synchronize controller to component by using setComponentState
+  MemoryStream stream;
+  if (component->getState(&stream) == kResultOk) {
+    stream.truncate();
+    edit_controller->setComponentState(&stream);
+  }
+
+  instance->aux_in_channels = g_new0(gint, processor_info->n_aux_inputs);
+  instance->aux_in_data = g_new0(gpointer, GST_VST_MAX_CHANNELS * processor_info->n_aux_inputs);
+  instance->aux_in_silent = g_new0(gboolean, processor_info->n_aux_inputs);
+  instance->aux_out_channels = g_new0(gint, processor_info->n_aux_outputs);
+  instance->aux_out_data = g_new0(gpointer *, processor_info->n_aux_outputs);
+  instance->aux_out_buffers = g_new0(gpointer *, processor_info->n_aux_outputs);
+  instance->aux_out_dest = g_new0(gpointer, processor_info->n_aux_outputs);
+  instance->inputs = new Vst::AudioBusBuffers[1 + processor_info->n_aux_inputs];
+  instance->outputs = new Vst::AudioBusBuffers[1 + processor_info->n_aux_outputs];
+  instance->out_parameter_changes = new Vst::ParameterChanges(processor_info->n_properties);
+
+  instance->state = GST_VST_INSTANCE_STATE_INITIALIZED;
+  instance->module = mod;
+  instance->component = component;
+  instance->audio_processor = audio_processor;
+  instance->edit_controller = edit_controller;
+
+  return TRUE;
+}
+
+// Returns the next size bytes of the arena and advances offset. Without
+// arena data only the offset is advanced, which is used for calculating the
+// size of the arena
+static gpointer
+arena_take(GstVstInstance * instance, gsize * offset, gsize size)
+{
+  auto p = instance->arena_data ? (guint8 *) instance->arena_data + *offset : nullptr;
+
+  *offset += (size + GST_VST_INSTANCE_ALIGNMENT - 1) & ~((gsize) GST_VST_INSTANCE_ALIGNMENT - 1);
+
+  return p;
+}
+
+// Assigns all scratch buffers from the arena and returns the size needed
+static gsize
+layout_scratch_memory(GstVstInstance * instance, gint channels, gint bps,
+    gint max_samples_per_chunk)
+{
+  auto processor_info = instance->processor_info;
+  auto buffer_size = (gsize) bps * max_samples_per_chunk;
+  gsize offset = 0;
+
+  for (auto c = 0; c < GST_VST_MAX_CHANNELS; c++) {
+    instance->in_data[c] = c < channels ? arena_take(instance, &offset, buffer_size) : nullptr;
+    instance->out_data[c] = c < channels ? arena_take(instance, &offset, buffer_size) : nullptr;
+  }
+
+  for (auto i = 0U; i < processor_info->n_aux_inputs; i++) {
+    auto aux_channels = instance->aux_in_channels[i] ? instance->aux_in_channels[i] : channels;
+
+    for (auto c = 0; c < GST_VST_MAX_CHANNELS; c++)
+      instance->aux_in_data[GST_VST_MAX_CHANNELS * i + c] = c < aux_channels ? arena_take(instance, &offset, buffer_size) : nullptr;
+  }
+
+  for (auto i = 0U; i < processor_info->n_aux_outputs; i++) {
+    auto aux_channels = instance->aux_out_channels[i];
+
+    instance->aux_out_data[i] = (gpointer *) arena_take(instance, &offset,
+        sizeof(gpointer) * MAX(aux_channels, 1));
+    instance->aux_out_buffers[i] = (gpointer *) arena_take(instance, &offset,
+        sizeof(gpointer) * MAX(aux_channels, 1));
+    for (auto c = 0; c < aux_channels; c++) {
+      auto data = arena_take(instance, &offset, buffer_size);
+      if (instance->aux_out_data[i])
+        instance->aux_out_data[i][c] = data;
+    }
+  }
+
+  return offset;
+}
+
+// Returns the size of the pages that locked memory is mapped in
+static gsize
+get_page_size()
+{
+#if defined(G_OS_WIN32)
+  SYSTEM_INFO info;
+
+  GetSystemInfo(&info);
+  return info.dwPageSize;
+#else
+  auto page_size = sysconf(_SC_PAGESIZE);
+
+  return page_size > 0 ? page_size : 4096;
+#endif
+}
+
+static void
+free_scratch_memory(GstVstInstance * instance)
+{
+  if (instance->arena_locked) {
+#if defined(G_OS_WIN32)
+    VirtualUnlock(instance->arena_data, instance->arena_size);
+#else
+    munlock(instance->arena_data, instance->arena_size);
+#endif
+    instance->arena_locked = FALSE;
+  }
+
+  g_free(instance->arena);
+  instance->arena = nullptr;
+  instance->arena_data = nullptr;
+  instance->arena_size = 0;
+
+  // Everything else pointed into the arena
+  if (instance->processor_info) {
+    for (auto i = 0U; instance->aux_in_data && i < GST_VST_MAX_CHANNELS * instance->processor_info->n_aux_inputs; i++)
+      instance->aux_in_data[i] = nullptr;
+    for (auto i = 0U; instance->aux_out_data && i < instance->processor_info->n_aux_outputs; i++) {
+      instance->aux_out_data[i] = nullptr;
+      instance->aux_out_buffers[i] = nullptr;
+    }
+  }
+  instance->in_data[0] = instance->in_data[1] = nullptr;
+  instance->out_data[0] = instance->out_data[1] = nullptr;
+}
+
+// Allocates one zeroed block for all scratch memory of the current
+// configuration, and locks it into RAM if requested
+static void
+allocate_scratch_memory(GstVstInstance * instance, gint channels, gint bps,
+    gint max_samples_per_chunk)
+{
+  free_scratch_memory(instance);
+
+  auto size = layout_scratch_memory(instance, channels, bps, max_samples_per_chunk);
+
+  instance->arena = g_malloc0(size + GST_VST_INSTANCE_ALIGNMENT - 1);
+  instance->arena_data = (gpointer) (((guintptr) instance->arena + GST_VST_INSTANCE_ALIGNMENT - 1)
+      & ~((guintptr) GST_VST_INSTANCE_ALIGNMENT - 1));
+  instance->arena_size = size;
+  layout_scratch_memory(instance, channels, bps, max_samples_per_chunk);
+
+  if (!instance->lock_memory || size == 0)
+    return;
+
+#if defined(G_OS_WIN32)
+  instance->arena_locked = VirtualLock(instance->arena_data, size);
+#else
+  instance->arena_locked = mlock(instance->arena_data, size) == 0;
+#endif
+  if (!instance->arena_locked)
+    GST_WARNING_OBJECT(instance->element, "Failed to lock %" G_GSIZE_FORMAT
+        " bytes of scratch memory", size);
+
+  // Make sure every page is mapped before the first process() call
+  auto page_size = get_page_size();
+  for (gsize offset = 0; offset < size; offset += page_size)
+    ((volatile guint8 *) instance->arena_data)[offset] = 0;
+}
+
+void
+gst_vst_instance_close(GstVstInstance * instance)
+{
+  gst_vst_instance_deactivate(instance);
+
+  if (instance->sandbox) {
+    instance->edit_controller->terminate();
+    gst_vst_sandbox_free(instance->sandbox);
+    instance->sandbox = nullptr;
+  } else if (instance->state >= GST_VST_INSTANCE_STATE_INITIALIZED) {
+    instance->component->terminate();
+    instance->edit_controller->terminate();
+  }
+  instance->state = GST_VST_INSTANCE_STATE_NONE;
+  instance->audio_processor = nullptr;
+  instance->component = nullptr;
+  instance->edit_controller = nullptr;
+  instance->module = nullptr;
+  instance->component_handler = nullptr;
+
+  free_scratch_memory(instance);
+  instance->data_len = 0;
+
+  g_free(instance->aux_in_data);
+  instance->aux_in_data = nullptr;
+  g_free(instance->aux_in_channels);
+  instance->aux_in_channels = nullptr;
+  g_free(instance->aux_in_silent);
+  instance->aux_in_silent = nullptr;
+
+  g_free(instance->aux_out_data);
+  instance->aux_out_data = nullptr;
+  g_free(instance->aux_out_buffers);
+  instance->aux_out_buffers = nullptr;
+  g_free(instance->aux_out_channels);
+  instance->aux_out_channels = nullptr;
+  g_free(instance->aux_out_dest);
+  instance->aux_out_dest = nullptr;
+
+  delete[] instance->inputs;
+  instance->inputs = nullptr;
+  delete[] instance->outputs;
+  instance->outputs = nullptr;
+  delete instance->out_parameter_changes;
+  instance->out_parameter_changes = nullptr;
+}
+
+// Sets the given plain parameter values on the controller and returns the
+// corresponding parameter changes that have to be passed to the component
+// with the next process() call. With skip_defaults, parameters that are at
+// their default value are left alone, which is enough for a freshly opened
+// instance, and nullptr is returned if nothing has to be changed
+Vst::ParameterChanges *
+gst_vst_instance_sync_parameters(GstVstInstance * instance,
+    const gdouble * parameter_values, gboolean skip_defaults)
+{
+  auto processor_info = instance->processor_info;
+  Vst::ParameterChanges *parameter_changes = nullptr;
+
+  for (auto i = 0U; i < processor_info->n_properties; i++) {
+    auto property = &processor_info->properties[i];
+
+    if (property->read_only)
+      continue;
+    if (skip_defaults && parameter_values[i] == property->default_value)
+      continue;
+
+    if (!parameter_changes)
+      parameter_changes = new Vst::ParameterChanges();
+    gst_vst_instance_set_parameter(instance, parameter_changes,
+        property->param_id, parameter_values[i], 0);
+  }
+
+  if (!parameter_changes && !skip_defaults)
+    parameter_changes = new Vst::ParameterChanges();
+
+  return parameter_changes;
+}
+
+// Converts the plain value to a normalized value, lets the edit controller
+// know about it and queues the change for the component at the sample offset
+// of the next processed chunk. Returns the normalized value
+//
+// We always use plain values, but controller and component use normalized
+// values between 0.0 and 1.0
+gdouble
+gst_vst_instance_set_parameter(GstVstInstance * instance,
+    Vst::ParameterChanges * parameter_changes, Vst::ParamID param_id,
+    gdouble plain_value, Steinberg::int32 sample_offset)
+{
+  Steinberg::int32 idx = 0;
+  auto queue = parameter_changes->addParameterData(param_id, idx);
+  auto value = instance->edit_controller->plainParamToNormalized(param_id, plain_value);
+
+  queue->addPoint(sample_offset, value, idx);
+  instance->edit_controller->setParamNormalized(param_id, value);
+
+  return value;
+}
+
+// Returns the current plain value of a parameter according to the edit
+// controller
+gdouble
+gst_vst_instance_get_parameter(GstVstInstance * instance, Vst::ParamID param_id)
+{
+  auto value = instance->edit_controller->getParamNormalized(param_id);
+
+  return instance->edit_controller->normalizedParamToPlain(param_id, value);
+}
+
+// Writes the states of component and edit controller to the streams
+gboolean
+gst_vst_instance_get_state(GstVstInstance * instance, IBStream * component_stream,
+    IBStream * controller_stream)
+{
+  if (instance->state < GST_VST_INSTANCE_STATE_INITIALIZED)
+    return FALSE;
+
+  if (instance->sandbox) {
+    if (!gst_vst_sandbox_get_state(instance->sandbox, component_stream))
+      return FALSE;
+  } else {
+    auto res = instance->component->getState(component_stream);
+    if (res != kResultOk) {
+      GST_ERROR_OBJECT(instance->element, "Failed to get component state: 0x%08x", res);
+      return FALSE;
+    }
+  }
+
+  // Not every controller has a state of its own
+  instance->edit_controller->getState(controller_stream);
+
+  return TRUE;
+}
+
+// Restores a state as returned by getState() of the component, and
+// optionally of the edit controller. Controller and component are
+// synchronized afterwards
+gboolean
+gst_vst_instance_set_state(GstVstInstance * instance, GBytes * component_state,
+    GBytes * controller_state)
+{
+  gsize size;
+  auto data = g_bytes_get_data(component_state, &size);
+  MemoryStream stream((void *) data, size);
+
+  if (instance->state < GST_VST_INSTANCE_STATE_INITIALIZED)
+    return FALSE;
+
+  if (instance->sandbox) {
+    if (!gst_vst_sandbox_set_state(instance->sandbox, data, size)) {
+      GST_ERROR_OBJECT(instance->element, "Failed to set component state in sandbox");
+      return FALSE;
+    }
+  } else {
+    auto res = instance->component->setState(&stream);
+    if (res != kResultOk) {
+      GST_ERROR_OBJECT(instance->element, "Failed to set component state: 0x%08x", res);
+      return FALSE;
+    }
+    stream.seek(0, IBStream::kIBSeekSet, nullptr);
+  }
+
+  instance->edit_controller->setComponentState(&stream);
+
+  if (controller_state) {
+    auto controller_data = g_bytes_get_data(controller_state, &size);
+    MemoryStream controller_stream((void *) controller_data, size);
+
+    instance->edit_controller->setState(&controller_stream);
+  }
+
+  return TRUE;
+}
+
+gboolean
+gst_vst_instance_setup(GstVstInstance * instance, const GstAudioInfo * info,
+    Vst::ProcessModes process_mode, gint max_samples_per_chunk)
+{
+  auto processor_info = instance->processor_info;
+
+  // Need to shut down the component to be able to configure any new
+  // sample rate, channel configuration or sample format
+  gst_vst_instance_deactivate(instance);
+  instance->state = GST_VST_INSTANCE_STATE_INITIALIZED;
+
+  if (instance->sandbox) {
+    if (!gst_vst_sandbox_setup(instance->sandbox, info, process_mode, max_samples_per_chunk))
+      return FALSE;
+
+    instance->data_len = max_samples_per_chunk;
+    instance->info = *info;
+    instance->process_mode = process_mode;
+    instance->state = GST_VST_INSTANCE_STATE_SETUP;
+
+    return TRUE;
+  }
+
+  auto n_inputs = 1 + processor_info->n_aux_inputs;
+  auto n_outputs = 1 + processor_info->n_aux_outputs;
+  std::vector<Vst::SpeakerArrangement> inputs(n_inputs);
+  std::vector<Vst::SpeakerArrangement> outputs(n_outputs);
+
+  inputs[0] = outputs[0] = info->channels == 1 ? Vst::SpeakerArr::kMono : Vst::SpeakerArr::kStereo;
+  for (auto i = 0U; i < processor_info->n_aux_inputs; i++) {
+    auto channels = instance->aux_in_channels[i] ? instance->aux_in_channels[i] : info->channels;
+    inputs[i + 1] = channels == 1 ? Vst::SpeakerArr::kMono : Vst::SpeakerArr::kStereo;
+  }
+  // Auxiliary outputs keep whatever arrangement the plugin prefers
+  for (auto i = 0U; i < processor_info->n_aux_outputs; i++) {
+    if (instance->audio_processor->getBusArrangement(Vst::BusDirections::kOutput, i + 1, outputs[i + 1]) != kResultOk)
+      outputs[i + 1] = Vst::SpeakerArr::kStereo;
+  }
+
+  auto res = instance->audio_processor->setBusArrangements(inputs.data(), n_inputs,
+      outputs.data(), n_outputs);
+  if (res != kResultOk) {
+    GST_ERROR_OBJECT(instance->element, "Failed to set bus arrangments: 0x%08x", res);
+    return FALSE;
+  }
+
+  Vst::ProcessSetup setup = {
+    process_mode,
+    info->finfo->format == GST_AUDIO_FORMAT_F32 ? Vst::kSample32 : Vst::kSample64,
+    max_samples_per_chunk,
+    (double) info->rate
+  };
+
+  GST_VST_TRACER_PRE(instance->element, processor_info->name, GST_VST_TRACER_CALL_SETUP_PROCESSING,
+      setup.maxSamplesPerBlock);
+  res = instance->audio_processor->setupProcessing(setup);
+  GST_VST_TRACER_POST(instance->element, processor_info->name, GST_VST_TRACER_CALL_SETUP_PROCESSING,
+      setup.maxSamplesPerBlock, res);
+  if (res != kResultOk) {
+    GST_ERROR_OBJECT(instance->element, "Failed to setup processing: %08x", res);
+    return FALSE;
+  }
+
+  // Auxiliary inputs are silent until data is provided for them
+  for (auto i = 0U; i < processor_info->n_aux_inputs; i++)
+    instance->aux_in_silent[i] = TRUE;
+
+  // And the plugin decides about the channels of the auxiliary outputs
+  for (auto i = 0U; i < processor_info->n_aux_outputs; i++) {
+    Vst::SpeakerArrangement arrangement = outputs[i + 1];
+
+    instance->audio_processor->getBusArrangement(Vst::BusDirections::kOutput, i + 1, arrangement);
+    auto channels = Vst::SpeakerArr::getChannelCount(arrangement);
+    GST_DEBUG_OBJECT(instance->element, "Auxiliary output %u has %d channels", i, channels);
+
+    instance->aux_out_channels[i] = channels;
+    instance->aux_out_dest[i] = nullptr;
+  }
+
+  // Reallocate our buffers for all channels of all busses
+  allocate_scratch_memory(instance, info->channels, info->bpf / info->channels,
+      max_samples_per_chunk);
+  instance->data_len = max_samples_per_chunk;
+
+  instance->info = *info;
+  instance->process_mode = process_mode;
+  instance->state = GST_VST_INSTANCE_STATE_SETUP;
+
+  return TRUE;
+}
+
+// Whether the next gst_vst_instance_open() runs the component in a helper
+// process. memory_limit is the maximum address space of that process in
+// bytes, or 0 for no limit
+void
+gst_vst_instance_set_sandbox(GstVstInstance * instance, gboolean use_sandbox,
+    guint64 memory_limit)
+{
+  instance->use_sandbox = use_sandbox;
+  instance->sandbox_memory_limit = memory_limit;
+}
+
+// Whether the scratch memory should be locked into RAM. Only takes effect with
+// the next gst_vst_instance_setup()
+void
+gst_vst_instance_set_lock_memory(GstVstInstance * instance, gboolean lock_memory)
+{
+  instance->lock_memory = lock_memory;
+}
+
+// Configures the number of channels of an auxiliary input bus. Only takes
+// effect with the next gst_vst_instance_setup()
+void
+gst_vst_instance_set_aux_input_channels(GstVstInstance * instance, guint bus,
+    gint channels)
+{
+  g_return_if_fail(bus < instance->processor_info->n_aux_inputs);
+
+  instance->aux_in_channels[bus] = channels;
+}
+
+gint
+gst_vst_instance_get_aux_input_channels(GstVstInstance * instance, guint bus)
+{
+  g_return_val_if_fail(bus < instance->processor_info->n_aux_inputs, 0);
+
+  return instance->aux_in_channels[bus] ? instance->aux_in_channels[bus] : instance->info.channels;
+}
+
+gint
+gst_vst_instance_get_aux_output_channels(GstVstInstance * instance, guint bus)
+{
+  g_return_val_if_fail(bus < instance->processor_info->n_aux_outputs, 0);
+
+  return instance->aux_out_channels[bus];
+}
+
+// Sets where the next process() call stores the interleaved output of an
+// auxiliary bus. out_data must have space for the same number of samples as
+// the main output. Without a destination the output of the bus is
+// discarded. Mono busses are written there directly by the plugin
+void
+gst_vst_instance_set_aux_output(GstVstInstance * instance, guint bus,
+    gpointer out_data)
+{
+  g_return_if_fail(bus < instance->processor_info->n_aux_outputs);
+
+  instance->aux_out_dest[bus] = out_data;
+}
+
+GstClockTime
+gst_vst_instance_get_latency(GstVstInstance * instance)
+{
+  auto latency_samples = instance->sandbox ?
+      gst_vst_sandbox_get_latency_samples(instance->sandbox) :
+      instance->audio_processor->getLatencySamples();
+
+  return gst_util_uint64_scale_int(latency_samples, GST_SECOND, instance->info.rate);
+}
+
+guint32
+gst_vst_instance_get_tail_samples(GstVstInstance * instance)
+{
+  auto tail_samples = instance->sandbox ?
+      gst_vst_sandbox_get_tail_samples(instance->sandbox) :
+      instance->audio_processor->getTailSamples();
+
+  // Nothing sensible we can do with an infinite tail here
+  if (tail_samples == Vst::kInfiniteTail)
+    return 0;
+
+  return tail_samples;
+}
+
+gboolean
+gst_vst_instance_activate(GstVstInstance * instance)
+{
+  auto processor_info = instance->processor_info;
+
+  if (instance->state < GST_VST_INSTANCE_STATE_SETUP)
+    return FALSE;
+
+  if (instance->sandbox && instance->state < GST_VST_INSTANCE_STATE_PROCESSING) {
+    if (!gst_vst_sandbox_activate(instance->sandbox)) {
+      GST_ERROR_OBJECT(instance->element, "Failed to activate component in sandbox");
+      return FALSE;
+    }
+
+    instance->state = GST_VST_INSTANCE_STATE_PROCESSING;
+  }
+
+  if (instance->state < GST_VST_INSTANCE_STATE_ACTIVE) {
+    GST_DEBUG_OBJECT(instance->element, "Activating component");
+    GST_VST_TRACER_PRE(instance->element, processor_info->name, GST_VST_TRACER_CALL_SET_ACTIVE, 0);
+    auto res = instance->component->setActive(true);
+    GST_VST_TRACER_POST(instance->element, processor_info->name, GST_VST_TRACER_CALL_SET_ACTIVE, 0, res);
+    if (res != kResultOk) {
+      GST_ERROR_OBJECT(instance->element, "Failed to set active: %08x", res);
+      return FALSE;
+    }
+
+    instance->state = GST_VST_INSTANCE_STATE_ACTIVE;
+  }
+
+  if (instance->state < GST_VST_INSTANCE_STATE_PROCESSING) {
+    GST_DEBUG_OBJECT(instance->element, "Set component to processing");
+    auto res = instance->audio_processor->setProcessing(true);
+    if (res != kResultOk && res != kNotImplemented) {
+      GST_ERROR_OBJECT(instance->element, "Failed to set processing: %08x", res);
+      return FALSE;
+    }
+
+    instance->state = GST_VST_INSTANCE_STATE_PROCESSING;
+  }
+
+  return TRUE;
+}
+
+// Stops processing and deactivates the component if needed. It can be
+// activated again with gst_vst_instance_activate()
+void
+gst_vst_instance_deactivate(GstVstInstance * instance)
+{
+  auto processor_info = instance->processor_info;
+
+  if (instance->sandbox) {
+    if (instance->state >= GST_VST_INSTANCE_STATE_ACTIVE)
+      gst_vst_sandbox_deactivate(instance->sandbox);
+  } else {
+    if (instance->state >= GST_VST_INSTANCE_STATE_PROCESSING)
+      instance->audio_processor->setProcessing(false);
+    if (instance->state >= GST_VST_INSTANCE_STATE_ACTIVE) {
+      GST_VST_TRACER_PRE(instance->element, processor_info->name, GST_VST_TRACER_CALL_SET_ACTIVE, 0);
+      auto res = instance->component->setActive(false);
+      GST_VST_TRACER_POST(instance->element, processor_info->name, GST_VST_TRACER_CALL_SET_ACTIVE, 0, res);
+    }
+  }
+  if (instance->state > GST_VST_INSTANCE_STATE_SETUP)
+    instance->state = GST_VST_INSTANCE_STATE_SETUP;
+}
+
+template<typename T>
+static void
+deinterleave(const T * in_data, T ** out_data, gint channels, guint len)
+{
+  if (channels == 1) {
+    memcpy(out_data[0], in_data, len * sizeof(T));
+    return;
+  }
+
+  for (auto i = 0; i < channels; i++) {
+    auto out = out_data[i];
+
+    for (auto j = 0U; j < len; j++)
+      out[j] = in_data[i + j * channels];
+  }
+}
+
+template<typename T>
+static void
+interleave(T * const * in_data, T * out_data, gint channels, guint len)
+{
+  if (channels == 1) {
+    memcpy(out_data, in_data[0], len * sizeof(T));
+    return;
+  }
+
+  for (auto i = 0; i < channels; i++) {
+    auto in = in_data[i];
+
+    for (auto j = 0U; j < len; j++)
+      out_data[i + j * channels] = in[j];
+  }
+}
+
+// Same as interleave(), but also measures the peak and sum of squares per
+// channel while the samples pass through
+template<typename T>
+static void
+interleave_measure(T * const * in_data, T * out_data, gint channels, guint len,
+    gdouble * peaks, gdouble * sums)
+{
+  for (auto i = 0; i < channels; i++) {
+    auto in = in_data[i];
+    T peak = 0;
+    gdouble sum = 0.0;
+
+    for (auto j = 0U; j < len; j++) {
+      auto sample = in[j];
+
+      out_data[i + j * channels] = sample;
+      peak = MAX(peak, std::fabs(sample));
+      sum += (gdouble) sample * sample;
+    }
+
+    peaks[i] = peak;
+    sums[i] = sum;
+  }
+}
+
+template<typename T>
+static void
+measure(const T * data, gint channels, guint len, gdouble * peaks, gdouble * sums)
+{
+  for (auto i = 0; i < channels; i++) {
+    T peak = 0;
+    gdouble sum = 0.0;
+
+    for (auto j = 0U; j < len; j++) {
+      auto sample = data[i + j * channels];
+
+      peak = MAX(peak, std::fabs(sample));
+      sum += (gdouble) sample * sample;
+    }
+
+    peaks[i] = peak;
+    sums[i] = sum;
+  }
+}
+
+static void
+deinterleave_data(GstVstInstance * instance, gconstpointer in_data,
+    gpointer * out_data, gint channels, guint len)
+{
+  if (instance->info.finfo->format == GST_AUDIO_FORMAT_F32)
+    deinterleave((const float *) in_data, (float **) out_data, channels, len);
+  else
+    deinterleave((const double *) in_data, (double **) out_data, channels, len);
+}
+
+static void
+interleave_data(GstVstInstance * instance, gpointer * in_data,
+    gpointer out_data, gint channels, guint len)
+{
+  if (instance->info.finfo->format == GST_AUDIO_FORMAT_F32)
+    interleave((float **) in_data, (float *) out_data, channels, len);
+  else
+    interleave((double **) in_data, (double *) out_data, channels, len);
+}
+
+static void
+interleave_measure_data(GstVstInstance * instance, gpointer * in_data,
+    gpointer out_data, gint channels, guint len)
+{
+  if (instance->info.finfo->format == GST_AUDIO_FORMAT_F32)
+    interleave_measure((float **) in_data, (float *) out_data, channels, len,
+        instance->level_peaks, instance->level_sums);
+  else
+    interleave_measure((double **) in_data, (double *) out_data, channels, len,
+        instance->level_peaks, instance->level_sums);
+}
+
+// Provides the interleaved input of an auxiliary bus for the next process()
+// call. in_data must contain n_samples in the format of the main bus and the
+// channels of the auxiliary bus, or be nullptr for silence
+void
+gst_vst_instance_set_aux_input(GstVstInstance * instance, guint bus,
+    gconstpointer in_data, guint n_samples)
+{
+  g_return_if_fail(bus < instance->processor_info->n_aux_inputs);
+  g_return_if_fail(n_samples <= instance->data_len);
+
+  auto channels = gst_vst_instance_get_aux_input_channels(instance, bus);
+  auto bps = instance->info.bpf / instance->info.channels;
+
+  if (in_data) {
+    deinterleave_data(instance, in_data, &instance->aux_in_data[GST_VST_MAX_CHANNELS * bus], channels, n_samples);
+    instance->aux_in_silent[bus] = FALSE;
+  } else if (!instance->aux_in_silent[bus]) {
+    for (auto c = 0; c < channels; c++)
+      memset(instance->aux_in_data[GST_VST_MAX_CHANNELS * bus + c], 0, bps * instance->data_len);
+    instance->aux_in_silent[bus] = TRUE;
+  }
+}
+
+// Enables flush-to-zero and denormals-are-zero for the calling thread and
+// returns the previous floating point control state
+static inline guint64
+flush_denormals_begin(void)
+{
+#if defined(HAVE_MXCSR)
+  auto csr = _mm_getcsr();
+  // FTZ and DAZ
+  _mm_setcsr(csr | 0x8040);
+  return csr;
+#elif defined(__aarch64__) && defined(__GNUC__)
+  guint64 fpcr;
+  __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+  // FZ
+  __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1ULL << 24)));
+  return fpcr;
+#elif defined(__arm__) && defined(__ARM_FP) && defined(__GNUC__)
+  guint32 fpscr;
+  __asm__ __volatile__("vmrs %0, fpscr" : "=r"(fpscr));
+  // FZ
+  __asm__ __volatile__("vmsr fpscr, %0" : : "r"(fpscr | (1U << 24)));
+  return fpscr;
+#else
+  return 0;
+#endif
+}
+
+static inline void
+flush_denormals_end(guint64 state)
+{
+#if defined(HAVE_MXCSR)
+  _mm_setcsr((unsigned int) state);
+#elif defined(__aarch64__) && defined(__GNUC__)
+  __asm__ __volatile__("msr fpcr, %0" : : "r"(state));
+#elif defined(__arm__) && defined(__ARM_FP) && defined(__GNUC__)
+  __asm__ __volatile__("vmsr fpscr, %0" : : "r"((guint32) state));
+#endif
+}
+
+// Whether denormals are flushed to zero during process() calls. Enabled by
+// default
+void
+gst_vst_instance_set_flush_denormals(GstVstInstance * instance, gboolean flush_denormals)
+{
+  instance->flush_denormals = flush_denormals;
+}
+
+// Whether process() measures the levels of the main output into level_peaks
+// and level_sums. Disabled by default
+void
+gst_vst_instance_set_measure_levels(GstVstInstance * instance, gboolean measure_levels)
+{
+  instance->measure_levels = measure_levels;
+}
+
+// Measures the levels of interleaved data in the format of the main bus, for
+// output that was not interleaved by process()
+void
+gst_vst_instance_measure_levels(GstVstInstance * instance, gconstpointer data,
+    guint n_samples)
+{
+  if (instance->info.finfo->format == GST_AUDIO_FORMAT_F32)
+    measure((const float *) data, instance->info.channels, n_samples,
+        instance->level_peaks, instance->level_sums);
+  else
+    measure((const double *) data, instance->info.channels, n_samples,
+        instance->level_peaks, instance->level_sums);
+}
+
+// Returns the preallocated output parameter changes, emptied for the next
+// process() call
+Vst::ParameterChanges *
+gst_vst_instance_get_out_parameter_changes(GstVstInstance * instance)
+{
+  instance->out_parameter_changes->clearQueue();
+
+  return instance->out_parameter_changes;
+}
+
+// Processes one chunk of at most data_len interleaved samples from in_data
+// into out_data, which must have space for n_samples. The number of samples
+// the plugin actually produced is returned in n_out_samples. Both can be the
+// same to process in place
+tresult
+gst_vst_instance_process(GstVstInstance * instance,
+    gconstpointer in_data, gpointer out_data, guint n_samples,
+    gint64 sample_position, gboolean input_silent,
+    Vst::IParameterChanges * in_parameter_changes,
+    Vst::IParameterChanges * out_parameter_changes,
+    guint * n_out_samples)
+{
+  auto processor_info = instance->processor_info;
+
+  g_assert(n_samples <= instance->data_len);
+
+  if (instance->sandbox) {
+    auto res = gst_vst_sandbox_process(instance->sandbox, in_data, out_data, n_samples,
+        sample_position, input_silent, instance->flush_denormals,
+        in_parameter_changes, out_parameter_changes, n_out_samples);
+
+    // The output was just copied out of the shared memory
+    if (res == kResultOk && instance->measure_levels)
+      gst_vst_instance_measure_levels(instance, out_data, *n_out_samples);
+
+    return res;
+  }
+
+  *n_out_samples = 0;
+
+  // Mono audio is the same interleaved and planar, so the plugin can work
+  // directly on our buffers. VST3 allows in-place processing, so they may
+  // even be the same
+  auto direct = instance->info.channels == 1;
+  gpointer direct_in_data[1] = { (gpointer) in_data };
+  gpointer direct_out_data[1] = { out_data };
+  auto channel_in_data = direct ? direct_in_data : instance->in_data;
+  auto channel_out_data = direct ? direct_out_data : instance->out_data;
+
+  // Fill input buffers and metadata
+  if (!direct)
+    deinterleave_data(instance, in_data, instance->in_data, instance->info.channels, n_samples);
+  auto n_inputs = 1 + processor_info->n_aux_inputs;
+  auto n_outputs = 1 + processor_info->n_aux_outputs;
+  auto inputs = instance->inputs;
+  inputs[0].numChannels = instance->info.channels;
+  inputs[0].silenceFlags = input_silent ? G_MAXUINT64 : 0;
+  if (instance->info.finfo->format == GST_AUDIO_FORMAT_F32)
+    inputs[0].channelBuffers32 = (Vst::Sample32 **) channel_in_data;
+  else
+    inputs[0].channelBuffers64 = (Vst::Sample64 **) channel_in_data;
+
+  for (auto i = 0U; i < processor_info->n_aux_inputs; i++) {
+    auto input = &inputs[i + 1];
+
+    input->numChannels = gst_vst_instance_get_aux_input_channels(instance, i);
+    input->silenceFlags = instance->aux_in_silent[i] ? G_MAXUINT64 : 0;
+    if (instance->info.finfo->format == GST_AUDIO_FORMAT_F32)
+      input->channelBuffers32 = (Vst::Sample32 **) &instance->aux_in_data[GST_VST_MAX_CHANNELS * i];
+    else
+      input->channelBuffers64 = (Vst::Sample64 **) &instance->aux_in_data[GST_VST_MAX_CHANNELS * i];
+  }
+
+  // Fill output buffer metadata
+  auto outputs = instance->outputs;
+  outputs[0].numChannels = instance->info.channels;
+  outputs[0].silenceFlags = 0;
+  if (instance->info.finfo->format == GST_AUDIO_FORMAT_F32)
+    outputs[0].channelBuffers32 = (Vst::Sample32 **) channel_out_data;
+  else
+    outputs[0].channelBuffers64 = (Vst::Sample64 **) channel_out_data;
+
+  for (auto i = 0U; i < processor_info->n_aux_outputs; i++) {
+    auto output = &outputs[i + 1];
+    auto channels = instance->aux_out_channels[i];
+
+    // Mono output can be written directly to the destination
+    for (auto c = 0; c < channels; c++)
+      instance->aux_out_buffers[i][c] = instance->aux_out_data[i][c];
+    if (channels == 1 && instance->aux_out_dest[i])
+      instance->aux_out_buffers[i][0] = instance->aux_out_dest[i];
+
+    output->numChannels = channels;
+    output->silenceFlags = 0;
+    if (instance->info.finfo->format == GST_AUDIO_FORMAT_F32)
+      output->channelBuffers32 = (Vst::Sample32 **) instance->aux_out_buffers[i];
+    else
+      output->channelBuffers64 = (Vst::Sample64 **) instance->aux_out_buffers[i];
+  }
+
+  // Set up process context with information about the system state
+  Vst::ProcessContext process_context;
+  process_context.state = Vst::ProcessContext::kPlaying |
+      Vst::ProcessContext::kRecording;
+  process_context.sampleRate = instance->info.rate;
+  process_context.projectTimeSamples = sample_position;
+  // The system time is meaningless when rendering offline
+  if (instance->process_mode != Vst::kOffline) {
+    process_context.state |= Vst::ProcessContext::kSystemTimeValid;
+    process_context.systemTime = gst_util_get_timestamp();
+  } else {
+    process_context.systemTime = 0;
+  }
+
+  // Set up process data
+  Vst::ProcessData data;
+  data.processMode = instance->process_mode;
+  data.symbolicSampleSize = instance->info.finfo->format == GST_AUDIO_FORMAT_F32 ? Vst::kSample32 : Vst::kSample64;
+  data.numSamples = n_samples;
+  data.numInputs = n_inputs;
+  data.numOutputs = n_outputs;
+  data.inputs = inputs;
+  data.outputs = outputs;
+  data.processContext = &process_context;
+  data.inputParameterChanges = in_parameter_changes;
+  data.outputParameterChanges = out_parameter_changes;
+
+  // And finally do the actual processing of this chunk
+  GST_VST_TRACER_PRE(instance->element, processor_info->name, GST_VST_TRACER_CALL_PROCESS, n_samples);
+  auto fp_state = instance->flush_denormals ? flush_denormals_begin() : 0;
+  auto res = instance->audio_processor->process(data);
+  if (instance->flush_denormals)
+    flush_denormals_end(fp_state);
+  GST_VST_TRACER_POST(instance->element, processor_info->name, GST_VST_TRACER_CALL_PROCESS, n_samples, res);
+
+  if (res == kResultOk && data.numSamples > 0) {
+    // Never write more than what was requested
+    auto n = MIN((guint) data.numSamples, n_samples);
+    if (!direct && instance->measure_levels)
+      interleave_measure_data(instance, instance->out_data, out_data, instance->info.channels, n);
+    else if (!direct)
+      interleave_data(instance, instance->out_data, out_data, instance->info.channels, n);
+    else if (instance->measure_levels)
+      gst_vst_instance_measure_levels(instance, out_data, n);
+
+    for (auto i = 0U; i < processor_info->n_aux_outputs; i++) {
+      auto channels = instance->aux_out_channels[i];
+
+      if (instance->aux_out_dest[i] && channels > 1)
+        interleave_data(instance, instance->aux_out_buffers[i], instance->aux_out_dest[i], channels, n);
+    }
+
+    *n_out_samples = n;
+  }
+
+  // Destinations are only valid for a single call
+  for (auto i = 0U; i < processor_info->n_aux_outputs; i++)
+    instance->aux_out_dest[i] = nullptr;
+
+  return res;
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+#include <vst/hosting/module.h>
+#include <vst/hosting/parameterchanges.h>
+#include <pluginterfaces/base/smartpointer.h>
+#include <pluginterfaces/vst/ivstaudioprocessor.h>
+#include <pluginterfaces/vst/ivsteditcontroller.h>
+
+#include <memory>
+
+#include "gstvstaudioprocessor.h"
+#include "gstvstsandbox.h"
+
+#ifndef __GST_VST_INSTANCE_H__
+#define __GST_VST_INSTANCE_H__
+
+// Channels per bus. Only mono and stereo arrangements are registered, see
+// gst_vst_audio_processor_register(), so all per channel arrays have this
+// size
+#define GST_VST_MAX_CHANNELS (2)
+
+// Property definition
+typedef struct {
+  Steinberg::Vst::ParamID param_id;
+  const gchar *name;
+  const gchar *nick;
+  const gchar *description;
+  GType type;            // float, bool, int
+  gint32 max_value;      // for int
+  gdouble default_value;
+  gboolean read_only;
+
+  GParamSpec *pspec;
+} GstVstAudioProcessorProperty;
+
+// Class information extracted from component
+struct _GstVstAudioProcessorInfo {
+  const gchar *name;
+  GstCaps *caps;
+  const gchar *path;
+  VST3::UID class_id;
+
+  // properties[0] -> GObject property ID 1
+  GstVstAudioProcessorProperty *properties;
+  guint n_properties;
+
+  // Audio input busses after the main one, e.g. sidechains
+  guint n_aux_inputs;
+  // Audio output busses after the main one, e.g. stems
+  guint n_aux_outputs;
+};
+
+GParamSpec * gst_vst_audio_processor_property_new_param_spec(
+    const GstVstAudioProcessorProperty * property);
+
+Steinberg::Vst::ProcessModes gst_vst_process_mode_resolve(GstVstProcessMode process_mode,
+    GstPad * sinkpad);
+
+// The different states a plugin instance can be in
+typedef enum {
+  GST_VST_INSTANCE_STATE_NONE = 0,
+  GST_VST_INSTANCE_STATE_CREATED,
+  GST_VST_INSTANCE_STATE_INITIALIZED,
+  GST_VST_INSTANCE_STATE_SETUP,
+  GST_VST_INSTANCE_STATE_ACTIVE,
+  GST_VST_INSTANCE_STATE_PROCESSING,
+} GstVstInstanceState;
+
+// One instance of a plugin class, together with the scratch memory needed
+// for converting between interleaved GStreamer and planar VST3 buffers.
+//
+// Not thread-safe: all functions must be called from the thread that
+// currently owns the instance
+typedef struct {
+  // Used for logging, tracing and posting messages, not owned
+  GstElement *element;
+  const GstVstAudioProcessorInfo *processor_info;
+
+  GstVstInstanceState state;
+  std::shared_ptr<VST3::Hosting::Module> module;
+  Steinberg::IPtr<Steinberg::Vst::IComponent> component;
+  Steinberg::IPtr<Steinberg::Vst::IEditController> edit_controller;
+  Steinberg::IPtr<Steinberg::Vst::IAudioProcessor> audio_processor;
+  Steinberg::IPtr<Steinberg::Vst::IComponentHandler> component_handler;
+
+  // Set flush-to-zero and denormals-are-zero around process() calls
+  gboolean flush_denormals;
+
+  // If set, component and audio processor live in a helper process and
+  // everything goes through the sandbox. Only the edit controller is
+  // created in this process
+  gboolean use_sandbox;
+  guint64 sandbox_memory_limit;
+  GstVstSandbox *sandbox;
+
+  // Configuration from the last successful setup
+  GstAudioInfo info;
+  Steinberg::Vst::ProcessModes process_mode;
+
+  // All scratch memory below is allocated from this block at setup, with
+  // every buffer aligned to GST_VST_INSTANCE_ALIGNMENT bytes. If requested,
+  // it is locked into RAM and all pages are touched once before processing.
+  // The bus buffers and parameter changes are allocated at open instead
+  gboolean lock_memory;
+  gpointer arena;
+  gpointer arena_data;
+  gsize arena_size;
+  gboolean arena_locked;
+
+  // Temporary buffer space used for deinterleaving
+  gpointer in_data[GST_VST_MAX_CHANNELS];
+  gpointer out_data[GST_VST_MAX_CHANNELS];
+  guint data_len;
+
+  // Channels (0 = same as main bus), deinterleaved data of the next
+  // process() call (GST_VST_MAX_CHANNELS per bus) and silence per auxiliary input bus
+  gint *aux_in_channels;
+  gpointer *aux_in_data;
+  gboolean *aux_in_silent;
+
+  // Channels as configured by the plugin, deinterleaved data, the channel
+  // buffers passed to the plugin and the interleaved destination of the
+  // next process() call per auxiliary output bus
+  gint *aux_out_channels;
+  gpointer **aux_out_data;
+  gpointer **aux_out_buffers;
+  gpointer *aux_out_dest;
+
+  // Bus buffers passed to process(), main bus first
+  Steinberg::Vst::AudioBusBuffers *inputs;
+  Steinberg::Vst::AudioBusBuffers *outputs;
+
+  // Output parameter changes of the last process() call, with space for
+  // changes of all parameters
+  Steinberg::Vst::ParameterChanges *out_parameter_changes;
+
+  // If set, the peak and sum of squares per channel of the main output are
+  // measured while interleaving it in process()
+  gboolean measure_levels;
+  gdouble level_peaks[GST_VST_MAX_CHANNELS];
+  gdouble level_sums[GST_VST_MAX_CHANNELS];
+} GstVstInstance;
+
+#define GST_VST_INSTANCE_ALIGNMENT (64)
+
+gboolean gst_vst_instance_open(GstVstInstance * instance, GstElement * element,
+    const GstVstAudioProcessorInfo * processor_info);
+void gst_vst_instance_close(GstVstInstance * instance);
+void gst_vst_instance_set_sandbox(GstVstInstance * instance, gboolean use_sandbox,
+    guint64 memory_limit);
+
+Steinberg::Vst::ParameterChanges * gst_vst_instance_sync_parameters(GstVstInstance * instance,
+    const gdouble * parameter_values, gboolean skip_defaults);
+gdouble gst_vst_instance_set_parameter(GstVstInstance * instance,
+    Steinberg::Vst::ParameterChanges * parameter_changes,
+    Steinberg::Vst::ParamID param_id, gdouble plain_value,
+    Steinberg::int32 sample_offset);
+gdouble gst_vst_instance_get_parameter(GstVstInstance * instance,
+    Steinberg::Vst::ParamID param_id);
+gboolean gst_vst_instance_get_state(GstVstInstance * instance,
+    Steinberg::IBStream * component_stream, Steinberg::IBStream * controller_stream);
+gboolean gst_vst_instance_set_state(GstVstInstance * instance,
+    GBytes * component_state, GBytes * controller_state);
+
+gboolean gst_vst_instance_setup(GstVstInstance * instance, const GstAudioInfo * info,
+    Steinberg::Vst::ProcessModes process_mode, gint max_samples_per_chunk);
+void gst_vst_instance_set_lock_memory(GstVstInstance * instance, gboolean lock_memory);
+void gst_vst_instance_set_aux_input_channels(GstVstInstance * instance, guint bus,
+    gint channels);
+gint gst_vst_instance_get_aux_input_channels(GstVstInstance * instance, guint bus);
+void gst_vst_instance_set_aux_input(GstVstInstance * instance, guint bus,
+    gconstpointer in_data, guint n_samples);
+gint gst_vst_instance_get_aux_output_channels(GstVstInstance * instance, guint bus);
+void gst_vst_instance_set_aux_output(GstVstInstance * instance, guint bus,
+    gpointer out_data);
+GstClockTime gst_vst_instance_get_latency(GstVstInstance * instance);
+guint32 gst_vst_instance_get_tail_samples(GstVstInstance * instance);
+
+gboolean gst_vst_instance_activate(GstVstInstance * instance);
+void gst_vst_instance_deactivate(GstVstInstance * instance);
+
+void gst_vst_instance_set_flush_denormals(GstVstInstance * instance,
+    gboolean flush_denormals);
+Steinberg::Vst::ParameterChanges * gst_vst_instance_get_out_parameter_changes(GstVstInstance * instance);
+void gst_vst_instance_set_measure_levels(GstVstInstance * instance,
+    gboolean measure_levels);
+void gst_vst_instance_measure_levels(GstVstInstance * instance, gconstpointer data,
+    guint n_samples);
+
+Steinberg::tresult gst_vst_instance_process(GstVstInstance * instance,
+    gconstpointer in_data, gpointer out_data, guint n_samples,
+    gint64 sample_position, gboolean input_silent,
+    Steinberg::Vst::IParameterChanges * in_parameter_changes,
+    Steinberg::Vst::IParameterChanges * out_parameter_changes,
+    guint * n_out_samples);
+
+#endif /* __GST_VST_INSTANCE_H__ */
@@ -0,0 +1,878 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "plugin.h"
+#include "gstvstmultiaudioprocessor.h"
+#include "gstvstinstance.h"
+#include "gstvstthreadpool.h"
+
+#include <gst/audio/audio.h>
+#include <gst/base/base.h>
+
+#include <vst/hosting/parameterchanges.h>
+#include <pluginterfaces/vst/ivstaudioprocessor.h>
+
+GST_DEBUG_CATEGORY_EXTERN(gst_vst_audio_processor_debug);
+#define GST_CAT_DEFAULT gst_vst_audio_processor_debug
+
+using namespace Steinberg;
+
+static GstElementClass *parent_class = nullptr;
+static GQuark multi_audio_processor_info_quark;
+
+static void gst_vst_multi_audio_processor_class_init(GstVstMultiAudioProcessorClass * klass);
+static void gst_vst_multi_audio_processor_sub_class_init(GstVstMultiAudioProcessorClass * klass);
+static void gst_vst_multi_audio_processor_init(GstVstMultiAudioProcessor * self,
+    GstVstMultiAudioProcessorClass * klass);
+
+static GstFlowReturn gst_vst_multi_audio_processor_sink_chain(GstPad * pad,
+    GstObject * parent, GstBuffer * buffer);
+static gboolean gst_vst_multi_audio_processor_sink_event(GstPad * pad,
+    GstObject * parent, GstEvent * event);
+static gboolean gst_vst_multi_audio_processor_src_query(GstPad * pad,
+    GstObject * parent, GstQuery * query);
+static GstIterator *gst_vst_multi_audio_processor_iterate_internal_links(GstPad * pad,
+    GstObject * parent);
+
+static void gst_vst_multi_audio_processor_finalize(GObject * object);
+static void gst_vst_multi_audio_processor_get_property(GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_vst_multi_audio_processor_set_property(GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+
+static void gst_vst_multi_audio_processor_sub_get_property(GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_vst_multi_audio_processor_sub_set_property(GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+
+static GstStateChangeReturn gst_vst_multi_audio_processor_change_state(GstElement *
+    element, GstStateChange transition);
+static GstPad *gst_vst_multi_audio_processor_request_new_pad(GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_vst_multi_audio_processor_release_pad(GstElement * element,
+    GstPad * pad);
+
+enum {
+  PROP_0 = 0,
+  PROP_MAX_SAMPLES_PER_CHUNK,
+  PROP_PROCESS_MODE,
+};
+
+#define DEFAULT_MAX_SAMPLES_PER_CHUNK (1024)
+#define DEFAULT_PROCESS_MODE GST_VST_PROCESS_MODE_PREFETCH
+
+// One sink_%u/src_%u pad pair together with its own plugin instance
+typedef struct {
+  GstVstMultiAudioProcessor *self;
+  guint index;
+
+  GstPad *sinkpad, *srcpad;
+
+  // Protected by object lock
+  Vst::ParameterChanges *parameter_changes;
+
+  // State
+  // Protected by stream lock of sinkpad
+  GstSegment segment;
+  GstAudioInfo info;
+  GstClockTime latency;
+
+  GstVstInstance instance;
+} GstVstMultiStream;
+
+struct _GstVstMultiAudioProcessor {
+  GstElement element;
+
+  // Properties
+  gint max_samples_per_chunk;
+  GstVstProcessMode process_mode;
+
+  // Protected by object lock
+  gdouble *parameter_values;
+
+  // Protected by streams lock, taken before the object lock
+  GMutex streams_lock;
+  GList *streams;
+  guint next_stream_index;
+  gboolean opened;
+
+  GstVstThreadPool *thread_pool;
+};
+
+struct _GstVstMultiAudioProcessorClass {
+  GstElementClass parent_class;
+
+  const GstVstAudioProcessorInfo *processor_info;
+};
+
+GType
+gst_vst_multi_audio_processor_get_type(void)
+{
+  static volatile gsize type = 0;
+
+  if (g_once_init_enter(&type)) {
+    GType _type;
+    static const GTypeInfo info = {
+      sizeof (GstVstMultiAudioProcessorClass),
+      nullptr,
+      nullptr,
+      (GClassInitFunc) gst_vst_multi_audio_processor_class_init,
+      nullptr,
+      nullptr,
+      sizeof (GstVstMultiAudioProcessor),
+      0,
+      (GInstanceInitFunc) gst_vst_multi_audio_processor_init,
+      nullptr
+    };
+
+    _type = g_type_register_static(GST_TYPE_ELEMENT, "GstVstMultiAudioProcessor",
+        &info, (GTypeFlags) 0);
+
+    multi_audio_processor_info_quark =
+        g_quark_from_static_string ("gst-vst-multi-audio-processor-info");
+
+    g_once_init_leave(&type, _type);
+  }
+  return type;
+}
+
+static void
+gst_vst_multi_audio_processor_sub_class_init(GstVstMultiAudioProcessorClass * klass)
+{
+  auto gobject_class = G_OBJECT_CLASS(klass);
+  auto element_class = GST_ELEMENT_CLASS(klass);
+
+  auto processor_info = (const GstVstAudioProcessorInfo *)
+      g_type_get_qdata(G_TYPE_FROM_CLASS(klass), multi_audio_processor_info_quark);
+  // This happens for the base class and abstract subclasses
+  if (!processor_info)
+    return;
+
+  klass->processor_info = processor_info;
+
+  // Add pad templates
+  auto templ = gst_pad_template_new("sink_%u", GST_PAD_SINK, GST_PAD_REQUEST, processor_info->caps);
+  gst_element_class_add_pad_template(element_class, templ);
+
+  templ = gst_pad_template_new("src_%u", GST_PAD_SRC, GST_PAD_REQUEST, processor_info->caps);
+  gst_element_class_add_pad_template(element_class, templ);
+
+  auto longname = g_strdup_printf("VST3 Multi-stream audio processor - %s", processor_info->name);
+  gst_element_class_set_metadata(element_class,
+      processor_info->name,
+      "Audio/Filter",
+      longname, "Sebastian Dröge <sebastian@centricular.com>");
+  g_free(longname);
+
+  // Register all writable properties, if any. They apply to the instances of
+  // all streams. Read-only ones are not meaningful as each instance would
+  // report its own values
+  if (processor_info->n_properties > 0) {
+    gobject_class->set_property = gst_vst_multi_audio_processor_sub_set_property;
+    gobject_class->get_property = gst_vst_multi_audio_processor_sub_get_property;
+
+    for (auto i = 0U; i < processor_info->n_properties; i++) {
+      auto property = &processor_info->properties[i];
+
+      if (property->read_only)
+        continue;
+
+      g_object_class_install_property(gobject_class, i + 1,
+          gst_vst_audio_processor_property_new_param_spec(property));
+    }
+  }
+}
+
+static void
+gst_vst_multi_audio_processor_class_init(GstVstMultiAudioProcessorClass * klass)
+{
+  auto gobject_class = G_OBJECT_CLASS(klass);
+  auto gstelement_class = GST_ELEMENT_CLASS(klass);
+
+  parent_class = GST_ELEMENT_CLASS(g_type_class_peek_parent(klass));
+
+  gobject_class->set_property = gst_vst_multi_audio_processor_set_property;
+  gobject_class->get_property = gst_vst_multi_audio_processor_get_property;
+  gobject_class->finalize = gst_vst_multi_audio_processor_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_MAX_SAMPLES_PER_CHUNK,
+      g_param_spec_int ("max-samples-per-chunk", "Max Samples per Chunk",
+          "Maximum number of samples to process per chunk", 1,
+          G_MAXINT, DEFAULT_MAX_SAMPLES_PER_CHUNK,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  g_object_class_install_property (gobject_class, PROP_PROCESS_MODE,
+      g_param_spec_enum ("process-mode", "Process Mode",
+          "Processing mode the plugin is configured for. Offline allows "
+          "high-quality algorithms, realtime asks for low-CPU processing",
+          GST_TYPE_VST_PROCESS_MODE, DEFAULT_PROCESS_MODE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY)));
+
+  gstelement_class->change_state = gst_vst_multi_audio_processor_change_state;
+  gstelement_class->request_new_pad = gst_vst_multi_audio_processor_request_new_pad;
+  gstelement_class->release_pad = gst_vst_multi_audio_processor_release_pad;
+}
+
+static void
+gst_vst_multi_audio_processor_init(GstVstMultiAudioProcessor * self,
+    GstVstMultiAudioProcessorClass * klass)
+{
+  g_mutex_init(&self->streams_lock);
+
+  self->max_samples_per_chunk = DEFAULT_MAX_SAMPLES_PER_CHUNK;
+  self->process_mode = DEFAULT_PROCESS_MODE;
+  self->thread_pool = gst_vst_thread_pool_get_default();
+
+  // Initialize all properties as stored here with their default values
+  self->parameter_values = g_new0(gdouble, klass->processor_info->n_properties);
+  for (auto i = 0U; i < klass->processor_info->n_properties; i++)
+    self->parameter_values[i] = klass->processor_info->properties[i].default_value;
+}
+
+static void
+gst_vst_multi_audio_processor_finalize(GObject * object)
+{
+  auto self = GST_VST_MULTI_AUDIO_PROCESSOR(object);
+
+  // All request pads were released during dispose
+  g_assert(self->streams == nullptr);
+
+  g_free(self->parameter_values);
+  g_mutex_clear(&self->streams_lock);
+
+  G_OBJECT_CLASS(parent_class)->finalize(object);
+}
+
+static void
+gst_vst_multi_audio_processor_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec)
+{
+  auto self = GST_VST_MULTI_AUDIO_PROCESSOR(object);
+
+  switch (property_id) {
+    case PROP_MAX_SAMPLES_PER_CHUNK:
+      g_value_set_int (value, self->max_samples_per_chunk);
+      break;
+    case PROP_PROCESS_MODE:
+      g_value_set_enum (value, self->process_mode);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vst_multi_audio_processor_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec)
+{
+  auto self = GST_VST_MULTI_AUDIO_PROCESSOR(object);
+
+  switch (property_id) {
+    case PROP_MAX_SAMPLES_PER_CHUNK:
+      self->max_samples_per_chunk = g_value_get_int (value);
+      break;
+    case PROP_PROCESS_MODE:
+      self->process_mode = (GstVstProcessMode) g_value_get_enum (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vst_multi_audio_processor_sub_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec)
+{
+  auto self = GST_VST_MULTI_AUDIO_PROCESSOR(object);
+  auto klass = GST_VST_MULTI_AUDIO_PROCESSOR_GET_CLASS(self);
+
+  if (property_id > klass->processor_info->n_properties || property_id == 0) {
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    return;
+  }
+
+  GST_OBJECT_LOCK(self);
+  auto property = &klass->processor_info->properties[property_id - 1];
+  if (property->type == G_TYPE_DOUBLE)
+    g_value_set_double(value, self->parameter_values[property_id - 1]);
+  else if (property->type == G_TYPE_BOOLEAN)
+    g_value_set_boolean(value, self->parameter_values[property_id - 1] > 0.5);
+  else
+    g_value_set_int(value, self->parameter_values[property_id - 1]);
+  GST_OBJECT_UNLOCK(self);
+}
+
+static void
+gst_vst_multi_audio_processor_sub_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec)
+{
+  auto self = GST_VST_MULTI_AUDIO_PROCESSOR(object);
+  auto klass = GST_VST_MULTI_AUDIO_PROCESSOR_GET_CLASS(self);
+
+  if (property_id > klass->processor_info->n_properties || property_id == 0) {
+    G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    return;
+  }
+
+  g_mutex_lock(&self->streams_lock);
+  GST_OBJECT_LOCK(self);
+  auto property = &klass->processor_info->properties[property_id - 1];
+
+  // Store value in our cache
+  if (property->type == G_TYPE_DOUBLE) {
+    self->parameter_values[property_id - 1] = g_value_get_double(value);
+  } else if (property->type == G_TYPE_BOOLEAN) {
+    self->parameter_values[property_id - 1] = g_value_get_boolean(value);
+  } else {
+    self->parameter_values[property_id - 1] = g_value_get_int(value);
+  }
+
+  // And queue the change for every stream that has an instance
+  for (auto l = self->streams; l; l = l->next) {
+    auto stream = (GstVstMultiStream *) l->data;
+
+    if (!stream->instance.edit_controller)
+      continue;
+
+    if (!stream->parameter_changes)
+      stream->parameter_changes = new Vst::ParameterChanges();
+
+    gst_vst_instance_set_parameter(&stream->instance, stream->parameter_changes,
+        property->param_id, self->parameter_values[property_id - 1], 0);
+  }
+  GST_OBJECT_UNLOCK(self);
+  g_mutex_unlock(&self->streams_lock);
+}
+
+// Must be called with the streams lock
+static gboolean
+gst_vst_multi_audio_processor_open_stream(GstVstMultiAudioProcessor * self,
+    GstVstMultiStream * stream)
+{
+  auto klass = GST_VST_MULTI_AUDIO_PROCESSOR_GET_CLASS(self);
+
+  if (!gst_vst_instance_open(&stream->instance, GST_ELEMENT_CAST(self), klass->processor_info))
+    return FALSE;
+
+  // synchronize our cached property values with the component and controller
+  GST_OBJECT_LOCK(self);
+  stream->parameter_changes = gst_vst_instance_sync_parameters(&stream->instance,
+      self->parameter_values, TRUE);
+  GST_OBJECT_UNLOCK(self);
+
+  return TRUE;
+}
+
+// Must be called with the streams lock
+static void
+gst_vst_multi_audio_processor_close_stream(GstVstMultiAudioProcessor * self,
+    GstVstMultiStream * stream)
+{
+  GST_OBJECT_LOCK(self);
+  if (stream->parameter_changes) {
+    delete stream->parameter_changes;
+    stream->parameter_changes = nullptr;
+  }
+  GST_OBJECT_UNLOCK(self);
+
+  gst_vst_instance_close(&stream->instance);
+}
+
+static GstPad *
+gst_vst_multi_audio_processor_request_new_pad(GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps)
+{
+  auto self = GST_VST_MULTI_AUDIO_PROCESSOR(element);
+  guint index;
+
+  // Source pads are created together with their sink pad
+  if (GST_PAD_TEMPLATE_DIRECTION(templ) != GST_PAD_SINK) {
+    GST_ERROR_OBJECT(self, "Only sink pads can be requested");
+    return nullptr;
+  }
+
+  g_mutex_lock(&self->streams_lock);
+  if (name && sscanf(name, "sink_%u", &index) == 1) {
+    for (auto l = self->streams; l; l = l->next) {
+      if (((GstVstMultiStream *) l->data)->index == index) {
+        GST_ERROR_OBJECT(self, "Pad %s already exists", name);
+        g_mutex_unlock(&self->streams_lock);
+        return nullptr;
+      }
+    }
+    self->next_stream_index = MAX(self->next_stream_index, index + 1);
+  } else {
+    index = self->next_stream_index++;
+  }
+
+  auto stream = new GstVstMultiStream();
+  stream->self = self;
+  stream->index = index;
+  stream->instance.state = GST_VST_INSTANCE_STATE_NONE;
+  stream->latency = 0;
+  gst_audio_info_init(&stream->info);
+  gst_segment_init(&stream->segment, GST_FORMAT_TIME);
+
+  // Already past NULL, so the instance is needed right away
+  if (self->opened && !gst_vst_multi_audio_processor_open_stream(self, stream)) {
+    g_mutex_unlock(&self->streams_lock);
+    delete stream;
+    return nullptr;
+  }
+
+  auto pad_name = g_strdup_printf("sink_%u", index);
+  stream->sinkpad = gst_pad_new_from_template(templ, pad_name);
+  g_free(pad_name);
+  gst_pad_set_element_private(stream->sinkpad, stream);
+  gst_pad_set_chain_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_vst_multi_audio_processor_sink_chain));
+  gst_pad_set_event_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_vst_multi_audio_processor_sink_event));
+  gst_pad_set_iterate_internal_links_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_vst_multi_audio_processor_iterate_internal_links));
+  GST_PAD_SET_PROXY_CAPS (stream->sinkpad);
+
+  auto src_templ = gst_element_class_get_pad_template(GST_ELEMENT_GET_CLASS(self), "src_%u");
+  pad_name = g_strdup_printf("src_%u", index);
+  stream->srcpad = gst_pad_new_from_template(src_templ, pad_name);
+  g_free(pad_name);
+  gst_pad_set_element_private(stream->srcpad, stream);
+  gst_pad_set_query_function (stream->srcpad,
+      GST_DEBUG_FUNCPTR (gst_vst_multi_audio_processor_src_query));
+  gst_pad_set_iterate_internal_links_function (stream->srcpad,
+      GST_DEBUG_FUNCPTR (gst_vst_multi_audio_processor_iterate_internal_links));
+  GST_PAD_SET_PROXY_CAPS (stream->srcpad);
+  gst_pad_use_fixed_caps (stream->srcpad);
+
+  self->streams = g_list_append(self->streams, stream);
+  g_mutex_unlock(&self->streams_lock);
+
+  // The sink pad is added first so that it is also released first
+  gst_element_add_pad(element, stream->sinkpad);
+  gst_element_add_pad(element, stream->srcpad);
+
+  GST_DEBUG_OBJECT(self, "Created stream %u", index);
+
+  return stream->sinkpad;
+}
+
+static void
+gst_vst_multi_audio_processor_release_pad(GstElement * element, GstPad * pad)
+{
+  auto self = GST_VST_MULTI_AUDIO_PROCESSOR(element);
+  auto stream = (GstVstMultiStream *) gst_pad_get_element_private(pad);
+
+  GST_DEBUG_OBJECT(self, "Releasing stream %u", stream->index);
+
+  g_mutex_lock(&self->streams_lock);
+  self->streams = g_list_remove(self->streams, stream);
+  g_mutex_unlock(&self->streams_lock);
+
+  // Deactivating waits for the streaming thread of the stream to be done
+  gst_pad_set_active(stream->sinkpad, FALSE);
+  gst_pad_set_active(stream->srcpad, FALSE);
+
+  g_mutex_lock(&self->streams_lock);
+  gst_vst_multi_audio_processor_close_stream(self, stream);
+  g_mutex_unlock(&self->streams_lock);
+
+  if (GST_OBJECT_PARENT(stream->srcpad) == GST_OBJECT_CAST(self))
+    gst_element_remove_pad(element, stream->srcpad);
+  gst_element_remove_pad(element, stream->sinkpad);
+
+  delete stream;
+}
+
+static GstStateChangeReturn
+gst_vst_multi_audio_processor_change_state(GstElement * element,
+    GstStateChange transition)
+{
+  auto self = GST_VST_MULTI_AUDIO_PROCESSOR(element);
+  auto state_ret = GST_STATE_CHANGE_SUCCESS;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_NULL_TO_READY:
+      g_mutex_lock(&self->streams_lock);
+      for (auto l = self->streams; l; l = l->next) {
+        auto stream = (GstVstMultiStream *) l->data;
+
+        gst_audio_info_init(&stream->info);
+        gst_segment_init(&stream->segment, GST_FORMAT_TIME);
+        if (!gst_vst_multi_audio_processor_open_stream(self, stream)) {
+          state_ret = GST_STATE_CHANGE_FAILURE;
+          break;
+        }
+      }
+      if (state_ret == GST_STATE_CHANGE_FAILURE) {
+        for (auto l = self->streams; l; l = l->next)
+          gst_vst_multi_audio_processor_close_stream(self, (GstVstMultiStream *) l->data);
+      } else {
+        self->opened = TRUE;
+      }
+      g_mutex_unlock(&self->streams_lock);
+      break;
+    default:
+      break;
+  }
+
+  if (state_ret == GST_STATE_CHANGE_FAILURE)
+    return state_ret;
+
+  state_ret = GST_ELEMENT_CLASS(parent_class)->change_state(element, transition);
+  if (state_ret == GST_STATE_CHANGE_FAILURE)
+    return state_ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      g_mutex_lock(&self->streams_lock);
+      for (auto l = self->streams; l; l = l->next) {
+        auto stream = (GstVstMultiStream *) l->data;
+
+        gst_vst_instance_deactivate(&stream->instance);
+        // Make sure the next caps set up processing again with any properties
+        // that were changed in READY
+        gst_audio_info_init(&stream->info);
+      }
+      g_mutex_unlock(&self->streams_lock);
+      break;
+    case GST_STATE_CHANGE_READY_TO_NULL:
+      g_mutex_lock(&self->streams_lock);
+      for (auto l = self->streams; l; l = l->next)
+        gst_vst_multi_audio_processor_close_stream(self, (GstVstMultiStream *) l->data);
+      self->opened = FALSE;
+      g_mutex_unlock(&self->streams_lock);
+      break;
+    default:
+      break;
+  }
+
+  return state_ret;
+}
+
+static GstIterator *
+gst_vst_multi_audio_processor_iterate_internal_links(GstPad * pad,
+    GstObject * parent)
+{
+  auto stream = (GstVstMultiStream *) gst_pad_get_element_private(pad);
+  auto otherpad = pad == stream->sinkpad ? stream->srcpad : stream->sinkpad;
+  GValue val = G_VALUE_INIT;
+
+  g_value_init(&val, GST_TYPE_PAD);
+  g_value_set_object(&val, otherpad);
+  auto it = gst_iterator_new_single(GST_TYPE_PAD, &val);
+  g_value_unset(&val);
+
+  return it;
+}
+
+// Processing of one input buffer of a stream, run on the thread pool
+typedef struct {
+  GstVstMultiStream *stream;
+
+  const guint8 *in_data;
+  guint8 *out_data;
+  guint n_samples;
+  gint64 sample_position;
+  gboolean input_silent;
+  Vst::ParameterChanges *parameter_changes;
+
+  Steinberg::tresult res;
+  guint n_out_samples;
+} GstVstMultiProcessJob;
+
+static void
+gst_vst_multi_audio_processor_process_job(gpointer user_data)
+{
+  auto job = (GstVstMultiProcessJob *) user_data;
+  auto instance = &job->stream->instance;
+  auto bpf = job->stream->info.bpf;
+  auto in_data = job->in_data;
+  auto out_data = job->out_data;
+  auto num_samples = job->n_samples;
+  auto sample_position = job->sample_position;
+  auto parameter_changes = job->parameter_changes;
+
+  job->res = kResultOk;
+  job->n_out_samples = 0;
+
+  while (num_samples > 0) {
+    auto chunk_size = MIN(instance->data_len, num_samples);
+    auto &out_parameter_changes = *gst_vst_instance_get_out_parameter_changes(instance);
+    guint n_out_samples = 0;
+
+    job->res = gst_vst_instance_process(instance, (gconstpointer) in_data,
+        (gpointer) out_data, chunk_size, sample_position, job->input_silent,
+        parameter_changes, &out_parameter_changes, &n_out_samples);
+    if (job->res != kResultOk)
+      break;
+
+    // Pending input parameter changes only apply to the first chunk
+    parameter_changes = nullptr;
+
+    // Let the edit controller know about any changes of the component. These
+    // are not exposed as properties as they differ between the streams
+    auto out_changes_count = out_parameter_changes.getParameterCount();
+    for (auto i = 0; i < out_changes_count; i++) {
+      auto queue = out_parameter_changes.getParameterData(i);
+      auto point_count = queue->getPointCount();
+      Vst::ParamValue value;
+      Steinberg::int32 sample_offset = 0;
+
+      if (point_count > 0 && queue->getPoint(point_count - 1, sample_offset, value) == kResultOk)
+        instance->edit_controller->setParamNormalized(queue->getParameterId(), value);
+    }
+
+    // FIXME: We assume that input length == output length, same as the
+    // single-stream element
+    job->n_out_samples += n_out_samples;
+    out_data += n_out_samples * bpf;
+
+    num_samples -= chunk_size;
+    in_data += chunk_size * bpf;
+    sample_position += chunk_size;
+  }
+}
+
+static GstFlowReturn
+gst_vst_multi_audio_processor_sink_chain(GstPad * pad, GstObject * parent,
+    GstBuffer * in_buffer)
+{
+  auto self = GST_VST_MULTI_AUDIO_PROCESSOR(parent);
+  auto stream = (GstVstMultiStream *) gst_pad_get_element_private(pad);
+
+  if (stream->instance.state < GST_VST_INSTANCE_STATE_SETUP) {
+    gst_buffer_unref(in_buffer);
+    GST_ERROR_OBJECT(pad, "Not negotiated yet");
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  if (!GST_BUFFER_PTS_IS_VALID (in_buffer)) {
+    GST_ERROR_OBJECT(pad, "Need buffers with valid timestamps");
+    gst_buffer_unref(in_buffer);
+    return GST_FLOW_ERROR;
+  }
+
+  if (GST_BUFFER_IS_DISCONT (in_buffer)) {
+    GST_DEBUG_OBJECT(pad, "Discontinuity, restarting component");
+    gst_vst_instance_deactivate(&stream->instance);
+  }
+
+  if (!gst_vst_instance_activate(&stream->instance)) {
+    gst_buffer_unref(in_buffer);
+    return GST_FLOW_ERROR;
+  }
+
+  // Controlled properties are shared by all streams, so this affects all of
+  // them from the next buffer on
+  auto stream_time = gst_segment_to_stream_time(&stream->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS(in_buffer));
+  gst_object_sync_values(GST_OBJECT_CAST(self), stream_time);
+
+  GstMapInfo in_map, out_map;
+  gst_buffer_map(in_buffer, &in_map, GST_MAP_READ);
+
+  auto num_samples = in_map.size / stream->info.bpf;
+  auto out_buffer = gst_buffer_new_and_alloc(num_samples * stream->info.bpf);
+  gst_buffer_map(out_buffer, &out_map, GST_MAP_WRITE);
+
+  GstVstMultiProcessJob job;
+  job.stream = stream;
+  job.in_data = in_map.data;
+  job.out_data = out_map.data;
+  job.n_samples = num_samples;
+  job.sample_position = (gint64) gst_util_uint64_scale(GST_BUFFER_PTS(in_buffer),
+      stream->info.rate, GST_SECOND);
+  job.input_silent = GST_BUFFER_FLAG_IS_SET(in_buffer, GST_BUFFER_FLAG_GAP);
+
+  GST_OBJECT_LOCK(self);
+  job.parameter_changes = stream->parameter_changes;
+  stream->parameter_changes = nullptr;
+  GST_OBJECT_UNLOCK(self);
+
+  // The plugin code runs on one of the workers of the shared pool, which
+  // bounds the number of threads processing at once to the number of cores
+  // independent of the number of streams
+  gst_vst_thread_pool_run(self->thread_pool,
+      gst_vst_multi_audio_processor_process_job, &job);
+
+  // We have to delete the pointer here, the processor does not do that
+  if (job.parameter_changes)
+    delete job.parameter_changes;
+
+  gst_buffer_unmap(out_buffer, &out_map);
+  gst_buffer_unmap(in_buffer, &in_map);
+
+  if (job.res != kResultOk) {
+    gst_buffer_unref(out_buffer);
+    gst_buffer_unref(in_buffer);
+    return GST_FLOW_ERROR;
+  }
+
+  if (job.n_out_samples == 0) {
+    gst_buffer_unref(out_buffer);
+    gst_buffer_unref(in_buffer);
+    return GST_FLOW_OK;
+  }
+
+  gst_buffer_set_size(out_buffer, job.n_out_samples * stream->info.bpf);
+  GST_BUFFER_PTS(out_buffer) = GST_BUFFER_PTS(in_buffer);
+  GST_BUFFER_DURATION(out_buffer) = gst_util_uint64_scale(job.n_out_samples,
+      GST_SECOND, stream->info.rate);
+  if (GST_BUFFER_IS_DISCONT(in_buffer))
+    GST_BUFFER_FLAG_SET(out_buffer, GST_BUFFER_FLAG_DISCONT);
+  gst_buffer_unref(in_buffer);
+
+  return gst_pad_push(stream->srcpad, out_buffer);
+}
+
+static gboolean
+gst_vst_multi_audio_processor_sink_event(GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  auto self = GST_VST_MULTI_AUDIO_PROCESSOR(parent);
+  auto stream = (GstVstMultiStream *) gst_pad_get_element_private(pad);
+  gboolean ret = FALSE;
+
+  switch (GST_EVENT_TYPE(event)) {
+    case GST_EVENT_CAPS:{
+      GstCaps *caps;
+      GstAudioInfo info;
+      gboolean changed;
+
+      gst_event_parse_caps(event, &caps);
+
+      ret = gst_audio_info_from_caps(&info, caps);
+      changed = ret && !gst_audio_info_is_equal(&info, &stream->info);
+      if (ret && changed) {
+        GST_DEBUG_OBJECT(pad, "Got caps %" GST_PTR_FORMAT, caps);
+
+        stream->info = info;
+
+        auto process_mode = gst_vst_process_mode_resolve(self->process_mode, pad);
+        GST_DEBUG_OBJECT(pad, "Using process mode %d", process_mode);
+
+        if (!gst_vst_instance_setup(&stream->instance, &info, process_mode,
+              self->max_samples_per_chunk)) {
+          gst_event_unref(event);
+          ret = FALSE;
+          break;
+        }
+
+        // Update latency
+        auto latency = gst_vst_instance_get_latency(&stream->instance);
+        if (latency != stream->latency) {
+          stream->latency = latency;
+          GST_DEBUG_OBJECT(pad, "Latency changed to %" GST_TIME_FORMAT, GST_TIME_ARGS(latency));
+          gst_element_post_message(GST_ELEMENT_CAST(self), gst_message_new_latency(GST_OBJECT_CAST(self)));
+        }
+      } else if (!ret) {
+        GST_ERROR_OBJECT(pad, "Invalid caps");
+      } else {
+        // Nothing changed
+        ret = TRUE;
+      }
+
+      if (ret)
+        ret = gst_pad_event_default(pad, parent, event);
+      else
+        gst_event_unref (event);
+
+      break;
+    }
+    case GST_EVENT_FLUSH_STOP:
+      gst_segment_init(&stream->segment, GST_FORMAT_TIME);
+      // Shut down component, it will be started again on next buffer
+      gst_vst_instance_deactivate(&stream->instance);
+      ret = gst_pad_event_default(pad, parent, event);
+      break;
+    case GST_EVENT_SEGMENT:
+      gst_event_copy_segment(event, &stream->segment);
+      if (stream->segment.format != GST_FORMAT_TIME) {
+        gst_event_unref(event);
+        ret = FALSE;
+      } else {
+        ret = gst_pad_event_default(pad, parent, event);
+      }
+      break;
+    default:
+      ret = gst_pad_event_default(pad, parent, event);
+      break;
+  }
+
+  return ret;
+}
+
+static gboolean
+gst_vst_multi_audio_processor_src_query(GstPad * pad,
+    GstObject * parent, GstQuery * query)
+{
+  auto stream = (GstVstMultiStream *) gst_pad_get_element_private(pad);
+  gboolean ret = FALSE;
+
+  switch (GST_QUERY_TYPE(query)) {
+    case GST_QUERY_LATENCY:{
+      if ((ret = gst_pad_peer_query(stream->sinkpad, query))) {
+        GstClockTime min, max;
+        gboolean live;
+
+        gst_query_parse_latency(query, &live, &min, &max);
+
+        min += stream->latency;
+        if (max != GST_CLOCK_TIME_NONE)
+          max += stream->latency;
+
+        GST_DEBUG_OBJECT(pad, "Calculated total latency : min %"
+            GST_TIME_FORMAT " max %" GST_TIME_FORMAT,
+            GST_TIME_ARGS(min), GST_TIME_ARGS(max));
+
+        gst_query_set_latency(query, live, min, max);
+      }
+
+      break;
+    }
+    default:
+      ret = gst_pad_query_default(pad, parent, query);
+      break;
+  }
+
+  return ret;
+}
+
+GType
+gst_vst_multi_audio_processor_register_subtype(const gchar * type_name,
+    const GstVstAudioProcessorInfo * processor_info)
+{
+  GTypeQuery type_query;
+
+  g_type_query(gst_vst_multi_audio_processor_get_type(), &type_query);
+
+  GTypeInfo type_info = { 0, };
+  type_info.class_size = type_query.class_size;
+  type_info.instance_size = type_query.instance_size;
+  type_info.class_init = (GClassInitFunc) gst_vst_multi_audio_processor_sub_class_init;
+
+  auto type = g_type_register_static(gst_vst_multi_audio_processor_get_type(), type_name, &type_info, (GTypeFlags) 0);
+  g_type_set_qdata(type, multi_audio_processor_info_quark, (gpointer) processor_info);
+
+  return type;
+}
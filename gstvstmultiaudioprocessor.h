@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gst/gst.h>
+
+#include "gstvstaudioprocessor.h"
+
+#ifndef __GST_VST_MULTI_AUDIO_PROCESSOR_H__
+#define __GST_VST_MULTI_AUDIO_PROCESSOR_H__
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_VST_MULTI_AUDIO_PROCESSOR \
+  (gst_vst_multi_audio_processor_get_type())
+#define GST_VST_MULTI_AUDIO_PROCESSOR(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_VST_MULTI_AUDIO_PROCESSOR, GstVstMultiAudioProcessor))
+#define GST_VST_MULTI_AUDIO_PROCESSOR_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GST_TYPE_VST_MULTI_AUDIO_PROCESSOR, GstVstMultiAudioProcessorClass))
+#define GST_VST_MULTI_AUDIO_PROCESSOR_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS((obj),GST_TYPE_VST_MULTI_AUDIO_PROCESSOR,GstVstMultiAudioProcessorClass))
+#define GST_IS_VST_MULTI_AUDIO_PROCESSOR(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_VST_MULTI_AUDIO_PROCESSOR))
+#define GST_IS_VST_MULTI_AUDIO_PROCESSOR_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_VST_MULTI_AUDIO_PROCESSOR))
+
+typedef struct _GstVstMultiAudioProcessor GstVstMultiAudioProcessor;
+typedef struct _GstVstMultiAudioProcessorClass GstVstMultiAudioProcessorClass;
+
+GType gst_vst_multi_audio_processor_get_type(void);
+
+GType gst_vst_multi_audio_processor_register_subtype(const gchar * type_name,
+    const GstVstAudioProcessorInfo * processor_info);
+
+G_END_DECLS
+
+#endif /* __GST_VST_MULTI_AUDIO_PROCESSOR_H__ */
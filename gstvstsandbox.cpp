@@ -0,0 +1,644 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "gstvstsandbox.h"
+#include "gstvstinstance.h"
+
+#include <string.h>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+
+GST_DEBUG_CATEGORY_EXTERN(gst_vst_audio_processor_debug);
+#define GST_CAT_DEFAULT gst_vst_audio_processor_debug
+
+using namespace Steinberg;
+
+#ifndef GST_VST_SANDBOX_HELPER
+#define GST_VST_SANDBOX_HELPER "gst-vst3-sandbox"
+#endif
+
+// Milliseconds after which the helper is considered hung. Opening and
+// setting up the plugin can take long, while process() gets a multiple of
+// the duration of the chunk, with a lot more headroom when processing offline
+#define COMMAND_TIMEOUT (60 * 1000)
+#define PROCESS_TIMEOUT_MIN (1000)
+#define PROCESS_TIMEOUT_FACTOR_REALTIME (10)
+#define PROCESS_TIMEOUT_FACTOR_OFFLINE (1000)
+
+gsize
+gst_vst_sandbox_data_offset(void)
+{
+  return (sizeof(GstVstSandboxHeader) + GST_VST_INSTANCE_ALIGNMENT - 1)
+      & ~((gsize) GST_VST_INSTANCE_ALIGNMENT - 1);
+}
+
+// Size of one interleaved audio area in the data area. Output follows input
+gsize
+gst_vst_sandbox_audio_size(gint bpf, gint max_samples)
+{
+  return ((gsize) bpf * max_samples + GST_VST_INSTANCE_ALIGNMENT - 1)
+      & ~((gsize) GST_VST_INSTANCE_ALIGNMENT - 1);
+}
+
+// Flattens all points of all parameter queues into points and returns how
+// many were written
+guint
+gst_vst_sandbox_write_parameter_changes(GstVstSandboxParameterPoint * points,
+    Vst::IParameterChanges * parameter_changes)
+{
+  guint n_points = 0;
+
+  for (auto i = 0; i < parameter_changes->getParameterCount(); i++) {
+    auto queue = parameter_changes->getParameterData(i);
+    if (!queue)
+      continue;
+
+    for (auto j = 0; j < queue->getPointCount(); j++) {
+      int32 offset;
+      Vst::ParamValue value;
+
+      if (queue->getPoint(j, offset, value) != kResultOk)
+        continue;
+
+      if (n_points == GST_VST_SANDBOX_MAX_PARAMETER_POINTS) {
+        GST_WARNING("Too many parameter changes, dropping the remaining ones");
+        return n_points;
+      }
+
+      points[n_points].id = queue->getParameterId();
+      points[n_points].offset = offset;
+      points[n_points].value = value;
+      n_points++;
+    }
+  }
+
+  return n_points;
+}
+
+void
+gst_vst_sandbox_read_parameter_changes(const GstVstSandboxParameterPoint * points,
+    guint n_points, Vst::IParameterChanges * parameter_changes)
+{
+  for (auto i = 0U; i < n_points; i++) {
+    int32 idx = 0;
+    auto queue = parameter_changes->addParameterData(points[i].id, idx);
+
+    if (queue)
+      queue->addPoint(points[i].offset, points[i].value, idx);
+  }
+}
+
+#if defined(__linux__)
+
+struct _GstVstSandbox {
+  // Used for logging and posting messages, not owned
+  GstElement *element;
+  const GstVstAudioProcessorInfo *processor_info;
+
+  pid_t pid;
+  int shm_fd;
+  // Signalled by us for every command, and by the helper once it is done
+  int request_fd;
+  int response_fd;
+  // Read end of a pipe whose write end is only held by the helper, so that
+  // it hangs up once the helper exited for whatever reason
+  int alive_fd;
+
+  GstVstSandboxHeader *header;
+  gsize size;
+  gint bpf;
+  gint rate;
+  gint max_samples;
+  Vst::ProcessModes process_mode;
+
+  gboolean dead;
+  guint32 latency_samples;
+
+  // Serializes commands, e.g. getting the state from the application while
+  // the streaming thread processes
+  GMutex lock;
+};
+
+static void
+gst_vst_sandbox_reap(GstVstSandbox * sandbox)
+{
+  int status;
+
+  if (sandbox->pid <= 0)
+    return;
+
+  kill(sandbox->pid, SIGKILL);
+  while (waitpid(sandbox->pid, &status, 0) < 0 && errno == EINTR);
+  sandbox->pid = 0;
+}
+
+// Runs command in the helper and waits up to timeout milliseconds until it
+// is done. Returns FALSE if the helper died or hung, in which case it is
+// killed and all further calls fail immediately
+static gboolean
+gst_vst_sandbox_call(GstVstSandbox * sandbox, GstVstSandboxCommand command,
+    gint timeout)
+{
+  guint64 value = 1;
+  auto deadline = g_get_monotonic_time() + (gint64) timeout * G_TIME_SPAN_MILLISECOND;
+  auto hung = FALSE;
+
+  if (sandbox->dead)
+    return FALSE;
+
+  sandbox->header->command = command;
+  sandbox->header->result = kResultFalse;
+
+  if (write(sandbox->request_fd, &value, sizeof(value)) == sizeof(value)) {
+    struct pollfd fds[2];
+
+    fds[0].fd = sandbox->response_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = sandbox->alive_fd;
+    fds[1].events = POLLIN;
+
+    while (TRUE) {
+      auto remaining = deadline - g_get_monotonic_time();
+      auto n = remaining > 0 ? poll(fds, 2, (int) ((remaining + 999) / G_TIME_SPAN_MILLISECOND)) : 0;
+
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        break;
+      if (n == 0) {
+        hung = TRUE;
+        break;
+      }
+
+      // A response that was written right before exiting is still valid
+      if ((fds[0].revents & POLLIN) && read(sandbox->response_fd, &value, sizeof(value)) == sizeof(value))
+        return TRUE;
+      if (fds[1].revents)
+        break;
+    }
+  }
+
+  if (hung)
+    GST_ERROR_OBJECT(sandbox->element, "Sandbox for '%s' did not respond within %d ms",
+        sandbox->processor_info->name, timeout);
+  else
+    GST_ERROR_OBJECT(sandbox->element, "Sandbox for '%s' died", sandbox->processor_info->name);
+  sandbox->dead = TRUE;
+  gst_vst_sandbox_reap(sandbox);
+
+  return FALSE;
+}
+
+// (Re)maps the shared memory with size bytes. On failure the sandbox can't be
+// used anymore
+static gboolean
+gst_vst_sandbox_map(GstVstSandbox * sandbox, gsize size)
+{
+  if (sandbox->header)
+    munmap(sandbox->header, sandbox->size);
+  sandbox->header = nullptr;
+  sandbox->size = 0;
+  sandbox->dead = TRUE;
+
+  if (ftruncate(sandbox->shm_fd, size) != 0) {
+    GST_ERROR_OBJECT(sandbox->element, "Failed to resize shared memory: %s", g_strerror(errno));
+    return FALSE;
+  }
+
+  auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, sandbox->shm_fd, 0);
+  if (p == MAP_FAILED) {
+    GST_ERROR_OBJECT(sandbox->element, "Failed to map shared memory: %s", g_strerror(errno));
+    return FALSE;
+  }
+
+  sandbox->header = (GstVstSandboxHeader *) p;
+  sandbox->size = size;
+  sandbox->header->size = size;
+  sandbox->dead = FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+gst_vst_sandbox_spawn(GstVstSandbox * sandbox, guint64 memory_limit)
+{
+  auto helper = g_getenv("GST_VST3_SANDBOX_HELPER");
+  int alive[2];
+
+  if (!helper)
+    helper = GST_VST_SANDBOX_HELPER;
+
+  if (pipe2(alive, O_CLOEXEC) != 0) {
+    GST_ERROR_OBJECT(sandbox->element, "Failed to create pipe: %s", g_strerror(errno));
+    return FALSE;
+  }
+
+  // Everything needs to be prepared before forking, only async-signal-safe
+  // functions can be used in the child
+  auto class_id = sandbox->processor_info->class_id.toString();
+  gchar *argv[] = {
+    g_strdup(helper),
+    g_strdup_printf("%d", sandbox->shm_fd),
+    g_strdup_printf("%d", sandbox->request_fd),
+    g_strdup_printf("%d", sandbox->response_fd),
+    g_strdup_printf("%d", alive[1]),
+    g_strdup_printf("%" G_GUINT64_FORMAT, memory_limit),
+    g_strdup(sandbox->processor_info->path),
+    g_strdup(class_id.c_str()),
+    g_strdup(sandbox->processor_info->name),
+    nullptr
+  };
+  int inherited_fds[] = { sandbox->shm_fd, sandbox->request_fd, sandbox->response_fd, alive[1] };
+
+  auto pid = fork();
+  if (pid == 0) {
+    // The helper exits by itself once we close our end of the alive pipe,
+    // also if we crash. A parent death signal would be tied to the thread
+    // that forks, which e.g. for async-open exits right after opening
+    for (auto fd : inherited_fds)
+      fcntl(fd, F_SETFD, 0);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+
+  close(alive[1]);
+  for (auto arg = argv; *arg; arg++)
+    g_free(*arg);
+
+  if (pid < 0) {
+    GST_ERROR_OBJECT(sandbox->element, "Failed to start sandbox: %s", g_strerror(errno));
+    close(alive[0]);
+    return FALSE;
+  }
+
+  GST_DEBUG_OBJECT(sandbox->element, "Started sandbox %s with pid %d", helper, (int) pid);
+
+  sandbox->pid = pid;
+  sandbox->alive_fd = alive[0];
+
+  return TRUE;
+}
+
+// Starts a helper process and creates the component of the plugin class
+// there. memory_limit is the maximum address space of the helper in bytes,
+// or 0 for no limit
+GstVstSandbox *
+gst_vst_sandbox_new(GstElement * element,
+    const GstVstAudioProcessorInfo * processor_info, guint64 memory_limit)
+{
+  auto sandbox = g_new0(GstVstSandbox, 1);
+
+  sandbox->element = element;
+  sandbox->processor_info = processor_info;
+  sandbox->alive_fd = -1;
+  g_mutex_init(&sandbox->lock);
+  sandbox->shm_fd = memfd_create("gst-vst3-sandbox", MFD_CLOEXEC);
+  sandbox->request_fd = eventfd(0, EFD_CLOEXEC);
+  sandbox->response_fd = eventfd(0, EFD_CLOEXEC);
+
+  if (sandbox->shm_fd < 0 || sandbox->request_fd < 0 || sandbox->response_fd < 0) {
+    GST_ERROR_OBJECT(element, "Failed to create sandbox resources: %s", g_strerror(errno));
+    gst_vst_sandbox_free(sandbox);
+    return nullptr;
+  }
+
+  if (!gst_vst_sandbox_map(sandbox, gst_vst_sandbox_data_offset() + GST_VST_SANDBOX_DEFAULT_DATA_SIZE)
+      || !gst_vst_sandbox_spawn(sandbox, memory_limit)) {
+    gst_vst_sandbox_free(sandbox);
+    return nullptr;
+  }
+
+  if (!gst_vst_sandbox_call(sandbox, GST_VST_SANDBOX_COMMAND_OPEN, COMMAND_TIMEOUT)
+      || sandbox->header->result != kResultOk) {
+    GST_ERROR_OBJECT(element, "Failed to create '%s' in sandbox", processor_info->name);
+    gst_vst_sandbox_free(sandbox);
+    return nullptr;
+  }
+
+  return sandbox;
+}
+
+void
+gst_vst_sandbox_free(GstVstSandbox * sandbox)
+{
+  if (sandbox->pid > 0) {
+    gst_vst_sandbox_call(sandbox, GST_VST_SANDBOX_COMMAND_CLOSE, COMMAND_TIMEOUT);
+    gst_vst_sandbox_reap(sandbox);
+  }
+
+  if (sandbox->header)
+    munmap(sandbox->header, sandbox->size);
+  for (auto fd : { sandbox->shm_fd, sandbox->request_fd, sandbox->response_fd, sandbox->alive_fd }) {
+    if (fd >= 0)
+      close(fd);
+  }
+
+  g_mutex_clear(&sandbox->lock);
+  g_free(sandbox);
+}
+
+// Class ID of the edit controller, which is always created in our process
+gboolean
+gst_vst_sandbox_get_controller_class_id(GstVstSandbox * sandbox, TUID class_id)
+{
+  if (sandbox->dead)
+    return FALSE;
+
+  memcpy(class_id, sandbox->header->controller_class_id, sizeof(TUID));
+
+  return TRUE;
+}
+
+// Writes the current component state to stream
+gboolean
+gst_vst_sandbox_get_state(GstVstSandbox * sandbox, IBStream * stream)
+{
+  g_mutex_lock(&sandbox->lock);
+  if (!gst_vst_sandbox_call(sandbox, GST_VST_SANDBOX_COMMAND_GET_STATE, COMMAND_TIMEOUT)
+      || sandbox->header->result != kResultOk) {
+    g_mutex_unlock(&sandbox->lock);
+    return FALSE;
+  }
+
+  // Never trust the helper with sizes
+  auto size = sandbox->header->state_size;
+  if (size > sandbox->size - gst_vst_sandbox_data_offset() || size > G_MAXINT32) {
+    GST_ERROR_OBJECT(sandbox->element, "Invalid component state size %" G_GUINT64_FORMAT,
+        size);
+    g_mutex_unlock(&sandbox->lock);
+    return FALSE;
+  }
+
+  auto data = (guint8 *) sandbox->header + gst_vst_sandbox_data_offset();
+  auto res = stream->write(data, (int32) size, nullptr);
+  g_mutex_unlock(&sandbox->lock);
+
+  return res == kResultOk;
+}
+
+// Restores a component state as returned by gst_vst_sandbox_get_state()
+gboolean
+gst_vst_sandbox_set_state(GstVstSandbox * sandbox, gconstpointer data, gsize size)
+{
+  auto offset = gst_vst_sandbox_data_offset();
+
+  g_mutex_lock(&sandbox->lock);
+  // Grow the shared memory if needed, the helper maps it again on demand
+  if (sandbox->dead
+      || (size > sandbox->size - offset && !gst_vst_sandbox_map(sandbox, offset + size))) {
+    g_mutex_unlock(&sandbox->lock);
+    return FALSE;
+  }
+
+  memcpy((guint8 *) sandbox->header + offset, data, size);
+  sandbox->header->state_size = size;
+
+  auto res = gst_vst_sandbox_call(sandbox, GST_VST_SANDBOX_COMMAND_SET_STATE, COMMAND_TIMEOUT)
+      && sandbox->header->result == kResultOk;
+  g_mutex_unlock(&sandbox->lock);
+
+  return res;
+}
+
+gboolean
+gst_vst_sandbox_setup(GstVstSandbox * sandbox, const GstAudioInfo * info,
+    Vst::ProcessModes process_mode, gint max_samples_per_chunk)
+{
+  auto size = gst_vst_sandbox_data_offset() + 2 * gst_vst_sandbox_audio_size(info->bpf, max_samples_per_chunk);
+
+  g_mutex_lock(&sandbox->lock);
+  // The helper maps the new size when handling the command
+  if (sandbox->dead || (size > sandbox->size && !gst_vst_sandbox_map(sandbox, size))) {
+    g_mutex_unlock(&sandbox->lock);
+    return FALSE;
+  }
+
+  auto header = sandbox->header;
+  header->format = GST_AUDIO_INFO_FORMAT(info);
+  header->rate = info->rate;
+  header->channels = info->channels;
+  header->process_mode = process_mode;
+  header->max_samples = max_samples_per_chunk;
+
+  if (!gst_vst_sandbox_call(sandbox, GST_VST_SANDBOX_COMMAND_SETUP, COMMAND_TIMEOUT)
+      || header->result != kResultOk) {
+    g_mutex_unlock(&sandbox->lock);
+    GST_ERROR_OBJECT(sandbox->element, "Failed to setup processing in sandbox");
+    return FALSE;
+  }
+
+  sandbox->bpf = info->bpf;
+  sandbox->rate = info->rate;
+  sandbox->max_samples = max_samples_per_chunk;
+  sandbox->process_mode = process_mode;
+  sandbox->latency_samples = header->latency_samples;
+  g_mutex_unlock(&sandbox->lock);
+
+  return TRUE;
+}
+
+gboolean
+gst_vst_sandbox_activate(GstVstSandbox * sandbox)
+{
+  g_mutex_lock(&sandbox->lock);
+  auto res = gst_vst_sandbox_call(sandbox, GST_VST_SANDBOX_COMMAND_ACTIVATE, COMMAND_TIMEOUT)
+      && sandbox->header->result == kResultOk;
+  g_mutex_unlock(&sandbox->lock);
+
+  return res;
+}
+
+void
+gst_vst_sandbox_deactivate(GstVstSandbox * sandbox)
+{
+  g_mutex_lock(&sandbox->lock);
+  gst_vst_sandbox_call(sandbox, GST_VST_SANDBOX_COMMAND_DEACTIVATE, COMMAND_TIMEOUT);
+  g_mutex_unlock(&sandbox->lock);
+}
+
+guint32
+gst_vst_sandbox_get_latency_samples(GstVstSandbox * sandbox)
+{
+  return sandbox->latency_samples;
+}
+
+guint32
+gst_vst_sandbox_get_tail_samples(GstVstSandbox * sandbox)
+{
+  return sandbox->dead ? 0 : sandbox->header->tail_samples;
+}
+
+// Same as gst_vst_instance_process(), but the plugin processes the audio in
+// the helper process
+tresult
+gst_vst_sandbox_process(GstVstSandbox * sandbox,
+    gconstpointer in_data, gpointer out_data, guint n_samples,
+    gint64 sample_position, gboolean input_silent, gboolean flush_denormals,
+    Vst::IParameterChanges * in_parameter_changes,
+    Vst::IParameterChanges * out_parameter_changes,
+    guint * n_out_samples)
+{
+  g_assert(n_samples <= (guint) sandbox->max_samples);
+
+  *n_out_samples = 0;
+
+  g_mutex_lock(&sandbox->lock);
+  if (sandbox->dead) {
+    g_mutex_unlock(&sandbox->lock);
+    return kInternalError;
+  }
+
+  auto header = sandbox->header;
+  auto data = (guint8 *) header + gst_vst_sandbox_data_offset();
+
+  memcpy(data, in_data, (gsize) n_samples * sandbox->bpf);
+  header->n_samples = n_samples;
+  header->sample_position = sample_position;
+  header->input_silent = input_silent;
+  header->flush_denormals = flush_denormals;
+  header->n_in_points = in_parameter_changes ?
+      gst_vst_sandbox_write_parameter_changes(header->in_points, in_parameter_changes) : 0;
+
+  auto factor = sandbox->process_mode == Vst::kOffline ?
+      PROCESS_TIMEOUT_FACTOR_OFFLINE : PROCESS_TIMEOUT_FACTOR_REALTIME;
+  auto timeout = MAX(gst_util_uint64_scale_int(n_samples, 1000 * factor, sandbox->rate),
+      (guint64) PROCESS_TIMEOUT_MIN);
+  if (!gst_vst_sandbox_call(sandbox, GST_VST_SANDBOX_COMMAND_PROCESS, (gint) MIN(timeout, (guint64) G_MAXINT))) {
+    g_mutex_unlock(&sandbox->lock);
+    return kInternalError;
+  }
+
+  if (header->result == kResultOk) {
+    // Never trust the helper with sizes
+    auto n = MIN(header->n_out_samples, n_samples);
+
+    memcpy(out_data, data + gst_vst_sandbox_audio_size(sandbox->bpf, sandbox->max_samples),
+        (gsize) n * sandbox->bpf);
+    *n_out_samples = n;
+  }
+
+  if (out_parameter_changes)
+    gst_vst_sandbox_read_parameter_changes(header->out_points,
+        MIN(header->n_out_points, GST_VST_SANDBOX_MAX_PARAMETER_POINTS), out_parameter_changes);
+
+  // restartComponent() of the component can't reach us from the helper
+  auto latency_changed = header->latency_samples != sandbox->latency_samples;
+  sandbox->latency_samples = header->latency_samples;
+  auto res = header->result;
+  g_mutex_unlock(&sandbox->lock);
+
+  if (latency_changed)
+    gst_element_post_message(sandbox->element,
+        gst_message_new_latency(GST_OBJECT_CAST(sandbox->element)));
+
+  return res;
+}
+
+#else
+
+struct _GstVstSandbox {
+  guint32 latency_samples;
+};
+
+GstVstSandbox *
+gst_vst_sandbox_new(GstElement * element,
+    const GstVstAudioProcessorInfo * processor_info, guint64 memory_limit)
+{
+  GST_ERROR_OBJECT(element, "Sandboxing is not supported on this platform");
+
+  return nullptr;
+}
+
+void
+gst_vst_sandbox_free(GstVstSandbox * sandbox)
+{
+  g_free(sandbox);
+}
+
+gboolean
+gst_vst_sandbox_get_controller_class_id(GstVstSandbox * sandbox, TUID class_id)
+{
+  return FALSE;
+}
+
+gboolean
+gst_vst_sandbox_get_state(GstVstSandbox * sandbox, IBStream * stream)
+{
+  return FALSE;
+}
+
+gboolean
+gst_vst_sandbox_set_state(GstVstSandbox * sandbox, gconstpointer data, gsize size)
+{
+  return FALSE;
+}
+
+gboolean
+gst_vst_sandbox_setup(GstVstSandbox * sandbox, const GstAudioInfo * info,
+    Vst::ProcessModes process_mode, gint max_samples_per_chunk)
+{
+  return FALSE;
+}
+
+gboolean
+gst_vst_sandbox_activate(GstVstSandbox * sandbox)
+{
+  return FALSE;
+}
+
+void
+gst_vst_sandbox_deactivate(GstVstSandbox * sandbox)
+{
+}
+
+guint32
+gst_vst_sandbox_get_latency_samples(GstVstSandbox * sandbox)
+{
+  return 0;
+}
+
+guint32
+gst_vst_sandbox_get_tail_samples(GstVstSandbox * sandbox)
+{
+  return 0;
+}
+
+tresult
+gst_vst_sandbox_process(GstVstSandbox * sandbox,
+    gconstpointer in_data, gpointer out_data, guint n_samples,
+    gint64 sample_position, gboolean input_silent, gboolean flush_denormals,
+    Vst::IParameterChanges * in_parameter_changes,
+    Vst::IParameterChanges * out_parameter_changes,
+    guint * n_out_samples)
+{
+  *n_out_samples = 0;
+
+  return kNotImplemented;
+}
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+#include <vst/hosting/module.h>
+#include <pluginterfaces/base/ibstream.h>
+#include <pluginterfaces/vst/ivstaudioprocessor.h>
+
+#include "gstvstaudioprocessor.h"
+
+#ifndef __GST_VST_SANDBOX_H__
+#define __GST_VST_SANDBOX_H__
+
+// Component and audio processor of a plugin running in a separate helper
+// process. Audio and parameter changes are exchanged through a shared memory
+// block, one command at a time, and each side wakes up the other via an
+// eventfd. If the helper crashes or runs out of memory, all further calls
+// fail instead of taking down the calling process.
+//
+// Only supported on Linux. The helper executable can be overridden with the
+// GST_VST3_SANDBOX_HELPER environment variable
+typedef struct _GstVstSandbox GstVstSandbox;
+
+// Everything below is shared between the element and the helper process
+
+typedef enum {
+  GST_VST_SANDBOX_COMMAND_NONE = 0,
+  GST_VST_SANDBOX_COMMAND_OPEN,
+  GST_VST_SANDBOX_COMMAND_GET_STATE,
+  GST_VST_SANDBOX_COMMAND_SET_STATE,
+  GST_VST_SANDBOX_COMMAND_SETUP,
+  GST_VST_SANDBOX_COMMAND_ACTIVATE,
+  GST_VST_SANDBOX_COMMAND_DEACTIVATE,
+  GST_VST_SANDBOX_COMMAND_PROCESS,
+  GST_VST_SANDBOX_COMMAND_CLOSE,
+} GstVstSandboxCommand;
+
+#define GST_VST_SANDBOX_MAX_PARAMETER_POINTS (4096)
+// Space for the component state before the first setup
+#define GST_VST_SANDBOX_DEFAULT_DATA_SIZE (1024 * 1024)
+
+typedef struct {
+  Steinberg::Vst::ParamID id;
+  gint32 offset;
+  gdouble value;
+} GstVstSandboxParameterPoint;
+
+// Start of the shared memory block. The data area follows, aligned to
+// GST_VST_INSTANCE_ALIGNMENT bytes: the component state for GET_STATE and
+// SET_STATE, or
+// interleaved input and output audio for PROCESS
+typedef struct {
+  guint32 command;
+  gint32 result;
+  // Total size of the shared memory block, changed by SETUP
+  guint64 size;
+
+  // OPEN
+  Steinberg::TUID controller_class_id;
+
+  // SETUP
+  gint32 format;
+  gint32 rate;
+  gint32 channels;
+  gint32 process_mode;
+  gint32 max_samples;
+
+  // PROCESS
+  guint32 n_samples;
+  gint64 sample_position;
+  gint32 input_silent;
+  gint32 flush_denormals;
+  guint32 n_out_samples;
+  guint32 n_in_points;
+  guint32 n_out_points;
+  GstVstSandboxParameterPoint in_points[GST_VST_SANDBOX_MAX_PARAMETER_POINTS];
+  GstVstSandboxParameterPoint out_points[GST_VST_SANDBOX_MAX_PARAMETER_POINTS];
+
+  // GET_STATE and SET_STATE
+  guint64 state_size;
+
+  // Returned by every command after SETUP
+  guint32 latency_samples;
+  guint32 tail_samples;
+} GstVstSandboxHeader;
+
+gsize gst_vst_sandbox_data_offset(void);
+gsize gst_vst_sandbox_audio_size(gint bpf, gint max_samples);
+
+guint gst_vst_sandbox_write_parameter_changes(GstVstSandboxParameterPoint * points,
+    Steinberg::Vst::IParameterChanges * parameter_changes);
+void gst_vst_sandbox_read_parameter_changes(const GstVstSandboxParameterPoint * points,
+    guint n_points, Steinberg::Vst::IParameterChanges * parameter_changes);
+
+// Used by the element
+
+GstVstSandbox * gst_vst_sandbox_new(GstElement * element,
+    const GstVstAudioProcessorInfo * processor_info, guint64 memory_limit);
+void gst_vst_sandbox_free(GstVstSandbox * sandbox);
+
+gboolean gst_vst_sandbox_get_controller_class_id(GstVstSandbox * sandbox,
+    Steinberg::TUID class_id);
+gboolean gst_vst_sandbox_get_state(GstVstSandbox * sandbox, Steinberg::IBStream * stream);
+gboolean gst_vst_sandbox_set_state(GstVstSandbox * sandbox, gconstpointer data, gsize size);
+
+gboolean gst_vst_sandbox_setup(GstVstSandbox * sandbox, const GstAudioInfo * info,
+    Steinberg::Vst::ProcessModes process_mode, gint max_samples_per_chunk);
+gboolean gst_vst_sandbox_activate(GstVstSandbox * sandbox);
+void gst_vst_sandbox_deactivate(GstVstSandbox * sandbox);
+
+guint32 gst_vst_sandbox_get_latency_samples(GstVstSandbox * sandbox);
+guint32 gst_vst_sandbox_get_tail_samples(GstVstSandbox * sandbox);
+
+Steinberg::tresult gst_vst_sandbox_process(GstVstSandbox * sandbox,
+    gconstpointer in_data, gpointer out_data, guint n_samples,
+    gint64 sample_position, gboolean input_silent, gboolean flush_denormals,
+    Steinberg::Vst::IParameterChanges * in_parameter_changes,
+    Steinberg::Vst::IParameterChanges * out_parameter_changes,
+    guint * n_out_samples);
+
+#endif /* __GST_VST_SANDBOX_H__ */
@@ -0,0 +1,463 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "gstvstscheduler.h"
+#include "gstvsttracer.h"
+
+#include <stdlib.h>
+
+#if defined(G_OS_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+GST_DEBUG_CATEGORY_EXTERN(gst_vst_audio_processor_debug);
+#define GST_CAT_DEFAULT gst_vst_audio_processor_debug
+
+#define DEFAULT_BUDGET (0.75)
+#define RT_PRIORITY (10)
+// Weight of the newest measurement in the per-client load average
+#define LOAD_SMOOTHING (0.1)
+// Load that is assumed for a plugin class that was never measured before
+#define DEFAULT_CLASS_LOAD (0.25)
+
+// The workers run with real-time priority while the streaming threads that
+// submit tasks usually don't, so the lock they share has to boost its holder
+// to avoid priority inversion. Windows has no priority inheriting locks, but
+// boosts threads that starve while holding one
+#if defined(G_OS_WIN32)
+typedef GMutex SchedulerMutex;
+typedef GCond SchedulerCond;
+#else
+typedef pthread_mutex_t SchedulerMutex;
+typedef pthread_cond_t SchedulerCond;
+#endif
+
+static void
+scheduler_mutex_init(SchedulerMutex * mutex)
+{
+#if defined(G_OS_WIN32)
+  g_mutex_init(mutex);
+#else
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init(&attr);
+  if (pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT) != 0)
+    GST_WARNING("Priority inheritance is not supported");
+  pthread_mutex_init(mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+#endif
+}
+
+static void
+scheduler_mutex_lock(SchedulerMutex * mutex)
+{
+#if defined(G_OS_WIN32)
+  g_mutex_lock(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif
+}
+
+static void
+scheduler_mutex_unlock(SchedulerMutex * mutex)
+{
+#if defined(G_OS_WIN32)
+  g_mutex_unlock(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif
+}
+
+static void
+scheduler_cond_init(SchedulerCond * cond)
+{
+#if defined(G_OS_WIN32)
+  g_cond_init(cond);
+#else
+  pthread_cond_init(cond, nullptr);
+#endif
+}
+
+static void
+scheduler_cond_clear(SchedulerCond * cond)
+{
+#if defined(G_OS_WIN32)
+  g_cond_clear(cond);
+#else
+  pthread_cond_destroy(cond);
+#endif
+}
+
+static void
+scheduler_cond_signal(SchedulerCond * cond)
+{
+#if defined(G_OS_WIN32)
+  g_cond_signal(cond);
+#else
+  pthread_cond_signal(cond);
+#endif
+}
+
+static void
+scheduler_cond_wait(SchedulerCond * cond, SchedulerMutex * mutex)
+{
+#if defined(G_OS_WIN32)
+  g_cond_wait(cond, mutex);
+#else
+  pthread_cond_wait(cond, mutex);
+#endif
+}
+
+typedef struct {
+  GstVstSchedulerClient *client;
+  GstVstSchedulerFunc func;
+  gpointer user_data;
+
+  // Monotonic time until which the task has to be finished, and the
+  // duration of audio it processes
+  GstClockTime deadline;
+  GstClockTime duration;
+
+  SchedulerCond cond;
+  gboolean done;
+} Task;
+
+struct _GstVstScheduler {
+  guint n_workers;
+  GThread **workers;
+  // Fraction of the capacity of each worker that may be used
+  gdouble budget;
+
+  SchedulerMutex lock;
+  SchedulerCond cond;
+  // Pending tasks, sorted by deadline
+  GQueue tasks;
+  GList *clients;
+  // Highest load measured so far for each plugin class name
+  GHashTable *class_loads;
+};
+
+struct _GstVstSchedulerClient {
+  GstVstScheduler *scheduler;
+  // Only used for logging, not owned
+  GstObject *owner;
+  gchar *class_name;
+
+  // Protected by scheduler lock
+  // Average CPU time per time of processed audio
+  gdouble load;
+  GstClockTime cpu_time;
+  guint64 n_tasks;
+  guint64 n_late;
+};
+
+static GstClockTime
+get_monotonic_time(void)
+{
+  return g_get_monotonic_time() * GST_USECOND;
+}
+
+// Pins the calling worker to one core and asks for real-time scheduling.
+// This usually needs special privileges, so failing is not fatal
+static void
+setup_worker_thread(guint index)
+{
+  auto n_cpus = MAX(g_get_num_processors(), 1);
+
+#if defined(G_OS_WIN32)
+  if (n_cpus <= 8 * sizeof(DWORD_PTR) &&
+      !SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR) 1) << (index % n_cpus)))
+    GST_DEBUG("Failed to pin worker %u: %lu", index, GetLastError());
+  if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+    GST_DEBUG("Failed to set priority of worker %u: %lu", index, GetLastError());
+#else
+#if defined(__linux__)
+  cpu_set_t cpu_set;
+
+  CPU_ZERO(&cpu_set);
+  CPU_SET(index % n_cpus, &cpu_set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0)
+    GST_DEBUG("Failed to pin worker %u", index);
+#endif
+
+  struct sched_param param;
+
+  param.sched_priority = RT_PRIORITY;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+    GST_WARNING("Failed to set real-time priority for worker %u", index);
+#endif
+}
+
+static gpointer
+worker_thread(gpointer data)
+{
+  auto scheduler = gst_vst_scheduler_get_default();
+
+  setup_worker_thread(GPOINTER_TO_UINT(data));
+
+  scheduler_mutex_lock(&scheduler->lock);
+  while (TRUE) {
+    while (g_queue_is_empty(&scheduler->tasks))
+      scheduler_cond_wait(&scheduler->cond, &scheduler->lock);
+
+    auto task = (Task *) g_queue_pop_head(&scheduler->tasks);
+    scheduler_mutex_unlock(&scheduler->lock);
+
+    auto start_cpu_time = gst_vst_get_thread_cpu_time();
+    task->func(task->user_data);
+    auto end_cpu_time = gst_vst_get_thread_cpu_time();
+    auto end_time = get_monotonic_time();
+
+    scheduler_mutex_lock(&scheduler->lock);
+    auto client = task->client;
+
+    client->n_tasks++;
+    if (end_time > task->deadline) {
+      client->n_late++;
+      GST_DEBUG_OBJECT(client->owner, "Task finished %" GST_TIME_FORMAT " late",
+          GST_TIME_ARGS(end_time - task->deadline));
+    }
+
+    if (GST_CLOCK_TIME_IS_VALID(start_cpu_time) && GST_CLOCK_TIME_IS_VALID(end_cpu_time)
+        && task->duration > 0) {
+      auto cpu_time = end_cpu_time - start_cpu_time;
+
+      client->cpu_time += cpu_time;
+      client->load = (1.0 - LOAD_SMOOTHING) * client->load +
+          LOAD_SMOOTHING * ((gdouble) cpu_time / task->duration);
+    }
+
+    task->done = TRUE;
+    scheduler_cond_signal(&task->cond);
+  }
+  scheduler_mutex_unlock(&scheduler->lock);
+
+  return nullptr;
+}
+
+static gpointer
+gst_vst_scheduler_new(gpointer data)
+{
+  auto scheduler = g_new0(GstVstScheduler, 1);
+  auto threads_env_var = g_getenv("GST_VST3_SCHEDULER_THREADS");
+  auto budget_env_var = g_getenv("GST_VST3_SCHEDULER_BUDGET");
+
+  scheduler->n_workers = MAX(g_get_num_processors(), 1);
+  if (threads_env_var) {
+    auto n_threads = g_ascii_strtoull(threads_env_var, nullptr, 10);
+    if (n_threads > 0 && n_threads <= G_MAXUINT)
+      scheduler->n_workers = n_threads;
+  }
+
+  scheduler->budget = DEFAULT_BUDGET;
+  if (budget_env_var) {
+    auto budget = g_ascii_strtod(budget_env_var, nullptr);
+    if (budget > 0.0 && budget <= 1.0)
+      scheduler->budget = budget;
+    else
+      GST_WARNING("Invalid scheduler budget '%s'", budget_env_var);
+  }
+
+  scheduler_mutex_init(&scheduler->lock);
+  scheduler_cond_init(&scheduler->cond);
+  g_queue_init(&scheduler->tasks);
+  scheduler->class_loads = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  GST_INFO("Starting scheduler with %u workers and a budget of %.2f",
+      scheduler->n_workers, scheduler->budget);
+
+  return scheduler;
+}
+
+static gpointer
+gst_vst_scheduler_start(gpointer data)
+{
+  auto scheduler = (GstVstScheduler *) data;
+
+  scheduler->workers = g_new0(GThread *, scheduler->n_workers);
+  for (auto i = 0U; i < scheduler->n_workers; i++) {
+    auto name = g_strdup_printf("vst-dsp-%u", i);
+    scheduler->workers[i] = g_thread_new(name, worker_thread, GUINT_TO_POINTER(i));
+    g_free(name);
+  }
+
+  return nullptr;
+}
+
+// The scheduler is shared by all elements and lives until the process exits.
+// The workers are only started once the first client registers
+GstVstScheduler *
+gst_vst_scheduler_get_default(void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once(&once, gst_vst_scheduler_new, nullptr);
+
+  return (GstVstScheduler *) once.retval;
+}
+
+// Returns the highest load measured for the plugin class so far, from both
+// current and previous clients. Classes that were never measured are assumed
+// to need DEFAULT_CLASS_LOAD. Must be called with the scheduler lock
+static gdouble
+get_expected_load(GstVstScheduler * scheduler, const gchar * class_name)
+{
+  auto class_load = (const gdouble *) g_hash_table_lookup(scheduler->class_loads, class_name);
+  auto expected_load = class_load ? *class_load : -1.0;
+
+  for (auto l = scheduler->clients; l; l = l->next) {
+    auto other = (GstVstSchedulerClient *) l->data;
+
+    if (other->n_tasks > 0 && g_strcmp0(other->class_name, class_name) == 0)
+      expected_load = MAX(expected_load, other->load);
+  }
+
+  return expected_load >= 0.0 ? expected_load : DEFAULT_CLASS_LOAD;
+}
+
+// Remembers the load of a client for projecting the load of later clients of
+// the same class. Must be called with the scheduler lock
+static void
+update_class_load(GstVstScheduler * scheduler, GstVstSchedulerClient * client)
+{
+  if (client->n_tasks == 0)
+    return;
+
+  auto class_load = (gdouble *) g_hash_table_lookup(scheduler->class_loads, client->class_name);
+  if (!class_load) {
+    class_load = g_new0(gdouble, 1);
+    g_hash_table_insert(scheduler->class_loads, g_strdup(client->class_name), class_load);
+  }
+  *class_load = MAX(*class_load, client->load);
+}
+
+// Registers a new client with the scheduler. Returns nullptr if the load of
+// all clients, together with the expected load of the new one, would exceed
+// the budget. See get_expected_load() for the expected load
+GstVstSchedulerClient *
+gst_vst_scheduler_client_new(GstVstScheduler * scheduler, GstObject * owner,
+    const gchar * class_name)
+{
+  static GOnce started = G_ONCE_INIT;
+  gdouble total_load = 0.0, expected_load = 0.0;
+
+  g_once(&started, gst_vst_scheduler_start, scheduler);
+
+  scheduler_mutex_lock(&scheduler->lock);
+  for (auto l = scheduler->clients; l; l = l->next)
+    total_load += ((GstVstSchedulerClient *) l->data)->load;
+  expected_load = get_expected_load(scheduler, class_name);
+
+  if (total_load + expected_load > scheduler->budget * scheduler->n_workers) {
+    scheduler_mutex_unlock(&scheduler->lock);
+    GST_WARNING_OBJECT(owner, "Refusing client, projected load %.2f exceeds budget %.2f",
+        total_load + expected_load, scheduler->budget * scheduler->n_workers);
+    return nullptr;
+  }
+
+  auto client = g_new0(GstVstSchedulerClient, 1);
+  client->scheduler = scheduler;
+  client->owner = owner;
+  client->class_name = g_strdup(class_name);
+  // Account for the expected load until the first measurements are in
+  client->load = expected_load;
+
+  scheduler->clients = g_list_prepend(scheduler->clients, client);
+  scheduler_mutex_unlock(&scheduler->lock);
+
+  GST_DEBUG_OBJECT(owner, "Registered with scheduler, projected load %.2f",
+      total_load + expected_load);
+
+  return client;
+}
+
+void
+gst_vst_scheduler_client_free(GstVstSchedulerClient * client)
+{
+  auto scheduler = client->scheduler;
+
+  scheduler_mutex_lock(&scheduler->lock);
+  scheduler->clients = g_list_remove(scheduler->clients, client);
+  update_class_load(scheduler, client);
+  GST_DEBUG_OBJECT(client->owner, "Unregistering from scheduler: load %.2f, "
+      "CPU time %" GST_TIME_FORMAT ", %" G_GUINT64_FORMAT " tasks, %"
+      G_GUINT64_FORMAT " late", client->load, GST_TIME_ARGS(client->cpu_time),
+      client->n_tasks, client->n_late);
+  scheduler_mutex_unlock(&scheduler->lock);
+
+  g_free(client->class_name);
+  g_free(client);
+}
+
+static gint
+compare_deadlines(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  auto task_a = (const Task *) a;
+  auto task_b = (const Task *) b;
+
+  if (task_a->deadline < task_b->deadline)
+    return -1;
+  if (task_a->deadline > task_b->deadline)
+    return 1;
+  return 0;
+}
+
+// Runs func on one of the workers and waits until it has finished. duration
+// is the amount of audio that is processed by func, which also gives the
+// deadline for the task: it has to be done before the next chunk of audio
+// arrives
+void
+gst_vst_scheduler_client_run(GstVstSchedulerClient * client,
+    GstClockTime duration, GstVstSchedulerFunc func, gpointer user_data)
+{
+  auto scheduler = client->scheduler;
+  Task task;
+
+  task.client = client;
+  task.func = func;
+  task.user_data = user_data;
+  task.deadline = get_monotonic_time() + duration;
+  task.duration = duration;
+  task.done = FALSE;
+  scheduler_cond_init(&task.cond);
+
+  scheduler_mutex_lock(&scheduler->lock);
+  g_queue_insert_sorted(&scheduler->tasks, &task, compare_deadlines, nullptr);
+  scheduler_cond_signal(&scheduler->cond);
+
+  while (!task.done)
+    scheduler_cond_wait(&task.cond, &scheduler->lock);
+  scheduler_mutex_unlock(&scheduler->lock);
+
+  scheduler_cond_clear(&task.cond);
+}
+
+// Average CPU time needed per time of audio processed by this client
+gdouble
+gst_vst_scheduler_client_get_load(GstVstSchedulerClient * client)
+{
+  scheduler_mutex_lock(&client->scheduler->lock);
+  auto load = client->load;
+  scheduler_mutex_unlock(&client->scheduler->lock);
+
+  return load;
+}
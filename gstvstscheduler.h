@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gst/gst.h>
+
+#ifndef __GST_VST_SCHEDULER_H__
+#define __GST_VST_SCHEDULER_H__
+
+G_BEGIN_DECLS
+
+// Process-wide DSP engine. A fixed number of workers, pinned to CPU cores and
+// running with real-time priority if permitted, execute the submitted tasks
+// in order of their deadlines. The CPU time used by every client is measured
+// and new clients are refused when the projected load would exceed the
+// configured budget.
+//
+// Configured via the GST_VST3_SCHEDULER_THREADS and GST_VST3_SCHEDULER_BUDGET
+// environment variables
+typedef struct _GstVstScheduler GstVstScheduler;
+
+// One registered user of the scheduler, usually one plugin instance
+typedef struct _GstVstSchedulerClient GstVstSchedulerClient;
+
+typedef void (*GstVstSchedulerFunc) (gpointer user_data);
+
+GstVstScheduler * gst_vst_scheduler_get_default(void);
+
+GstVstSchedulerClient * gst_vst_scheduler_client_new(GstVstScheduler * scheduler,
+    GstObject * owner, const gchar * class_name);
+void gst_vst_scheduler_client_free(GstVstSchedulerClient * client);
+
+void gst_vst_scheduler_client_run(GstVstSchedulerClient * client,
+    GstClockTime duration, GstVstSchedulerFunc func, gpointer user_data);
+
+gdouble gst_vst_scheduler_client_get_load(GstVstSchedulerClient * client);
+
+G_END_DECLS
+
+#endif /* __GST_VST_SCHEDULER_H__ */
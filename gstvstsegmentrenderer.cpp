@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "gstvstsegmentrenderer.h"
+
+#include <gst/base/base.h>
+
+GST_DEBUG_CATEGORY_EXTERN(gst_vst_audio_processor_debug);
+#define GST_CAT_DEFAULT gst_vst_audio_processor_debug
+
+using namespace Steinberg;
+
+typedef struct {
+  // Warm-up samples followed by the samples of the segment itself
+  GstBuffer *input;
+  guint overlap_samples;
+  // Sample position of the first warm-up sample
+  gint64 sample_position;
+  // Timestamp of the first sample after the warm-up
+  GstClockTime pts;
+  gboolean discont;
+  // Property values at the beginning of the segment
+  gdouble *parameter_values;
+
+  // Protected by the renderer lock
+  gboolean done;
+  gboolean failed;
+  GstBuffer *output;
+} Segment;
+
+struct _GstVstSegmentRenderer {
+  GstElement *element;
+  GstPad *srcpad;
+  const GstVstAudioProcessorInfo *processor_info;
+  GstAudioInfo info;
+  gint max_samples_per_chunk;
+  guint n_threads;
+  guint segment_samples;
+  guint overlap_samples;
+
+  // Streaming thread only
+  GstAdapter *adapter;
+  // Number of samples at the start of the adapter that belong to the
+  // previous segment and are only used for warming up the next one
+  guint adapter_overlap;
+  GstClockTime next_pts;
+  gint64 next_sample_position;
+  gboolean discont;
+  // Property values passed with the last buffer
+  gdouble *parameter_values;
+
+  GThreadPool *pool;
+
+  GMutex lock;
+  GCond cond;
+  // Pending segments in stream order
+  GQueue segments;
+  // Instances that are set up and can be used for the next segment
+  GQueue idle_instances;
+  gboolean flushing;
+};
+
+static void
+segment_free(Segment * segment)
+{
+  gst_buffer_unref(segment->input);
+  if (segment->output)
+    gst_buffer_unref(segment->output);
+  g_free(segment->parameter_values);
+  g_free(segment);
+}
+
+static GstVstInstance *
+gst_vst_segment_renderer_get_instance(GstVstSegmentRenderer * renderer)
+{
+  g_mutex_lock(&renderer->lock);
+  auto instance = (GstVstInstance *) g_queue_pop_head(&renderer->idle_instances);
+  g_mutex_unlock(&renderer->lock);
+
+  if (instance)
+    return instance;
+
+  instance = new GstVstInstance();
+  if (!gst_vst_instance_open(instance, renderer->element, renderer->processor_info)
+      || !gst_vst_instance_setup(instance, &renderer->info, Vst::kOffline,
+          renderer->max_samples_per_chunk)) {
+    gst_vst_instance_close(instance);
+    delete instance;
+    return nullptr;
+  }
+
+  return instance;
+}
+
+static gboolean
+gst_vst_segment_renderer_render(GstVstSegmentRenderer * renderer,
+    GstVstInstance * instance, Segment * segment)
+{
+  auto bpf = renderer->info.bpf;
+  auto parameter_changes = gst_vst_instance_sync_parameters(instance, segment->parameter_values, FALSE);
+
+  if (!gst_vst_instance_activate(instance)) {
+    delete parameter_changes;
+    return FALSE;
+  }
+
+  GstMapInfo in_map, out_map;
+  gst_buffer_map(segment->input, &in_map, GST_MAP_READ);
+
+  auto num_samples = (guint) (in_map.size / bpf);
+  auto output = gst_buffer_new_and_alloc(in_map.size);
+  gst_buffer_map(output, &out_map, GST_MAP_WRITE);
+
+  auto ret = TRUE;
+  for (auto offset = 0U; offset < num_samples; ) {
+    auto chunk_size = MIN(instance->data_len, num_samples - offset);
+    auto &out_parameter_changes = *gst_vst_instance_get_out_parameter_changes(instance);
+    guint n_out_samples = 0;
+
+    if (G_UNLIKELY(g_atomic_int_get(&renderer->flushing))) {
+      ret = FALSE;
+      break;
+    }
+
+    auto res = gst_vst_instance_process(instance, in_map.data + offset * bpf,
+        out_map.data + offset * bpf, chunk_size,
+        segment->sample_position + offset, FALSE,
+        parameter_changes, &out_parameter_changes, &n_out_samples);
+
+    if (parameter_changes) {
+      delete parameter_changes;
+      parameter_changes = nullptr;
+    }
+
+    if (res != kResultOk) {
+      GST_ERROR_OBJECT(renderer->element, "Failed to process segment: %08x", res);
+      ret = FALSE;
+      break;
+    }
+
+    if (n_out_samples < chunk_size)
+      memset(out_map.data + (offset + n_out_samples) * bpf, 0, (chunk_size - n_out_samples) * bpf);
+
+    offset += chunk_size;
+  }
+
+  gst_buffer_unmap(output, &out_map);
+  gst_buffer_unmap(segment->input, &in_map);
+
+  if (parameter_changes)
+    delete parameter_changes;
+
+  // Reset the instance for the next segment
+  gst_vst_instance_deactivate(instance);
+
+  if (!ret) {
+    gst_buffer_unref(output);
+    return FALSE;
+  }
+
+  // Throw away the output of the warm-up
+  gst_buffer_resize(output, segment->overlap_samples * bpf,
+      (num_samples - segment->overlap_samples) * bpf);
+  segment->output = output;
+
+  return TRUE;
+}
+
+static void
+gst_vst_segment_renderer_worker(gpointer data, gpointer user_data)
+{
+  auto segment = (Segment *) data;
+  auto renderer = (GstVstSegmentRenderer *) user_data;
+  auto ret = FALSE;
+
+  auto instance = gst_vst_segment_renderer_get_instance(renderer);
+  if (instance) {
+    GST_LOG_OBJECT(renderer->element, "Rendering segment at %" GST_TIME_FORMAT,
+        GST_TIME_ARGS(segment->pts));
+    ret = gst_vst_segment_renderer_render(renderer, instance, segment);
+  }
+
+  g_mutex_lock(&renderer->lock);
+  if (instance)
+    g_queue_push_tail(&renderer->idle_instances, instance);
+  segment->failed = !ret && !renderer->flushing;
+  segment->done = TRUE;
+  g_cond_broadcast(&renderer->cond);
+  g_mutex_unlock(&renderer->lock);
+}
+
+GstVstSegmentRenderer *
+gst_vst_segment_renderer_new(GstElement * element, GstPad * srcpad,
+    const GstVstAudioProcessorInfo * processor_info, const GstAudioInfo * info,
+    gint max_samples_per_chunk, guint n_threads, guint segment_samples,
+    guint overlap_samples)
+{
+  auto renderer = g_new0(GstVstSegmentRenderer, 1);
+  GError *err = nullptr;
+
+  renderer->element = element;
+  renderer->srcpad = srcpad;
+  renderer->processor_info = processor_info;
+  renderer->info = *info;
+  renderer->max_samples_per_chunk = max_samples_per_chunk;
+  renderer->n_threads = n_threads;
+  renderer->segment_samples = MAX(segment_samples, 1);
+  renderer->overlap_samples = overlap_samples;
+
+  renderer->adapter = gst_adapter_new();
+  renderer->next_pts = GST_CLOCK_TIME_NONE;
+  renderer->discont = TRUE;
+  renderer->parameter_values = g_new0(gdouble, processor_info->n_properties);
+
+  g_mutex_init(&renderer->lock);
+  g_cond_init(&renderer->cond);
+  g_queue_init(&renderer->segments);
+  g_queue_init(&renderer->idle_instances);
+
+  renderer->pool = g_thread_pool_new(gst_vst_segment_renderer_worker, renderer,
+      n_threads, FALSE, &err);
+  if (!renderer->pool) {
+    GST_ERROR_OBJECT(element, "Failed to create thread pool: %s", err->message);
+    g_clear_error(&err);
+    gst_vst_segment_renderer_free(renderer);
+    return nullptr;
+  }
+
+  GST_DEBUG_OBJECT(element, "Rendering segments of %u samples with %u samples "
+      "overlap on %u threads", renderer->segment_samples, overlap_samples, n_threads);
+
+  return renderer;
+}
+
+void
+gst_vst_segment_renderer_free(GstVstSegmentRenderer * renderer)
+{
+  gst_vst_segment_renderer_flush(renderer);
+
+  if (renderer->pool)
+    g_thread_pool_free(renderer->pool, FALSE, TRUE);
+
+  GstVstInstance *instance;
+  while ((instance = (GstVstInstance *) g_queue_pop_head(&renderer->idle_instances))) {
+    gst_vst_instance_close(instance);
+    delete instance;
+  }
+
+  g_object_unref(renderer->adapter);
+  g_free(renderer->parameter_values);
+  g_mutex_clear(&renderer->lock);
+  g_cond_clear(&renderer->cond);
+  g_free(renderer);
+}
+
+// Takes all new samples from the adapter, or at most segment_samples, and
+// queues them as a new segment
+static gboolean
+gst_vst_segment_renderer_queue_segment(GstVstSegmentRenderer * renderer)
+{
+  auto n_properties = renderer->processor_info->n_properties;
+  auto bpf = renderer->info.bpf;
+  auto available = (guint) (gst_adapter_available(renderer->adapter) / bpf);
+  auto n_samples = MIN(available - renderer->adapter_overlap, renderer->segment_samples);
+  auto n_total = renderer->adapter_overlap + n_samples;
+
+  auto segment = g_new0(Segment, 1);
+  segment->input = gst_adapter_get_buffer(renderer->adapter, n_total * bpf);
+  segment->overlap_samples = renderer->adapter_overlap;
+  segment->sample_position = renderer->next_sample_position - renderer->adapter_overlap;
+  segment->pts = renderer->next_pts;
+  segment->discont = renderer->discont;
+  segment->parameter_values = g_new(gdouble, n_properties);
+  memcpy(segment->parameter_values, renderer->parameter_values, sizeof(gdouble) * n_properties);
+
+  // Keep the end of this segment around for warming up the next one
+  auto keep = MIN(renderer->overlap_samples, n_total);
+  gst_adapter_flush(renderer->adapter, (n_total - keep) * bpf);
+  renderer->adapter_overlap = keep;
+
+  renderer->next_pts += gst_util_uint64_scale_int(n_samples, GST_SECOND, renderer->info.rate);
+  renderer->next_sample_position += n_samples;
+  renderer->discont = FALSE;
+
+  g_mutex_lock(&renderer->lock);
+  g_queue_push_tail(&renderer->segments, segment);
+  g_mutex_unlock(&renderer->lock);
+
+  return g_thread_pool_push(renderer->pool, segment, nullptr);
+}
+
+// Pushes all finished segments at the head of the queue downstream, waiting
+// for the head to finish as long as more than max_pending segments are queued
+static GstFlowReturn
+gst_vst_segment_renderer_push_finished(GstVstSegmentRenderer * renderer,
+    guint max_pending)
+{
+  auto ret = GST_FLOW_OK;
+
+  g_mutex_lock(&renderer->lock);
+  while (ret == GST_FLOW_OK) {
+    auto segment = (Segment *) g_queue_peek_head(&renderer->segments);
+    if (!segment)
+      break;
+
+    if (!segment->done) {
+      if (g_queue_get_length(&renderer->segments) <= max_pending)
+        break;
+      g_cond_wait(&renderer->cond, &renderer->lock);
+      continue;
+    }
+
+    g_queue_pop_head(&renderer->segments);
+    g_mutex_unlock(&renderer->lock);
+
+    if (segment->failed) {
+      GST_ELEMENT_ERROR(renderer->element, STREAM, FAILED, (nullptr),
+          ("Failed to render segment at %" GST_TIME_FORMAT, GST_TIME_ARGS(segment->pts)));
+      ret = GST_FLOW_ERROR;
+    } else if (segment->output && gst_buffer_get_size(segment->output) > 0) {
+      auto output = segment->output;
+      segment->output = nullptr;
+
+      GST_BUFFER_PTS(output) = segment->pts;
+      GST_BUFFER_DURATION(output) = gst_util_uint64_scale_int(
+          gst_buffer_get_size(output) / renderer->info.bpf, GST_SECOND, renderer->info.rate);
+      if (segment->discont)
+        GST_BUFFER_FLAG_SET(output, GST_BUFFER_FLAG_DISCONT);
+
+      ret = gst_pad_push(renderer->srcpad, output);
+    }
+
+    segment_free(segment);
+    g_mutex_lock(&renderer->lock);
+  }
+  g_mutex_unlock(&renderer->lock);
+
+  return ret;
+}
+
+GstFlowReturn
+gst_vst_segment_renderer_chain(GstVstSegmentRenderer * renderer,
+    GstBuffer * buffer, const gdouble * parameter_values)
+{
+  auto bpf = renderer->info.bpf;
+
+  // New segments are rendered with the values of the last buffer that
+  // contributed to them
+  memcpy(renderer->parameter_values, parameter_values,
+      sizeof(gdouble) * renderer->processor_info->n_properties);
+
+  // Start from scratch after discontinuities, the samples before don't
+  // belong to this part of the stream
+  if (GST_BUFFER_IS_DISCONT(buffer)) {
+    if (gst_adapter_available(renderer->adapter) / bpf > renderer->adapter_overlap)
+      gst_vst_segment_renderer_queue_segment(renderer);
+    gst_adapter_clear(renderer->adapter);
+    renderer->adapter_overlap = 0;
+    renderer->next_pts = GST_CLOCK_TIME_NONE;
+    renderer->discont = TRUE;
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID(renderer->next_pts)) {
+    renderer->next_pts = GST_BUFFER_PTS(buffer);
+    renderer->next_sample_position = (gint64) gst_util_uint64_scale(GST_BUFFER_PTS(buffer),
+        renderer->info.rate, GST_SECOND);
+  }
+
+  gst_adapter_push(renderer->adapter, buffer);
+
+  while (gst_adapter_available(renderer->adapter) / bpf >=
+      renderer->adapter_overlap + renderer->segment_samples) {
+    if (!gst_vst_segment_renderer_queue_segment(renderer))
+      return GST_FLOW_ERROR;
+  }
+
+  // Keep a bounded number of segments in flight
+  return gst_vst_segment_renderer_push_finished(renderer, 2 * renderer->n_threads);
+}
+
+GstFlowReturn
+gst_vst_segment_renderer_drain(GstVstSegmentRenderer * renderer)
+{
+  auto bpf = renderer->info.bpf;
+
+  // Render the last, partial segment
+  if (gst_adapter_available(renderer->adapter) / bpf > renderer->adapter_overlap)
+    gst_vst_segment_renderer_queue_segment(renderer);
+
+  auto ret = gst_vst_segment_renderer_push_finished(renderer, 0);
+
+  gst_adapter_clear(renderer->adapter);
+  renderer->adapter_overlap = 0;
+  renderer->next_pts = GST_CLOCK_TIME_NONE;
+  renderer->discont = TRUE;
+
+  return ret;
+}
+
+void
+gst_vst_segment_renderer_flush(GstVstSegmentRenderer * renderer)
+{
+  g_mutex_lock(&renderer->lock);
+  g_atomic_int_set(&renderer->flushing, TRUE);
+  while (!g_queue_is_empty(&renderer->segments)) {
+    auto segment = (Segment *) g_queue_peek_head(&renderer->segments);
+
+    if (!segment->done) {
+      g_cond_wait(&renderer->cond, &renderer->lock);
+      continue;
+    }
+    g_queue_pop_head(&renderer->segments);
+    segment_free(segment);
+  }
+  g_atomic_int_set(&renderer->flushing, FALSE);
+  g_mutex_unlock(&renderer->lock);
+
+  gst_adapter_clear(renderer->adapter);
+  renderer->adapter_overlap = 0;
+  renderer->next_pts = GST_CLOCK_TIME_NONE;
+  renderer->discont = TRUE;
+}
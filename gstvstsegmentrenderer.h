@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+#include "gstvstinstance.h"
+
+#ifndef __GST_VST_SEGMENT_RENDERER_H__
+#define __GST_VST_SEGMENT_RENDERER_H__
+
+// Offline rendering of a stream by cutting it into segments that are each
+// processed by their own plugin instance on a worker thread. Every segment
+// is preceded by overlap_samples of the previous segment's input to warm up
+// the instance, and the corresponding output is discarded. The rendered
+// segments are pushed on srcpad in stream order.
+//
+// All functions must be called from the streaming thread
+typedef struct _GstVstSegmentRenderer GstVstSegmentRenderer;
+
+GstVstSegmentRenderer * gst_vst_segment_renderer_new(GstElement * element,
+    GstPad * srcpad, const GstVstAudioProcessorInfo * processor_info,
+    const GstAudioInfo * info, gint max_samples_per_chunk, guint n_threads,
+    guint segment_samples, guint overlap_samples);
+void gst_vst_segment_renderer_free(GstVstSegmentRenderer * renderer);
+
+GstFlowReturn gst_vst_segment_renderer_chain(GstVstSegmentRenderer * renderer,
+    GstBuffer * buffer, const gdouble * parameter_values);
+GstFlowReturn gst_vst_segment_renderer_drain(GstVstSegmentRenderer * renderer);
+void gst_vst_segment_renderer_flush(GstVstSegmentRenderer * renderer);
+
+#endif /* __GST_VST_SEGMENT_RENDERER_H__ */
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "gstvstthreadpool.h"
+
+GST_DEBUG_CATEGORY_EXTERN(gst_vst_audio_processor_debug);
+#define GST_CAT_DEFAULT gst_vst_audio_processor_debug
+
+typedef struct {
+  GstVstThreadPoolFunc func;
+  gpointer user_data;
+
+  GMutex lock;
+  GCond cond;
+  gboolean done;
+} Task;
+
+typedef struct {
+  GstVstThreadPool *pool;
+  guint index;
+  GThread *thread;
+
+  GMutex lock;
+  GQueue tasks;
+} Worker;
+
+struct _GstVstThreadPool {
+  guint n_workers;
+  Worker *workers;
+  // Worker the next task is queued on
+  gint next_worker;
+
+  // Number of queued tasks that were not picked up by any worker yet. Can
+  // briefly be negative if a task is taken before it was accounted for
+  GMutex lock;
+  GCond cond;
+  gint n_pending;
+};
+
+static Task *
+worker_pop_task(Worker * worker)
+{
+  auto pool = worker->pool;
+  Task *task;
+
+  // Own tasks are taken from the front
+  g_mutex_lock(&worker->lock);
+  task = (Task *) g_queue_pop_head(&worker->tasks);
+  g_mutex_unlock(&worker->lock);
+
+  // Other workers' tasks are stolen from the back
+  for (auto i = 1U; !task && i < pool->n_workers; i++) {
+    auto victim = &pool->workers[(worker->index + i) % pool->n_workers];
+
+    g_mutex_lock(&victim->lock);
+    task = (Task *) g_queue_pop_tail(&victim->tasks);
+    g_mutex_unlock(&victim->lock);
+  }
+
+  if (task) {
+    g_mutex_lock(&pool->lock);
+    pool->n_pending--;
+    g_mutex_unlock(&pool->lock);
+  }
+
+  return task;
+}
+
+static gpointer
+worker_thread(gpointer data)
+{
+  auto worker = (Worker *) data;
+  auto pool = worker->pool;
+
+  while (TRUE) {
+    auto task = worker_pop_task(worker);
+
+    if (!task) {
+      g_mutex_lock(&pool->lock);
+      while (pool->n_pending <= 0)
+        g_cond_wait(&pool->cond, &pool->lock);
+      g_mutex_unlock(&pool->lock);
+      continue;
+    }
+
+    task->func(task->user_data);
+
+    g_mutex_lock(&task->lock);
+    task->done = TRUE;
+    g_cond_signal(&task->cond);
+    g_mutex_unlock(&task->lock);
+  }
+
+  return nullptr;
+}
+
+static gpointer
+gst_vst_thread_pool_new(gpointer data)
+{
+  auto pool = g_new0(GstVstThreadPool, 1);
+
+  pool->n_workers = MAX(g_get_num_processors(), 1);
+  pool->workers = g_new0(Worker, pool->n_workers);
+  g_mutex_init(&pool->lock);
+  g_cond_init(&pool->cond);
+
+  GST_DEBUG("Starting thread pool with %u workers", pool->n_workers);
+
+  for (auto i = 0U; i < pool->n_workers; i++) {
+    auto worker = &pool->workers[i];
+
+    worker->pool = pool;
+    worker->index = i;
+    g_mutex_init(&worker->lock);
+    g_queue_init(&worker->tasks);
+  }
+
+  for (auto i = 0U; i < pool->n_workers; i++) {
+    auto name = g_strdup_printf("vst-worker-%u", i);
+    pool->workers[i].thread = g_thread_new(name, worker_thread, &pool->workers[i]);
+    g_free(name);
+  }
+
+  return pool;
+}
+
+// The pool is shared by all elements and lives until the process exits
+GstVstThreadPool *
+gst_vst_thread_pool_get_default(void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once(&once, gst_vst_thread_pool_new, nullptr);
+
+  return (GstVstThreadPool *) once.retval;
+}
+
+// Runs func on one of the workers of the pool and waits until it has finished
+void
+gst_vst_thread_pool_run(GstVstThreadPool * pool, GstVstThreadPoolFunc func,
+    gpointer user_data)
+{
+  Task task;
+
+  task.func = func;
+  task.user_data = user_data;
+  task.done = FALSE;
+  g_mutex_init(&task.lock);
+  g_cond_init(&task.cond);
+
+  auto worker = &pool->workers[(guint) g_atomic_int_add(&pool->next_worker, 1) % pool->n_workers];
+
+  g_mutex_lock(&worker->lock);
+  g_queue_push_tail(&worker->tasks, &task);
+  g_mutex_unlock(&worker->lock);
+
+  g_mutex_lock(&pool->lock);
+  pool->n_pending++;
+  g_cond_signal(&pool->cond);
+  g_mutex_unlock(&pool->lock);
+
+  g_mutex_lock(&task.lock);
+  while (!task.done)
+    g_cond_wait(&task.cond, &task.lock);
+  g_mutex_unlock(&task.lock);
+
+  g_mutex_clear(&task.lock);
+  g_cond_clear(&task.cond);
+}
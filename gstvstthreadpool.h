@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gst/gst.h>
+
+#ifndef __GST_VST_THREAD_POOL_H__
+#define __GST_VST_THREAD_POOL_H__
+
+G_BEGIN_DECLS
+
+// A fixed-size pool of worker threads, each with its own task queue. Idle
+// workers steal tasks from the queues of the other workers so that the
+// load is spread evenly while no more threads than CPU cores are running
+// plugin code at any time
+typedef struct _GstVstThreadPool GstVstThreadPool;
+
+typedef void (*GstVstThreadPoolFunc) (gpointer user_data);
+
+GstVstThreadPool * gst_vst_thread_pool_get_default(void);
+
+void gst_vst_thread_pool_run(GstVstThreadPool * pool, GstVstThreadPoolFunc func,
+    gpointer user_data);
+
+G_END_DECLS
+
+#endif /* __GST_VST_THREAD_POOL_H__ */
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+// The tracer API was only declared stable in later GStreamer versions
+#define GST_USE_UNSTABLE_API
+
+#include "gstvsttracer.h"
+
+#if defined(G_OS_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+GST_DEBUG_CATEGORY_STATIC(gst_vst_tracer_debug);
+#define GST_CAT_DEFAULT gst_vst_tracer_debug
+
+// CPU time consumed by the calling thread so far, or GST_CLOCK_TIME_NONE if
+// this is not supported on this platform
+GstClockTime
+gst_vst_get_thread_cpu_time(void)
+{
+#if defined(G_OS_WIN32)
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+
+  if (!GetThreadTimes(GetCurrentThread(), &creation_time, &exit_time, &kernel_time, &user_time))
+    return GST_CLOCK_TIME_NONE;
+
+  auto kernel = ((guint64) kernel_time.dwHighDateTime << 32) | kernel_time.dwLowDateTime;
+  auto user = ((guint64) user_time.dwHighDateTime << 32) | user_time.dwLowDateTime;
+
+  // FILETIME is in 100ns units
+  return (kernel + user) * 100;
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return GST_CLOCK_TIME_NONE;
+
+  return GST_TIMESPEC_TO_TIME(ts);
+#else
+  return GST_CLOCK_TIME_NONE;
+#endif
+}
+
+#ifndef GST_DISABLE_GST_TRACER_HOOKS
+
+// The vst3 tracer measures the wall-clock and thread CPU time of every call
+// into a plugin and logs it together with the element, the plugin class and
+// the number of samples, e.g.
+//
+//   GST_TRACERS="vst3" GST_DEBUG="GST_TRACER:7" gst-launch-1.0 ...
+typedef struct _GstVstTracer GstVstTracer;
+typedef struct _GstVstTracerClass GstVstTracerClass;
+
+struct _GstVstTracer {
+  GstTracer parent;
+};
+
+struct _GstVstTracerClass {
+  GstTracerClass parent_class;
+};
+
+GType gst_vst_tracer_get_type(void);
+
+G_DEFINE_TYPE(GstVstTracer, gst_vst_tracer, GST_TYPE_TRACER);
+
+gint _gst_vst_tracer_n_active = 0;
+
+static GstTracerRecord *tr_call = nullptr;
+
+static const gchar *call_names[] = {
+  "module-create",
+  "initialize",
+  "setup-processing",
+  "set-active",
+  "process",
+};
+
+// Start of the call currently running on this thread. Calls into the plugin
+// are never nested so one slot per thread is enough
+static thread_local GstClockTime call_start_time = GST_CLOCK_TIME_NONE;
+static thread_local GstClockTime call_start_cpu_time = GST_CLOCK_TIME_NONE;
+
+void
+_gst_vst_tracer_hook_pre(GstElement * element, const gchar * class_name,
+    GstVstTracerCall call, guint n_samples)
+{
+  call_start_time = gst_util_get_timestamp();
+  call_start_cpu_time = gst_vst_get_thread_cpu_time();
+}
+
+void
+_gst_vst_tracer_hook_post(GstElement * element, const gchar * class_name,
+    GstVstTracerCall call, guint n_samples, gint result)
+{
+  auto end_cpu_time = gst_vst_get_thread_cpu_time();
+  auto end_time = gst_util_get_timestamp();
+
+  // A tracer was started while the call was running
+  if (!GST_CLOCK_TIME_IS_VALID(call_start_time))
+    return;
+
+  GstClockTime cpu_time = GST_CLOCK_TIME_NONE;
+  if (GST_CLOCK_TIME_IS_VALID(call_start_cpu_time) && GST_CLOCK_TIME_IS_VALID(end_cpu_time))
+    cpu_time = end_cpu_time - call_start_cpu_time;
+
+  gst_tracer_record_log(tr_call,
+      (guint64) (guintptr) g_thread_self(),
+      GST_OBJECT_NAME(element),
+      class_name,
+      call_names[call],
+      n_samples,
+      call_start_time,
+      end_time - call_start_time,
+      cpu_time,
+      result);
+
+  call_start_time = GST_CLOCK_TIME_NONE;
+  call_start_cpu_time = GST_CLOCK_TIME_NONE;
+}
+
+static void
+gst_vst_tracer_finalize(GObject * object)
+{
+  g_atomic_int_add(&_gst_vst_tracer_n_active, -1);
+
+  G_OBJECT_CLASS(gst_vst_tracer_parent_class)->finalize(object);
+}
+
+static void
+gst_vst_tracer_class_init(GstVstTracerClass * klass)
+{
+  auto gobject_class = G_OBJECT_CLASS(klass);
+
+  gobject_class->finalize = gst_vst_tracer_finalize;
+
+  tr_call = gst_tracer_record_new("vst3-call.class",
+      "thread-id", GST_TYPE_STRUCTURE, gst_structure_new("scope",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "related-to", GST_TYPE_TRACER_VALUE_SCOPE, GST_TRACER_VALUE_SCOPE_THREAD,
+          nullptr),
+      "element", GST_TYPE_STRUCTURE, gst_structure_new("value",
+          "type", G_TYPE_GTYPE, G_TYPE_STRING,
+          "description", G_TYPE_STRING, "name of the element",
+          nullptr),
+      "class", GST_TYPE_STRUCTURE, gst_structure_new("value",
+          "type", G_TYPE_GTYPE, G_TYPE_STRING,
+          "description", G_TYPE_STRING, "VST3 plugin class name",
+          nullptr),
+      "call", GST_TYPE_STRUCTURE, gst_structure_new("value",
+          "type", G_TYPE_GTYPE, G_TYPE_STRING,
+          "description", G_TYPE_STRING, "plugin function that was called",
+          nullptr),
+      "samples", GST_TYPE_STRUCTURE, gst_structure_new("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT,
+          "description", G_TYPE_STRING, "number of samples processed or configured",
+          nullptr),
+      "ts", GST_TYPE_STRUCTURE, gst_structure_new("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "start of the call",
+          "min", G_TYPE_UINT64, G_GUINT64_CONSTANT(0),
+          "max", G_TYPE_UINT64, G_MAXUINT64,
+          nullptr),
+      "time", GST_TYPE_STRUCTURE, gst_structure_new("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "wall-clock time spent in the call in ns",
+          "min", G_TYPE_UINT64, G_GUINT64_CONSTANT(0),
+          "max", G_TYPE_UINT64, G_MAXUINT64,
+          nullptr),
+      "cpu-time", GST_TYPE_STRUCTURE, gst_structure_new("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "thread CPU time spent in the call in ns",
+          "min", G_TYPE_UINT64, G_GUINT64_CONSTANT(0),
+          "max", G_TYPE_UINT64, G_MAXUINT64,
+          nullptr),
+      "result", GST_TYPE_STRUCTURE, gst_structure_new("value",
+          "type", G_TYPE_GTYPE, G_TYPE_INT,
+          "description", G_TYPE_STRING, "tresult returned by the plugin",
+          nullptr),
+      nullptr);
+  GST_OBJECT_FLAG_SET(tr_call, GST_OBJECT_FLAG_MAY_BE_LEAKED);
+}
+
+static void
+gst_vst_tracer_init(GstVstTracer * self)
+{
+  g_atomic_int_add(&_gst_vst_tracer_n_active, 1);
+}
+
+#endif
+
+void
+gst_vst_tracer_register(GstPlugin * plugin)
+{
+  GST_DEBUG_CATEGORY_INIT(gst_vst_tracer_debug, "vst-tracer", 0,
+      "VST Tracer");
+
+#ifndef GST_DISABLE_GST_TRACER_HOOKS
+  gst_tracer_register(plugin, "vst3", gst_vst_tracer_get_type());
+#endif
+}
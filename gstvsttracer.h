@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2017 Sebastian Dröge <sebastian@centricular.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gst/gst.h>
+
+#ifndef __GST_VST_TRACER_H__
+#define __GST_VST_TRACER_H__
+
+G_BEGIN_DECLS
+
+// The calls into the plugin that are reported to tracers
+typedef enum {
+  GST_VST_TRACER_CALL_MODULE_CREATE = 0,
+  GST_VST_TRACER_CALL_INITIALIZE,
+  GST_VST_TRACER_CALL_SETUP_PROCESSING,
+  GST_VST_TRACER_CALL_SET_ACTIVE,
+  GST_VST_TRACER_CALL_PROCESS,
+} GstVstTracerCall;
+
+void gst_vst_tracer_register(GstPlugin * plugin);
+
+GstClockTime gst_vst_get_thread_cpu_time(void);
+
+#ifndef GST_DISABLE_GST_TRACER_HOOKS
+
+extern gint _gst_vst_tracer_n_active;
+
+void _gst_vst_tracer_hook_pre(GstElement * element, const gchar * class_name,
+    GstVstTracerCall call, guint n_samples);
+void _gst_vst_tracer_hook_post(GstElement * element, const gchar * class_name,
+    GstVstTracerCall call, guint n_samples, gint result);
+
+// Hooks around calls into the plugin. These are a single atomic read unless
+// a vst3 tracer is running
+#define GST_VST_TRACER_PRE(element, class_name, call, n_samples) G_STMT_START { \
+  if (G_UNLIKELY(g_atomic_int_get(&_gst_vst_tracer_n_active) > 0)) \
+    _gst_vst_tracer_hook_pre(GST_ELEMENT_CAST(element), class_name, call, n_samples); \
+} G_STMT_END
+
+#define GST_VST_TRACER_POST(element, class_name, call, n_samples, result) G_STMT_START { \
+  if (G_UNLIKELY(g_atomic_int_get(&_gst_vst_tracer_n_active) > 0)) \
+    _gst_vst_tracer_hook_post(GST_ELEMENT_CAST(element), class_name, call, n_samples, result); \
+} G_STMT_END
+
+#else
+
+#define GST_VST_TRACER_PRE(element, class_name, call, n_samples)
+#define GST_VST_TRACER_POST(element, class_name, call, n_samples, result)
+
+#endif
+
+G_END_DECLS
+
+#endif /* __GST_VST_TRACER_H__ */
@@ -25,6 +25,7 @@
 #include <string>
 
 #include "gstvstaudioprocessor.h"
+#include "gstvsttracer.h"
 
 using namespace Steinberg;
 
@@ -54,6 +55,7 @@ plugin_init(GstPlugin * plugin)
   gStandardPluginContext = new GStreamerHostApplication();
 
   gst_vst_audio_processor_register(plugin);
+  gst_vst_tracer_register(plugin);
 
   return TRUE;
 }